@@ -10,16 +10,32 @@ DEFINES += TIO_VERSION=\\\"$$VERSION\\\"
 TARGET=tio-agent
 
 SOURCES += src/logmsg.c \
-    src/rb.c \
     src/read_line.c \
     src/translate_agent.c \
     src/translate_parser.c \
+    src/translate_trie.c \
+    src/translate_dfa.c \
+    src/translate_image.c \
     src/translate_sio.c \
+    src/translate_event.c \
+    src/translate_uring.c \
+    src/translate_output.c \
+    src/translate_reload.c \
+    src/translate_pipeline.c \
     src/translate_socket.c \
+    src/translate_stats.c \
+    src/translate_histogram.c \
     src/die_with_message.c
 
-HEADERS += src/libtree.h \
-    src/read_line.h \
+HEADERS += src/read_line.h \
     src/translate_agent.h \
-    src/translate_parser.h
+    src/translate_event.h \
+    src/translate_uring.h \
+    src/translate_output.h \
+    src/translate_reload.h \
+    src/translate_pipeline.h \
+    src/translate_stats.h \
+    src/translate_histogram.h \
+    src/translate_parser.h \
+    src/translate_rules.h
 
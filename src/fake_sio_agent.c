@@ -0,0 +1,488 @@
+/*
+ * fake_sio_agent.c
+ *
+ * Stand-in for sio_agent for testing tio-agent without hardware.  It listens
+ * where sio_agent would, sends synthetic micro telemetry to the agent that
+ * connects at a steady rate, and echoes or acknowledges the commands the
+ * agent passes on from the qml-viewers.  To exercise the agent's error
+ * handling it can drop the connection at intervals and read slowly.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "tio_keys.h"
+#include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_output.h"
+#include "translate_stats.h"
+
+#define DEFAULT_RATE 10
+#define DEFAULT_KEYS 20
+#define DEFAULT_REPLY "echo"
+
+/* how often telemetry is generated and the read budget topped up */
+#define TICK_NS 1000000
+
+/* telemetry isn't queued beyond this while the agent isn't reading */
+#define MAX_BACKLOG (1024 * 1024)
+
+static int keepGoing;
+static const char *progName;
+
+/**
+ * The settings and state of the fake sio_agent.
+ */
+struct FakeSio
+{
+    /* settings */
+    double rate;                /* telemetry messages per second */
+    const char *reply;          /* "echo", "none" or the text to reply */
+    unsigned disconnectAfter;   /* seconds, 0 = never */
+    uint64_t readRate;          /* bytes per second read, 0 = unlimited */
+    int verbose;
+    int noDelay;
+    struct TioKeySet keys;
+
+    int listenFd;
+    int addressFamily;
+
+    /* the connection to tio-agent, -1 while there is none */
+    int fd;
+    uint64_t connectedAt;
+    uint64_t generated;         /* telemetry due since connectedAt */
+    struct TioOutQueue out;
+
+    /* characters received, not yet a complete command */
+    char in[READ_BUF_SIZE];
+    size_t inLength;
+
+    /*
+     * what the slow reader may still read, in byte nanoseconds so that slow
+     * rates add up over the ticks; reading stops below a byte
+     */
+    uint64_t readBudget;
+    int reading;
+
+    /* messages being put together for the next write */
+    char *batch;
+    size_t batchSize;
+    size_t batchLength;
+
+    uint64_t connects;
+    uint64_t disconnects;       /* injected */
+    uint64_t telemetry;
+    uint64_t telemetryDropped;  /* not sent since the agent wasn't reading */
+    uint64_t commands;
+    uint64_t replies;
+};
+
+static struct FakeSio fake;
+
+static void fakeSioDumpHelp(void)
+{
+    fprintf(stderr, "Fake SIO Agent %s \n\n", TIO_VERSION);
+
+    fprintf(stderr, "usage: %s [options]\n"
+        "  where options are:\n"
+        "    -a<reply>     | --reply=<reply>        \"echo\", \"none\" or text to reply, default = %s\n"
+        "    -b<bytes>     | --read-rate=<bytes>    read at most <bytes> per second\n"
+        "    -D<seconds>   | --disconnect=<seconds> drop the connection every <seconds>\n"
+        "    -f<path>      | --file=<path>          send the M: keys of this translation file\n"
+        "    -k<count>     | --keys=<count>         keys made up without -f, default = %d\n"
+        "    -r<rate>      | --rate=<rate>          telemetry messages per second, default = %d\n"
+        "    -s[<port>]    | --sio-port[=<port>]    use TCP socket, default = %d\n"
+        "    -v            | --verbose              print the commands received\n"
+        "    -z<skew>      | --zipf=<skew>          Zipf exponent for choosing keys, default = 0\n"
+        "    -h            | -? | --help            print usage information\n",
+        progName, DEFAULT_REPLY, DEFAULT_KEYS, DEFAULT_RATE,
+        SIO_DEFAULT_AGENT_PORT);
+}
+
+static void fakeSioInterruptHandler(int sig)
+{
+    keepGoing = 0;
+}
+
+static void fakeSioOnListen(int fd, unsigned events, void *context);
+
+/**
+ * Makes room in the batch for one more message.
+ */
+static char *fakeSioBatchReserve(size_t length)
+{
+    if ((fake.batchSize - fake.batchLength) < length) {
+        fake.batchSize = 2 * fake.batchSize + length;
+        fake.batch = realloc(fake.batch, fake.batchSize);
+        if (fake.batch == 0) {
+            dieWithSystemMessage("realloc() of batch failed");
+        }
+    }
+    return fake.batch + fake.batchLength;
+}
+
+/**
+ * Queues the messages in the batch as a single write.
+ */
+static void fakeSioBatchSend(void)
+{
+    if (fake.batchLength == 0) {
+        return;
+    }
+
+    struct TioMsgBuf *buf = tioMsgBufCreate(fake.batch, fake.batchLength, 0);
+    if ((buf == 0) || (tioOutQueuePush(&fake.out, buf) != 0)) {
+        dieWithSystemMessage("out of memory for messages");
+    }
+    tioMsgBufUnref(buf);
+    fake.batchLength = 0;
+}
+
+static void fakeSioUpdateEvents(void)
+{
+    if (fake.fd >= 0) {
+        tioEventModify(fake.fd, (fake.reading ? TIO_EVENT_READ : 0) |
+            ((fake.out.count > 0) ? TIO_EVENT_WRITE : 0));
+    }
+}
+
+static void fakeSioClose(void)
+{
+    tioEventRemove(fake.fd);
+    close(fake.fd);
+    fake.fd = -1;
+    tioOutQueueClear(&fake.out);
+
+    /* take the agent's next connection */
+    if (tioEventAdd(fake.listenFd, TIO_EVENT_READ, fakeSioOnListen, 0) != 0) {
+        dieWithSystemMessage("epoll_ctl() on listen socket failed");
+    }
+}
+
+static void fakeSioFlush(void)
+{
+    if (tioOutQueueFlush(&fake.out, fake.fd) < 0) {
+        fprintf(stderr, "%s: send to tio-agent failed, errno = %d\n",
+            progName, errno);
+        fakeSioClose();
+    }
+}
+
+/**
+ * Handles one command from the agent.
+ */
+static void fakeSioOnCommand(const char *command, size_t length)
+{
+    fake.commands++;
+    if (fake.verbose) {
+        printf("%.*s\n", (int)length, command);
+    }
+
+    if (strcmp(fake.reply, "none") == 0) {
+        return;
+    }
+    if (strcmp(fake.reply, "echo") != 0) {
+        command = fake.reply;
+        length = strlen(fake.reply);
+    }
+    char *p = fakeSioBatchReserve(length + 1);
+    memcpy(p, command, length);
+    p[length] = '\n';
+    fake.batchLength += length + 1;
+    fake.replies++;
+}
+
+static void fakeSioOnConnection(int fd, unsigned events, void *context)
+{
+    if (events & TIO_EVENT_WRITE) {
+        fakeSioFlush();
+        if (fake.fd < 0) {
+            return;
+        }
+    }
+
+    if (events & (TIO_EVENT_READ | TIO_EVENT_ERROR)) {
+        size_t wanted = sizeof(fake.in) - fake.inLength;
+        if ((fake.readRate != 0) && (fake.readBudget / 1000000000u < wanted)) {
+            wanted = fake.readBudget / 1000000000u;
+        }
+
+        const ssize_t numRead = read(fd, fake.in + fake.inLength, wanted);
+        if ((numRead == 0) || ((numRead < 0) && (errno != EAGAIN) &&
+            (errno != EWOULDBLOCK) && (errno != EINTR))) {
+            fprintf(stderr, "%s: tio-agent disconnected\n", progName);
+            fakeSioClose();
+            return;
+        }
+
+        if (numRead > 0) {
+            if (fake.readRate != 0) {
+                fake.readBudget -= numRead * 1000000000ull;
+                fake.reading = (fake.readBudget >= 1000000000u);
+            }
+            fake.inLength += numRead;
+
+            /* the agent ends commands with \r */
+            char *start = fake.in;
+            char *const end = fake.in + fake.inLength;
+            char *p;
+            for (p = start; p < end; p++) {
+                if ((*p == '\r') || (*p == '\n')) {
+                    if (p > start) {
+                        fakeSioOnCommand(start, p - start);
+                    }
+                    start = p + 1;
+                }
+            }
+
+            fake.inLength = end - start;
+            if (fake.inLength == sizeof(fake.in)) {
+                /* too long to be a command, drop it */
+                fake.inLength = 0;
+            } else {
+                memmove(fake.in, start, fake.inLength);
+            }
+            fakeSioBatchSend();
+            fakeSioFlush();
+        }
+    }
+    fakeSioUpdateEvents();
+}
+
+static void fakeSioOnListen(int fd, unsigned events, void *context)
+{
+    fake.fd = tioQvSocketAccept(fd, fake.addressFamily);
+    if (fake.fd < 0) {
+        return;
+    }
+
+    /* one agent at a time; others wait in the backlog */
+    tioEventRemove(fd);
+
+    if (tioSetNonBlocking(fake.fd) != 0) {
+        dieWithSystemMessage("fcntl() failed");
+    }
+    if (fake.noDelay) {
+        tioSocketSetNoDelay(fake.fd);
+    }
+    if (tioEventAdd(fake.fd, TIO_EVENT_READ, fakeSioOnConnection, 0) != 0) {
+        dieWithSystemMessage("epoll_ctl() on connection failed");
+    }
+
+    fake.connects++;
+    fake.connectedAt = tioStatsNow();
+    fake.generated = 0;
+    fake.inLength = 0;
+    fake.readBudget = 0;
+    fake.reading = (fake.readRate == 0);
+    fakeSioUpdateEvents();
+    fprintf(stderr, "%s: tio-agent connected\n", progName);
+}
+
+/**
+ * Sends the telemetry that has come due, tops up the read budget and drops
+ * the connection when it is time to.
+ */
+static void fakeSioOnTick(int fd, unsigned events, void *context)
+{
+    uint64_t expirations;
+    if ((read(fd, &expirations, sizeof(expirations)) <= 0) || (fake.fd < 0)) {
+        return;
+    }
+
+    const uint64_t elapsed = tioStatsNow() - fake.connectedAt;
+    if ((fake.disconnectAfter != 0) &&
+        (elapsed >= fake.disconnectAfter * 1000000000ull)) {
+        fprintf(stderr, "%s: dropping the connection\n", progName);
+        fake.disconnects++;
+        fakeSioClose();
+        return;
+    }
+
+    if (fake.readRate != 0) {
+        /* allow a burst of at most a tenth of a second */
+        fake.readBudget += fake.readRate * expirations * TICK_NS;
+        if (fake.readBudget > (fake.readRate * 100000000ull)) {
+            fake.readBudget = fake.readRate * 100000000ull;
+        }
+        fake.reading = (fake.readBudget >= 1000000000u);
+    }
+
+    const uint64_t due = (uint64_t)(fake.rate * (elapsed / 1e9));
+    if (due > fake.generated) {
+        const uint64_t count = due - fake.generated;
+        fake.generated = due;
+        if (fake.out.bytes > MAX_BACKLOG) {
+            fake.telemetryDropped += count;
+        } else {
+            const size_t longest = fake.keys.longest + TIO_KEY_VALUE_SIZE;
+            uint64_t i;
+            for (i = 0; i < count; i++) {
+                fake.batchLength += tioKeySetFormat(&fake.keys,
+                    fakeSioBatchReserve(longest));
+            }
+            fake.telemetry += count;
+            fakeSioBatchSend();
+            fakeSioFlush();
+        }
+    }
+    fakeSioUpdateEvents();
+}
+
+int main(int argc, char** argv)
+{
+    const char *translatePath = 0;
+    unsigned keyCount = DEFAULT_KEYS;
+    double skew = 0;
+    unsigned short sioPort = 0;
+    fake.rate = DEFAULT_RATE;
+    fake.reply = DEFAULT_REPLY;
+    fake.fd = -1;
+
+    /* allocate memory for progName since basename() modifies it */
+    const size_t nameLen = strlen(argv[0]) + 1;
+    char arg0[nameLen];
+    memcpy(arg0, argv[0], nameLen);
+    progName = basename(arg0);
+
+    while (1) {
+        static struct option longOptions[] = {
+            { "reply",      required_argument, 0, 'a' },
+            { "read-rate",  required_argument, 0, 'b' },
+            { "disconnect", required_argument, 0, 'D' },
+            { "file",       required_argument, 0, 'f' },
+            { "keys",       required_argument, 0, 'k' },
+            { "rate",       required_argument, 0, 'r' },
+            { "sio-port",   optional_argument, 0, 's' },
+            { "verbose",    no_argument,       0, 'v' },
+            { "zipf",       required_argument, 0, 'z' },
+            { "help",       no_argument,       0, 'h' },
+            { 0,            0, 0,  0  }
+        };
+        int c = getopt_long(argc, argv, "a:b:D:f:k:r:s::vz:h?", longOptions,
+            0);
+
+        if (c == -1) {
+            break;  // no more options to process
+        }
+
+        switch (c) {
+        case 'a':
+            fake.reply = optarg;
+            break;
+
+        case 'b':
+            fake.readRate = strtoull(optarg, 0, 10);
+            break;
+
+        case 'D':
+            fake.disconnectAfter = atoi(optarg);
+            break;
+
+        case 'f':
+            translatePath = optarg;
+            break;
+
+        case 'k':
+            keyCount = atoi(optarg);
+            break;
+
+        case 'r':
+            fake.rate = strtod(optarg, 0);
+            break;
+
+        case 's':
+            sioPort = (optarg == 0) ? SIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            break;
+
+        case 'v':
+            fake.verbose = 1;
+            break;
+
+        case 'z':
+            skew = strtod(optarg, 0);
+            break;
+
+        case 'h':
+        case '?':
+        default:
+            fakeSioDumpHelp();
+            exit(1);
+        }
+    }
+
+    if (translatePath != 0) {
+        tioKeySetLoad(translatePath, 0, &fake.keys);
+    }
+    if (fake.keys.count == 0) {
+        tioKeySetMake(&fake.keys, "micro", (keyCount == 0) ? 1 : keyCount);
+    }
+    tioKeySetPrepare(&fake.keys, skew);
+    tioOutQueueInit(&fake.out);
+
+    struct sigaction a;
+    memset(&a, 0, sizeof(a));
+    a.sa_handler = fakeSioInterruptHandler;
+    if ((sigaction(SIGINT, &a, 0) != 0) || (sigaction(SIGTERM, &a, 0) != 0)) {
+        dieWithSystemMessage("sigaction() failed");
+    }
+
+    if (tioEventInit() != 0) {
+        dieWithSystemMessage("epoll_create1() failed");
+    }
+
+    fake.listenFd = tioQvSocketInit(sioPort, &fake.addressFamily,
+        SIO_AGENT_UNIX_SOCKET);
+    fake.noDelay = (sioPort != 0);
+    if (tioEventAdd(fake.listenFd, TIO_EVENT_READ, fakeSioOnListen, 0) != 0) {
+        dieWithSystemMessage("epoll_ctl() on listen socket failed");
+    }
+
+    const int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_value.tv_nsec = TICK_NS;
+    interval.it_interval.tv_nsec = TICK_NS;
+    if ((timerFd < 0) || (timerfd_settime(timerFd, 0, &interval, 0) != 0) ||
+        (tioEventAdd(timerFd, TIO_EVENT_READ, fakeSioOnTick, 0) != 0)) {
+        dieWithSystemMessage("timerfd failed");
+    }
+
+    keepGoing = 1;
+    while (keepGoing) {
+        if ((tioEventWait(-1) < 0) && (errno != EINTR)) {
+            dieWithSystemMessage("epoll_wait() failed");
+        }
+    }
+
+    fprintf(stderr, "%s: %llu connections, %llu dropped on purpose\n"
+        "%s: %llu telemetry messages sent, %llu not sent\n"
+        "%s: %llu commands received, %llu replies\n",
+        progName, (unsigned long long)fake.connects,
+        (unsigned long long)fake.disconnects,
+        progName, (unsigned long long)fake.telemetry,
+        (unsigned long long)fake.telemetryDropped,
+        progName, (unsigned long long)fake.commands,
+        (unsigned long long)fake.replies);
+
+    if (fake.fd >= 0) {
+        tioEventRemove(fake.fd);
+        close(fake.fd);
+    }
+    tioOutQueueClear(&fake.out);
+    close(timerFd);
+    close(fake.listenFd);
+    if (sioPort == 0) {
+        unlink(SIO_AGENT_UNIX_SOCKET);
+    }
+    tioEventClose();
+    exit(EXIT_SUCCESS);
+}
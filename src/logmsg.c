@@ -1,31 +1,77 @@
-#define _BSD_SOURCE  /* for vsyslog() */
+#define _DEFAULT_SOURCE  /* for vsyslog() */
 
 #include <ctype.h>
-#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "translate_agent.h"
 
+/*
+ * Messages are formatted by the thread logging them into a slot of a bounded
+ * lock-free ring and written out by a background thread, so a thread logging
+ * never waits for the destination.  The ring is the multi-producer queue from
+ * Dmitry Vyukov: each slot carries a sequence number telling producers when
+ * it is free and the consumer when it is full.  A message which finds the
+ * ring full is dropped and counted.  Binary trace records go through the same
+ * ring to keep their order with the text messages.
+ */
+#define LOG_RING_SIZE 256               /* a power of 2 */
+#define LOG_MSG_SIZE 512
+
+/* the level of a slot holding a struct TioTraceRecord */
+#define LOG_TRACE_SLOT -1
+
+struct LogSlot
+{
+    atomic_size_t sequence;
+    int level;
+    char text[LOG_MSG_SIZE] __attribute__((aligned(8)));
+};
+
+/* messages at or below this level are logged; see LogMsg() */
+int logThreshold = LOG_NOTICE;
 
-/* -1: syslog; >= 0: an open file descriptor */
+/* 0: syslog; otherwise an open stream such as stderr or a file */
 static FILE *logFile;
-static int verboseOn;
 
-static void print_io_msg(int size, char *msg);
+/* set by LogTraceOpen(); see LogTrace() */
+int traceEnabled;
+static FILE *traceFile;
+
+static struct LogSlot logRing[LOG_RING_SIZE];
+static atomic_size_t enqueuePos;
+static size_t dequeuePos;
+static atomic_uint droppedCount;
+
+/* the writer sleeps on logWakeup once it has set logIdle */
+static pthread_t logWriter;
+static int logWriterRunning;
+static atomic_int logIdle;
+static atomic_int logStopping;
+static sem_t logWakeup;
+
+static void *LogWriterThread(void *arg);
+static void LogClose(void);
 
 /**
- * Sets up the logging for the program.  Three different message destinations 
- * are possible: the system's syslog facility; a named file; and the process' 
- * standard error stream. 
- * 
- * @param ident the ident string supplied to syslog, typically this is the 
+ * Sets up the logging for the program.  Three different message destinations
+ * are possible: the system's syslog facility; a named file; and the process'
+ * standard error stream.  Call after any fork(), since it starts the thread
+ * which writes the messages.
+ *
+ * @param ident the ident string supplied to syslog, typically this is the
  *              program's name
- * @param logToSyslog 
- * @param logFilePath 
- * @param verboseFlag 
+ * @param logToSyslog non-zero to log to syslog
+ * @param logFilePath the file to append messages to, 0 for standard error
+ * @param verboseFlag non-zero to log informational and debug messages too
  */
 void LogOpen(const char *ident, int logToSyslog, const char *logFilePath,
     int verboseFlag)
@@ -40,106 +86,272 @@ void LogOpen(const char *ident, int logToSyslog, const char *logFilePath,
             exit(-1);
         }
 
-        /* 
+        /*
          * set the file to line buffered so it gets updated in a timely
-         * manner 
-         */ 
+         * manner
+         */
         setlinebuf(logFile);
     } else {
         logFile = stderr;
     }
 
-    verboseOn = verboseFlag;
-    if(verboseOn) {
-		fprintf(stdout, "Verbose mode enabled\n");
-	}
+    unsigned i;
+    for (i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&logRing[i].sequence, i);
+    }
+
+    if (sem_init(&logWakeup, 0, 0) != 0) {
+        dieWithSystemMessage("sem_init() failed");
+    }
+    if (pthread_create(&logWriter, 0, LogWriterThread, 0) != 0) {
+        dieWithSystemMessage("could not start log writer");
+    }
+    logWriterRunning = 1;
+    atexit(LogClose);
+
+    logThreshold = verboseFlag ? LOG_DEBUG : LOG_NOTICE;
+    if (verboseFlag) {
+        LogMsg(LOG_INFO, "Verbose mode enabled\n");
+    }
+}
+
+/**
+ * Claims the next free slot of the ring.
+ *
+ * @param pos receives the slot's position, to be passed to LogPublish()
+ *
+ * @return struct LogSlot* the slot, or 0 if the ring is full
+ */
+static struct LogSlot *LogClaim(size_t *pos)
+{
+    size_t claim = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    for (;;) {
+        struct LogSlot *slot = &logRing[claim & (LOG_RING_SIZE - 1)];
+        const size_t sequence = atomic_load_explicit(&slot->sequence,
+            memory_order_acquire);
+
+        /* positions wrap, so only their difference can be compared */
+        const intptr_t diff = (intptr_t)(sequence - claim);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueuePos, &claim,
+                claim + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *pos = claim;
+                return slot;
+            }
+        } else if (diff < 0) {
+            /* full, the writer is behind */
+            atomic_fetch_add_explicit(&droppedCount, 1, memory_order_relaxed);
+            return 0;
+        } else {
+            claim = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Hands a filled slot to the writer thread, waking it if it is waiting.
+ */
+static void LogPublish(struct LogSlot *slot, size_t pos)
+{
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    if (atomic_exchange(&logIdle, 0)) {
+        sem_post(&logWakeup);
+    }
+}
+
+/**
+ * Formats a message into the ring for the writer thread.  Use LogMsg(),
+ * which skips this call for messages filtered out by level.
+ *
+ * @param level the syslog priority of the message
+ * @param fmt printf() style format
+ */
+void LogWrite(int level, const char *fmt, ...)
+{
+    if (!logWriterRunning) {
+        /* LogOpen() not called yet, write directly */
+        va_list ap;
+        va_start(ap, fmt);
+        vfprintf(stderr, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    size_t pos;
+    struct LogSlot *slot = LogClaim(&pos);
+    if (slot == 0) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+    va_end(ap);
+    slot->level = level;
+    LogPublish(slot, pos);
+}
+
+/**
+ * Opens a file for binary trace records and starts tracing.  Call after
+ * LogOpen().
+ *
+ * @param traceFilePath the file to write, replaced if it exists
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int LogTraceOpen(const char *traceFilePath)
+{
+    traceFile = fopen(traceFilePath, "wb");
+    if (traceFile == 0) {
+        return -1;
+    }
+
+    struct TioTraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TIO_TRACE_MAGIC, sizeof(header.magic));
+    header.version = TIO_TRACE_VERSION;
+    header.recordSize = sizeof(struct TioTraceRecord);
+    if (fwrite(&header, sizeof(header), 1, traceFile) != 1) {
+        fclose(traceFile);
+        traceFile = 0;
+        return -1;
+    }
+
+    traceEnabled = 1;
+    return 0;
+}
+
+/**
+ * Queues a binary trace record for the writer thread.  Use LogTrace(), which
+ * skips this call when tracing is off.
+ *
+ * @param event one of the TIO_TRACE_* events
+ * @param source TIO_TRACE_FROM_GUI or TIO_TRACE_FROM_MICRO
+ * @param rule the index of the rule involved or TIO_TRACE_NO_RULE
+ * @param length the length of the message or key, depending on the event
+ */
+void LogTraceWrite(unsigned event, unsigned source, uint32_t rule,
+    uint32_t length)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    size_t pos;
+    struct LogSlot *slot = LogClaim(&pos);
+    if (slot == 0) {
+        return;
+    }
+
+    struct TioTraceRecord *record = (struct TioTraceRecord *)slot->text;
+    record->timestamp = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+    record->event = event;
+    record->source = source;
+    record->rule = rule;
+    record->length = length;
+    record->reserved = 0;
+    slot->level = LOG_TRACE_SLOT;
+    LogPublish(slot, pos);
+}
+
+/**
+ * Writes a message to the destination, showing control characters other
+ * than the line ending as ^X.
+ */
+static void LogOutput(int level, const char *text)
+{
+    if (logFile == 0) {
+        syslog(LOG_USER | level, "%s", text);
+        return;
+    }
+
+    const char *p;
+    for (p = text; *p != '\0'; p++) {
+        if (iscntrl((unsigned char)*p) && (*p != '\n')) {
+            fprintf(logFile, "^%c", *p - 1 + 'A');
+        } else {
+            putc(*p, logFile);
+        }
+    }
 }
 
-void LogMsg(int level, const char *fmt, ...)
+/**
+ * Writes out every message in the ring.
+ *
+ * @return int the number of messages written
+ */
+static int LogDrain(void)
 {
-	const char *p;
-	va_list argp;
-	int i, len;
-	char *s;
-	char fmtbuf[256];
-
-	va_start(argp, fmt);
-
-	for(p = fmt; *p != '\0'; p++) {
-		if(*p != '%')
-		{
-			putchar(*p);
-			continue;
-		}
-
-		switch(*++p)
-		{
-			case 'c':
-				i = va_arg(argp, int);
-				putchar(i);
-				break;
-
-			case 'd':
-				i = va_arg(argp, int);
-				sprintf(fmtbuf,"%d",i);
-				fputs(fmtbuf, stdout);
-				break;
-
-			case 's':
-				s = va_arg(argp, char *);
-				len = strlen(s);
-				//fputs(s, stdout);
-				print_io_msg(len, s);
-				break;
-
-			case 'x':
-			case 'X':
-				i = va_arg(argp, int);
-				sprintf(fmtbuf,"0x%X",i);
-				fputs(fmtbuf, stdout);
-				break;
-
-			case '%':
-				putchar('%');
-				break;
-		}
-	}
-
-	va_end(argp);
+    int count = 0;
+    for (;;) {
+        struct LogSlot *slot = &logRing[dequeuePos & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) !=
+            (dequeuePos + 1)) {
+            break;
+        }
+
+        if (slot->level == LOG_TRACE_SLOT) {
+            fwrite(slot->text, sizeof(struct TioTraceRecord), 1, traceFile);
+        } else {
+            LogOutput(slot->level, slot->text);
+        }
+        atomic_store_explicit(&slot->sequence, dequeuePos + LOG_RING_SIZE,
+            memory_order_release);
+        dequeuePos++;
+        count++;
+    }
+
+    const unsigned dropped = atomic_exchange(&droppedCount, 0);
+    if (dropped > 0) {
+        char text[64];
+        snprintf(text, sizeof(text), "[LOG] %u messages dropped\n", dropped);
+        LogOutput(LOG_WARNING, text);
+    }
+
+    if ((count > 0) && (logFile != 0)) {
+        fflush(logFile);
+    }
+    if ((count > 0) && (traceFile != 0)) {
+        fflush(traceFile);
+    }
+    return count;
 }
 
-static void print_io_msg(int size, char *msg)
+static void *LogWriterThread(void *arg)
 {
-	int i;
-	
-	for (i=0; i < size; i++) {
-		if (iscntrl(msg[i])) {
-			fprintf(stdout,"^%C", msg[i] - 1 + 'A');
-		} else {
-			putchar(msg[i]);
-		}
-	}
+    for (;;) {
+        LogDrain();
+        if (atomic_load(&logStopping)) {
+            break;
+        }
+
+        /* say we're going to sleep, then check nothing slipped in */
+        atomic_store(&logIdle, 1);
+        if (LogDrain() > 0) {
+            if (!atomic_exchange(&logIdle, 0)) {
+                /* a producer cleared it and posted; absorb the wakeup */
+                while ((sem_wait(&logWakeup) != 0) && (errno == EINTR));
+            }
+            continue;
+        }
+        while ((sem_wait(&logWakeup) != 0) && (errno == EINTR));
+    }
+
+    LogDrain();
+    return 0;
 }
 
+/**
+ * Writes out any messages still queued and stops the writer thread.  Runs at
+ * exit.
+ */
+static void LogClose(void)
+{
+    if (!logWriterRunning) {
+        return;
+    }
 
-//void LogMsg(int level, const char *fmt, ...)
-//{
-    ///* 
-     //* only log the message if in verbose mode or the priority is higher than
-     //* informational
-     //*/ 
-    //if (verboseOn) {
-        //va_list ap;
-        //va_start(ap, fmt);
-
-        ////if (logFile == 0) {
-            ///* log to syslog */
-        ////    vsyslog(LOG_USER | level, fmt, ap);
-        ////} else {
-            ///* log to an open descriptor such as stdout or a file */
-            //vfprintf(logFile, fmt, ap);
-        ////}
-
-        //va_end(ap);
-    //}
-//}
+    atomic_store(&logStopping, 1);
+    sem_post(&logWakeup);
+    pthread_join(logWriter, 0);
+    logWriterRunning = 0;
+}
@@ -6,6 +6,7 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>     /* Commonly used string-handling functions */
 #include <sys/socket.h>
 #include <unistd.h>
@@ -73,55 +74,154 @@ void safe_strncpy(char *dest, const char *src, size_t n)
                             place but this one shouldn't interfere in any way */
 }
 
-int readLine2(int socketFd, char *outMsg, size_t msgSize,
-    struct LineBuffer *buffer, const char *end)
+/*
+ * Allocate the store of a line buffer.  'capacity' bounds the longest line
+ * that can be received; 0 means READ_BUF_SIZE.  Returns 0, or -1 if out of
+ * memory.
+ */
+
+int lineBufferInit(struct LineBuffer *buffer, size_t capacity)
 {
-    /* read into a temporary buffer for further processing */
-    const size_t cnt = recv(socketFd, buffer->store + buffer->pos,
-        sizeof(buffer->store) - buffer->pos, 0);
-    if (cnt <= 0) {
-        LogMsg(LOG_INFO, "[TIO] recv() from %s failed, client closed\n", end);
-        close(socketFd);
-        buffer->pos = 0;  /* flush any remaining buffered characters */
-        return -1;
-    } else {
-        /* look through the new part of the buffer for a newline */
-        off_t i = buffer->pos;
-        while (i < (buffer->pos + cnt)) {
-            /* make sure outMsg is long enough to hold this message + \0 */
-            if (i >= (msgSize - 1)) {
-                buffer->pos = 0;
-                return 0;
-            }
+    buffer->capacity = (capacity == 0) ? READ_BUF_SIZE : capacity;
+    buffer->start = 0;
+    buffer->end = 0;
+    buffer->store = malloc(buffer->capacity);
+    return (buffer->store == 0) ? -1 : 0;
+}
 
-            if (buffer->store[i] == '\n' || buffer->store[i] == '\r') {
-                /* copy the accumulated characters including \n or \r to outMsg */
-                bcopy(buffer->store, outMsg, i++);
+void lineBufferFree(struct LineBuffer *buffer)
+{
+    free(buffer->store);
+    buffer->store = 0;
+    buffer->capacity = 0;
+    lineBufferReset(buffer);
+}
 
-				LogMsg(LOG_INFO, "[TIO] received => \"%s\"; from %s\n", outMsg, end);
-                /* nul terminate the string and get rid of the \n or \r character */
-                outMsg[i-1] = '\0';
+/*
+ * Forget any partial line.
+ */
 
-                /* squish whatever may remain to the start of the store */
-                buffer->pos += cnt - i;
-                bcopy(buffer->store + i, buffer->store, buffer->pos);
+void lineBufferReset(struct LineBuffer *buffer)
+{
+    buffer->start = 0;
+    buffer->end = 0;
+}
 
-                return i;
-            }
+/*
+ * Pass every complete line among the 'count' characters just appended at
+ * buffer->end to 'handler', then take them into the buffer.  Returns the
+ * number of lines handled.
+ */
 
-            i++;
+static int lineBufferScan(struct LineBuffer *buffer, size_t count,
+    const char *end, LineHandler handler, void *context)
+{
+    /* the first new character is the earliest a terminator can be */
+    char *line = buffer->store + buffer->start;
+    char *scan = buffer->store + buffer->end;
+    char *const stop = scan + count;
+    int lines = 0;
+
+    while (scan < stop) {
+        char *eol = scan;
+        while (eol < stop && *eol != '\n' && *eol != '\r') {
+            eol++;
         }
-
-        if (i >= sizeof(buffer->store)) {
-            /* the temporary buffer is full but no newline so flush it */
-            LogMsg(LOG_ERR, "[TIO] %s buffer overflow, flushing\n", end);
-            buffer->pos = 0;
+        if (eol == stop) {
+            break;
         }
 
-        /* update position to start next message */
-        buffer->pos += i;
+        /* nul terminate the line, getting rid of the \n or \r character */
+        *eol = '\0';
+        LogMsg(LOG_INFO, "[TIO] received => \"%s\"; from %s\n", line, end);
+        handler(line, eol - line, context);
+        lines++;
+
+        line = scan = eol + 1;
+    }
+
+    buffer->start = line - buffer->store;
+    buffer->end = stop - buffer->store;
+    if (buffer->start == buffer->end) {
+        /* nothing left over, start again at the front for free */
+        lineBufferReset(buffer);
+    } else if ((buffer->start == 0) && (buffer->end == buffer->capacity)) {
+        /* the temporary buffer is full but no newline so flush it */
+        LogMsg(LOG_ERR, "[TIO] %s buffer overflow, flushing\n", end);
+        lineBufferReset(buffer);
+    }
+
+    return lines;
+}
 
-        /* no newline found, no message to return */
+/*
+ * Move a partial line to the front of the buffer if there is no room left
+ * after it.
+ */
+
+static void lineBufferCompact(struct LineBuffer *buffer)
+{
+    if (buffer->end == buffer->capacity) {
+        buffer->end -= buffer->start;
+        memmove(buffer->store, buffer->store + buffer->start, buffer->end);
+        buffer->start = 0;
+    }
+}
+
+/*
+ * Receive whatever is available on 'socketFd' and pass every complete line in
+ * 'buffer' to 'handler', in order.  Lines end with \n or \r; the terminator
+ * is replaced by a nul before the handler is called, and the line is only
+ * valid until the handler returns.  The handler gets a view into the buffer,
+ * nothing is copied.  A partial line stays where it is and the next recv()
+ * appends to it; the buffer is only compacted when that would run off its
+ * end.  A line that doesn't fit in the buffer is discarded.  On error or when
+ * the peer closes the connection the socket is closed and -1 returned,
+ * otherwise the number of lines handled.
+ */
+
+int readLine2(int socketFd, struct LineBuffer *buffer, const char *end,
+    LineHandler handler, void *context)
+{
+    lineBufferCompact(buffer);
+
+    /* read into a temporary buffer for further processing */
+    const ssize_t cnt = recv(socketFd, buffer->store + buffer->end,
+        buffer->capacity - buffer->end, 0);
+    if (cnt < 0 && (errno == EINTR || errno == EAGAIN)) {
         return 0;
+    } else if (cnt <= 0) {
+        LogMsg(LOG_INFO, "[TIO] recv() from %s failed, client closed\n", end);
+        close(socketFd);
+        lineBufferReset(buffer);  /* flush any remaining buffered characters */
+        return -1;
+    }
+
+    return lineBufferScan(buffer, cnt, end, handler, context);
+}
+
+/*
+ * Like readLine2() for characters that have already been received, e.g. by
+ * the event engine: append 'length' characters from 'data' to 'buffer' and
+ * pass every complete line to 'handler'.  Returns the number of lines
+ * handled.
+ */
+
+int lineBufferFeed(struct LineBuffer *buffer, const char *data, size_t length,
+    const char *end, LineHandler handler, void *context)
+{
+    int lines = 0;
+    while (length > 0) {
+        lineBufferCompact(buffer);
+
+        size_t count = buffer->capacity - buffer->end;
+        if (count > length) {
+            count = length;
+        }
+        memcpy(buffer->store + buffer->end, data, count);
+        lines += lineBufferScan(buffer, count, end, handler, context);
+        data += count;
+        length -= count;
     }
+    return lines;
 }
@@ -9,15 +9,28 @@
 
 #include "translate_agent.h"
 
+typedef void (*LineHandler)(char *line, size_t length, void *context);
+
 ssize_t readLine(int fd, char *buffer, size_t n);
-int readLine2(int socketFd, char *outMsg, size_t msgSize,
-    struct LineBuffer *buffer, const char *end);
+int lineBufferInit(struct LineBuffer *buffer, size_t capacity);
+void lineBufferFree(struct LineBuffer *buffer);
+void lineBufferReset(struct LineBuffer *buffer);
+int readLine2(int socketFd, struct LineBuffer *buffer, const char *end,
+    LineHandler handler, void *context);
+int lineBufferFeed(struct LineBuffer *buffer, const char *data, size_t length,
+    const char *end, LineHandler handler, void *context);
 void safe_strncpy(char *dest, const char *src, size_t n);
 
+/*
+ * Characters received on a socket.  Unconsumed characters, at most one
+ * partial line, are store[start] up to store[end].
+ */
 struct LineBuffer
 {
-    char store[READ_BUF_SIZE];
-    off_t pos;
+    char *store;
+    size_t capacity;
+    size_t start;
+    size_t end;
 };
 
 #endif
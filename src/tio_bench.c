@@ -0,0 +1,483 @@
+/*
+ * tio_bench.c
+ *
+ * Load generator for tio-agent.  tio-bench plays both ends of the agent: it
+ * listens where sio_agent would, and once the agent has connected to it, it
+ * connects to the agent as a qml-viewer.  Messages are then driven through
+ * the agent in both directions at fixed rates, or as fast as a window of
+ * messages in flight allows, and the throughput and round trip latencies
+ * are reported.
+ *
+ * Start tio-bench first and then the agent, e.g.
+ *     tio-bench -f translate.txt -g 5000 -m 5000 &
+ *     tio-agent -f translate.txt
+ *
+ * The agent keeps the order of the messages in each direction, so every
+ * terminator received is matched with the oldest message still in flight.
+ * Translations whose output contains the terminator of their direction
+ * (\r towards sio_agent, \n towards the viewers) throw the count off.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "tio_keys.h"
+#include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_histogram.h"
+#include "translate_output.h"
+#include "translate_stats.h"
+
+#define DEFAULT_RATE 1000
+#define DEFAULT_WINDOW 64
+#define DEFAULT_KEYS 100
+#define DEFAULT_DURATION 10
+
+/* a rate of RATE_MAX keeps window messages in flight instead */
+#define RATE_MAX -1.0
+
+/* the most messages one direction can have in flight */
+#define MAX_IN_FLIGHT 65536
+
+/* how often rate driven messages are generated */
+#define TICK_NS 1000000
+
+/* how long to wait for the messages in flight at the end */
+#define DRAIN_NS 2000000000u
+
+/**
+ * The messages going one way through the agent.
+ */
+struct BenchDirection
+{
+    const char *name;
+    double rate;                /* messages per second, 0 = none */
+
+    /* the keys messages are made from */
+    struct TioKeySet keys;
+
+    /* written to this connection, waiting in out for the socket */
+    int fd;
+    struct TioOutQueue out;
+    char *batch;
+    size_t batchSize;
+
+    /* the times the messages in flight were sent, oldest at head */
+    uint64_t sentAt[MAX_IN_FLIGHT];
+    unsigned head;
+    unsigned inFlight;
+
+    /* read back on the other connection, messages end with terminator */
+    char terminator;
+
+    uint64_t sent;
+    uint64_t sentBytes;
+    uint64_t received;
+    uint64_t receivedBytes;
+    uint64_t stalled;           /* not sent because too many in flight */
+    struct TioHistogram latency;
+};
+
+/**
+ * One of the two connections, carrying one direction out and the other in.
+ */
+struct BenchConnection
+{
+    int fd;
+    struct BenchDirection *sending;
+    struct BenchDirection *receiving;
+};
+
+static const char *progName;
+static struct BenchDirection guiToSio;
+static struct BenchDirection microToGui;
+static unsigned window = DEFAULT_WINDOW;
+static int connectionLost;
+
+static void tioBenchDumpHelp(void)
+{
+    fprintf(stderr, "TIO Bench %s \n\n", TIO_VERSION);
+
+    fprintf(stderr, "usage: %s [options]\n"
+        "  where options are:\n"
+        "    -d<seconds>   | --duration=<seconds>   length of the run, default = %d\n"
+        "    -f<path>      | --file=<path>          send the keys of this translation file\n"
+        "    -g<rate>      | --gui-rate=<rate>      viewer messages per second, default = %d\n"
+        "    -k<count>     | --keys=<count>         keys made up without -f, default = %d\n"
+        "    -m<rate>      | --micro-rate=<rate>    sio_agent messages per second, default = %d\n"
+        "    -s[<port>]    | --sio-port[=<port>]    use TCP socket, default = %d\n"
+        "    -t[<port>]    | --tio-port[=<port>]    use TCP socket, default = %d\n"
+        "    -w<count>     | --window=<count>       messages in flight at rate max, default = %d\n"
+        "    -z<skew>      | --zipf=<skew>          Zipf exponent for choosing keys, default = 0\n"
+        "    -h            | -? | --help            print usage information\n"
+        "  a rate may be \"max\" to send as fast as the window allows, or 0\n",
+        progName, DEFAULT_DURATION, DEFAULT_RATE, DEFAULT_KEYS, DEFAULT_RATE,
+        SIO_DEFAULT_AGENT_PORT, TIO_DEFAULT_AGENT_PORT, DEFAULT_WINDOW);
+}
+
+static double tioBenchParseRate(const char *arg)
+{
+    return (strcmp(arg, "max") == 0) ? RATE_MAX : strtod(arg, 0);
+}
+
+/**
+ * Writes whatever the connection will take of a direction's output.
+ */
+static void tioBenchFlush(struct BenchDirection *direction)
+{
+    const int rv = tioOutQueueFlush(&direction->out, direction->fd);
+    if (rv < 0) {
+        perror("send failed");
+        connectionLost = 1;
+        return;
+    }
+    tioEventModify(direction->fd, TIO_EVENT_READ |
+        ((rv > 0) ? TIO_EVENT_WRITE : 0));
+}
+
+/**
+ * Sends up to count messages in one batch, as many as fit in flight.
+ */
+static void tioBenchSend(struct BenchDirection *direction, uint64_t count,
+    uint64_t now)
+{
+    if (count > (MAX_IN_FLIGHT - direction->inFlight)) {
+        direction->stalled += count - (MAX_IN_FLIGHT - direction->inFlight);
+        count = MAX_IN_FLIGHT - direction->inFlight;
+    }
+    if (count == 0) {
+        return;
+    }
+
+    const size_t longest = direction->keys.longest + TIO_KEY_VALUE_SIZE;
+    size_t length = 0;
+    uint64_t i;
+    for (i = 0; i < count; i++) {
+        if ((direction->batchSize - length) < longest) {
+            direction->batchSize = 2 * direction->batchSize + longest;
+            direction->batch = realloc(direction->batch, direction->batchSize);
+            if (direction->batch == 0) {
+                dieWithSystemMessage("realloc() of batch failed");
+            }
+        }
+        length += tioKeySetFormat(&direction->keys, direction->batch + length);
+
+        direction->sentAt[(direction->head + direction->inFlight) %
+            MAX_IN_FLIGHT] = now;
+        direction->inFlight++;
+    }
+    direction->sent += count;
+    direction->sentBytes += length;
+
+    struct TioMsgBuf *buf = tioMsgBufCreate(direction->batch, length, 0);
+    if ((buf == 0) || (tioOutQueuePush(&direction->out, buf) != 0)) {
+        dieWithSystemMessage("out of memory for messages");
+    }
+    tioMsgBufUnref(buf);
+    tioBenchFlush(direction);
+}
+
+/**
+ * Matches the messages which arrived with the oldest ones in flight.
+ */
+static void tioBenchReceive(struct BenchDirection *direction,
+    const char *data, size_t length, uint64_t now)
+{
+    direction->receivedBytes += length;
+    const char *end = data + length;
+    while ((data = memchr(data, direction->terminator, end - data)) != 0) {
+        data++;
+        direction->received++;
+        if (direction->inFlight > 0) {
+            tioHistogramRecord(&direction->latency,
+                now - direction->sentAt[direction->head]);
+            direction->head = (direction->head + 1) % MAX_IN_FLIGHT;
+            direction->inFlight--;
+        }
+    }
+}
+
+static void tioBenchOnConnection(int fd, unsigned events, void *context)
+{
+    struct BenchConnection *connection = context;
+
+    if (events & TIO_EVENT_WRITE) {
+        tioBenchFlush(connection->sending);
+    }
+
+    if (events & (TIO_EVENT_READ | TIO_EVENT_ERROR)) {
+        char buf[65536];
+        const ssize_t numRead = read(fd, buf, sizeof(buf));
+        if (numRead > 0) {
+            struct BenchDirection *direction = connection->receiving;
+            tioBenchReceive(direction, buf, numRead, tioStatsNow());
+
+            /* keep the window full */
+            if (direction->rate == RATE_MAX) {
+                tioBenchSend(direction, window - direction->inFlight,
+                    tioStatsNow());
+            }
+        } else if ((numRead == 0) ||
+            ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))) {
+            fprintf(stderr, "%s: tio-agent closed the connection\n", progName);
+            connectionLost = 1;
+        }
+    }
+}
+
+static void tioBenchReport(const struct BenchDirection *direction,
+    double seconds)
+{
+    const struct TioHistogram *latency = &direction->latency;
+    printf("%-12s %10llu %10llu %8llu %8llu %10.0f %9.1f %9.1f %9.1f %9.1f\n",
+        direction->name, (unsigned long long)direction->sent,
+        (unsigned long long)direction->received,
+        (unsigned long long)direction->inFlight,
+        (unsigned long long)direction->stalled,
+        direction->received / seconds,
+        tioHistogramPercentile(latency, 500000) / 1000.0,
+        tioHistogramPercentile(latency, 990000) / 1000.0,
+        tioHistogramPercentile(latency, 999000) / 1000.0,
+        latency->max / 1000.0);
+}
+
+/**
+ * Waits for the agent to connect as if to sio_agent, then connects to the
+ * agent as a qml-viewer.
+ */
+static void tioBenchConnect(unsigned short sioPort, unsigned short tioPort)
+{
+    int addressFamily;
+    const int listenFd = tioQvSocketInit(sioPort, &addressFamily,
+        SIO_AGENT_UNIX_SOCKET);
+    fprintf(stderr, "%s: waiting for tio-agent\n", progName);
+    microToGui.fd = tioQvSocketAccept(listenFd, addressFamily);
+    if (microToGui.fd < 0) {
+        dieWithSystemMessage("accept() failed");
+    }
+    close(listenFd);
+    if (sioPort == 0) {
+        unlink(SIO_AGENT_UNIX_SOCKET);
+    }
+
+    /* the agent opens its listening socket once it has connected to us */
+    unsigned tries;
+    for (tries = 0; tries < 500; tries++) {
+        guiToSio.fd = tioSioSocketInit(tioPort, TIO_AGENT_UNIX_SOCKET);
+        if (guiToSio.fd >= 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    if (guiToSio.fd < 0) {
+        dieWithSystemMessage("could not connect to tio-agent");
+    }
+
+    if ((tioSetNonBlocking(guiToSio.fd) != 0) ||
+        (tioSetNonBlocking(microToGui.fd) != 0)) {
+        dieWithSystemMessage("fcntl() failed");
+    }
+    if (sioPort != 0) {
+        tioSocketSetNoDelay(microToGui.fd);
+    }
+    if (tioPort != 0) {
+        tioSocketSetNoDelay(guiToSio.fd);
+    }
+
+    /* give the agent a moment to take on the viewer */
+    usleep(100000);
+}
+
+int main(int argc, char** argv)
+{
+    const char *translatePath = 0;
+    unsigned keyCount = DEFAULT_KEYS;
+    unsigned duration = DEFAULT_DURATION;
+    double skew = 0;
+    unsigned short sioPort = 0;
+    unsigned short tioPort = 0;
+    guiToSio.rate = DEFAULT_RATE;
+    microToGui.rate = DEFAULT_RATE;
+
+    /* allocate memory for progName since basename() modifies it */
+    const size_t nameLen = strlen(argv[0]) + 1;
+    char arg0[nameLen];
+    memcpy(arg0, argv[0], nameLen);
+    progName = basename(arg0);
+
+    while (1) {
+        static struct option longOptions[] = {
+            { "duration",   required_argument, 0, 'd' },
+            { "file",       required_argument, 0, 'f' },
+            { "gui-rate",   required_argument, 0, 'g' },
+            { "keys",       required_argument, 0, 'k' },
+            { "micro-rate", required_argument, 0, 'm' },
+            { "sio-port",   optional_argument, 0, 's' },
+            { "tio-port",   optional_argument, 0, 't' },
+            { "window",     required_argument, 0, 'w' },
+            { "zipf",       required_argument, 0, 'z' },
+            { "help",       no_argument,       0, 'h' },
+            { 0,            0, 0,  0  }
+        };
+        int c = getopt_long(argc, argv, "d:f:g:k:m:s::t::w:z:h?", longOptions,
+            0);
+
+        if (c == -1) {
+            break;  // no more options to process
+        }
+
+        switch (c) {
+        case 'd':
+            duration = atoi(optarg);
+            break;
+
+        case 'f':
+            translatePath = optarg;
+            break;
+
+        case 'g':
+            guiToSio.rate = tioBenchParseRate(optarg);
+            break;
+
+        case 'k':
+            keyCount = atoi(optarg);
+            break;
+
+        case 'm':
+            microToGui.rate = tioBenchParseRate(optarg);
+            break;
+
+        case 's':
+            sioPort = (optarg == 0) ? SIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            break;
+
+        case 't':
+            tioPort = (optarg == 0) ? TIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            break;
+
+        case 'w':
+            window = atoi(optarg);
+            if ((window == 0) || (window > MAX_IN_FLIGHT)) {
+                window = DEFAULT_WINDOW;
+            }
+            break;
+
+        case 'z':
+            skew = strtod(optarg, 0);
+            break;
+
+        case 'h':
+        case '?':
+        default:
+            tioBenchDumpHelp();
+            exit(1);
+        }
+    }
+
+    guiToSio.name = "gui->sio";
+    guiToSio.terminator = '\r';
+    microToGui.name = "micro->gui";
+    microToGui.terminator = '\n';
+    tioOutQueueInit(&guiToSio.out);
+    tioOutQueueInit(&microToGui.out);
+
+    if (translatePath != 0) {
+        tioKeySetLoad(translatePath, &guiToSio.keys, &microToGui.keys);
+    }
+    if (guiToSio.keys.count == 0) {
+        tioKeySetMake(&guiToSio.keys, "gui", (keyCount == 0) ? 1 : keyCount);
+    }
+    if (microToGui.keys.count == 0) {
+        tioKeySetMake(&microToGui.keys, "micro",
+            (keyCount == 0) ? 1 : keyCount);
+    }
+    tioKeySetPrepare(&guiToSio.keys, skew);
+    tioKeySetPrepare(&microToGui.keys, skew);
+
+    if (tioEventInit() != 0) {
+        dieWithSystemMessage("epoll_create1() failed");
+    }
+    tioBenchConnect(sioPort, tioPort);
+
+    struct BenchConnection viewer = { guiToSio.fd, &guiToSio, &microToGui };
+    struct BenchConnection sio = { microToGui.fd, &microToGui, &guiToSio };
+    if ((tioEventAdd(viewer.fd, TIO_EVENT_READ, tioBenchOnConnection,
+        &viewer) != 0) ||
+        (tioEventAdd(sio.fd, TIO_EVENT_READ, tioBenchOnConnection,
+        &sio) != 0)) {
+        dieWithSystemMessage("epoll_ctl() failed");
+    }
+
+    /* a timer paces the rate driven directions */
+    const int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_value.tv_nsec = TICK_NS;
+    interval.it_interval.tv_nsec = TICK_NS;
+    if ((timerFd < 0) || (timerfd_settime(timerFd, 0, &interval, 0) != 0)) {
+        dieWithSystemMessage("timerfd failed");
+    }
+
+    const uint64_t start = tioStatsNow();
+    const uint64_t stop = start + (uint64_t)duration * 1000000000u;
+    struct BenchDirection *directions[] = { &guiToSio, &microToGui };
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        if (directions[i]->rate == RATE_MAX) {
+            tioBenchSend(directions[i], window, start);
+        }
+    }
+
+    uint64_t now = start;
+    while ((now < stop) && !connectionLost) {
+        if ((tioEventWait(1) < 0) && (errno != EINTR)) {
+            dieWithSystemMessage("epoll_wait() failed");
+        }
+
+        uint64_t expirations;
+        now = tioStatsNow();
+        if (read(timerFd, &expirations, sizeof(expirations)) <= 0) {
+            continue;
+        }
+        for (i = 0; i < 2; i++) {
+            struct BenchDirection *direction = directions[i];
+            if (direction->rate > 0) {
+                const uint64_t due = (uint64_t)(direction->rate *
+                    ((now - start) / 1e9));
+                const uint64_t generated = direction->sent +
+                    direction->stalled;
+                if (due > generated) {
+                    tioBenchSend(direction, due - generated, now);
+                }
+            }
+        }
+    }
+    const double seconds = (now - start) / 1e9;
+
+    /* collect the stragglers, sending nothing more */
+    guiToSio.rate = 0;
+    microToGui.rate = 0;
+    while (((guiToSio.inFlight > 0) || (microToGui.inFlight > 0)) &&
+        !connectionLost && ((tioStatsNow() - now) < DRAIN_NS)) {
+        tioEventWait(10);
+    }
+
+    printf("%-12s %10s %10s %8s %8s %10s %9s %9s %9s %9s\n", "direction",
+        "sent", "received", "lost", "stalled", "msg/s", "p50 us", "p99 us",
+        "p999 us", "max us");
+    tioBenchReport(&guiToSio, seconds);
+    tioBenchReport(&microToGui, seconds);
+
+    close(timerFd);
+    close(guiToSio.fd);
+    close(microToGui.fd);
+    tioEventClose();
+    exit(connectionLost ? 1 : EXIT_SUCCESS);
+}
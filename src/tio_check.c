@@ -0,0 +1,155 @@
+/*
+ * tio_check.c
+ *
+ * Behaviour checks of the translation engine, run by make check.  Loads a
+ * fixture translation file and the image tio-compile made from it, then
+ * translates every case below with both: each result must be the one
+ * expected, and the two must agree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "translate_parser.h"
+
+struct CheckCase {
+    /* FROM_GUI or FROM_MICRO */
+    char origin;
+    const char *input;
+    const char *expected;
+};
+
+static const struct CheckCase checkCases[] = {
+    /* exact keys, with and without a setter */
+    { FROM_GUI, "meter.value=42", "x=42" },
+    { FROM_GUI, "wakeup", ">" },
+    { FROM_MICRO, "x=7", "meter.value=7" },
+
+    /* no rule and no default: passed on as is */
+    { FROM_GUI, "unknown", "unknown" },
+    { FROM_MICRO, "meter.value=1", "meter.value=1" },
+
+    /* an exact key beats a wildcard rule, even one earlier in the file */
+    { FROM_GUI, "meter.reset", "reset" },
+
+    /* a wildcard rule with no suffix */
+    { FROM_GUI, "meter.other", "wild meter" },
+
+    /* the longest prefix wins */
+    { FROM_GUI, "sensor.humidity", "sensor .humidity" },
+    { FROM_GUI, "sensor.temp.max", "temp .max" },
+
+    /* an empty prefix, a suffix and a setter */
+    { FROM_GUI, "tank.level=80", "level tank=80" },
+    { FROM_GUI, "dev7.state", "state of 7" },
+
+    /* the * can match nothing */
+    { FROM_GUI, "pump", "pump[]" },
+    { FROM_GUI, "dev.state", "state of " },
+
+    /* a duplicate rule is left out, the first one is used */
+    { FROM_GUI, "devX.state", "state of X" },
+
+    /* the suffix must end the key */
+    { FROM_GUI, "dev7.stateX", "dev7.stateX" },
+
+    /* many prefixes of the key have rules, only the shortest fits */
+    { FROM_GUI, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaX",
+        "short aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" },
+    { FROM_GUI, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaY", "y40" },
+    { FROM_GUI, "aaY", "y2" },
+
+    /* pattern rules, with a setter; the first in the file wins */
+    { FROM_GUI, "CH03:TEMP=215", "temp=215" },
+    { FROM_GUI, "CHab:TEMP=5", "other temp=5" },
+    { FROM_GUI, "CH3:TEMP=1", "CH3:TEMP=1" },
+
+    /* alternation */
+    { FROM_GUI, "on.switch", "switch" },
+    { FROM_GUI, "off.switch", "switch" },
+    { FROM_GUI, "onoff.switch", "onoff.switch" },
+
+    /* a negated class */
+    { FROM_GUI, "items.count=3", "count=3" },
+    { FROM_GUI, "item5.count=3", "item5.count=3" },
+
+    /* an escaped operator is literal */
+    { FROM_GUI, "a*b", "escaped star" },
+    { FROM_GUI, "aab", "aab" },
+
+    /* optional and repeated parts, the whole key must match */
+    { FROM_GUI, "xw", "optional" },
+    { FROM_GUI, "xzwww", "optional" },
+    { FROM_GUI, "xyz", "xyz" },
+
+    /* malformed patterns are not used */
+    { FROM_GUI, "a(b", "a(b" },
+    { FROM_GUI, "[ab", "[ab" },
+
+    /* each direction has its own patterns */
+    { FROM_MICRO, "ERR42", "error" },
+    { FROM_MICRO, "ERR", "ERR" },
+    { FROM_GUI, "ERR42", "ERR42" },
+};
+
+/**
+ * Translates a case's input with a set of translations.
+ */
+static void checkTranslate(const TranslatorState *state,
+    const struct CheckCase *check, char *out, size_t outSize)
+{
+    const size_t length = strlen(check->input);
+    if (check->origin == FROM_GUI) {
+        translate_gui_msg(state, check->input, length, out, outSize);
+    } else {
+        translate_micro_msg(state, check->input, length, out, outSize);
+    }
+}
+
+static TranslatorState *checkLoad(const char *path)
+{
+    TranslatorState *state = newTranslatorState(0);
+    if (loadTranslations(state, path) != 0) {
+        fprintf(stderr, "could not load %s\n", path);
+        exit(1);
+    }
+    return state;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <translate.txt> <image.tiob>\n", argv[0]);
+        exit(1);
+    }
+
+    TranslatorState *text = checkLoad(argv[1]);
+    TranslatorState *image = checkLoad(argv[2]);
+
+    const unsigned count = sizeof(checkCases) / sizeof(checkCases[0]);
+    unsigned failures = 0;
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        const struct CheckCase *check = &checkCases[i];
+        char fromText[MAX_LINE_SIZE];
+        char fromImage[MAX_LINE_SIZE];
+        checkTranslate(text, check, fromText, sizeof(fromText));
+        checkTranslate(image, check, fromImage, sizeof(fromImage));
+
+        if (strcmp(fromText, check->expected) != 0) {
+            printf("FAIL %c:%s from text: \"%s\", expected \"%s\"\n",
+                check->origin, check->input, fromText, check->expected);
+            failures++;
+        } else if (strcmp(fromImage, fromText) != 0) {
+            printf("FAIL %c:%s from image: \"%s\", from text \"%s\"\n",
+                check->origin, check->input, fromImage, fromText);
+            failures++;
+        }
+    }
+
+    deleteTranslatorState(text);
+    deleteTranslatorState(image);
+    printf("%u checks, %u failed\n", count, failures);
+    exit((failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
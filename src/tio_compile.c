@@ -0,0 +1,87 @@
+/*
+ * tio_compile.c
+ *
+ * Compiles a translation file into an image which tio-agent can load into
+ * memory as it is instead of parsing (tio-agent -f file.tiob).
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "translate_agent.h"
+#include "translate_parser.h"
+
+static void tioCompileDumpHelp(const char *progName)
+{
+    fprintf(stderr, "TIO Compile %s \n\n", TIO_VERSION);
+
+    fprintf(stderr, "usage: %s [options] <translate.txt> <image.tiob>\n"
+        "  where options are:\n"
+        "    -v            | --verbose              print progress messages\n"
+        "    -h            | -? | --help            print usage information\n",
+        progName);
+}
+
+int main(int argc, char** argv)
+{
+    int verboseFlag = 0;
+
+    /* allocate memory for progName since basename() modifies it */
+    const size_t nameLen = strlen(argv[0]) + 1;
+    char arg0[nameLen];
+    memcpy(arg0, argv[0], nameLen);
+    const char *progName = basename(arg0);
+
+    while (1) {
+        static struct option longOptions[] = {
+            { "verbose",    no_argument,       0, 'v' },
+            { "help",       no_argument,       0, 'h' },
+            { 0,            0, 0,  0  }
+        };
+        int c = getopt_long(argc, argv, "vh?", longOptions, 0);
+
+        if (c == -1) {
+            break;  // no more options to process
+        }
+
+        switch (c) {
+        case 'v':
+            verboseFlag = 1;
+            break;
+
+        case 'h':
+        case '?':
+        default:
+            tioCompileDumpHelp(progName);
+            exit(1);
+        }
+    }
+
+    if ((argc - optind) != 2) {
+        tioCompileDumpHelp(progName);
+        exit(1);
+    }
+    const char *textPath = argv[optind];
+    const char *imagePath = argv[optind + 1];
+
+    LogOpen(progName, 0, 0, verboseFlag);
+
+    /* no preallocation, so the indexes are sized by the actual rules */
+    TranslatorState *state = newTranslatorState(0);
+    if (loadTranslations(state, textPath) != 0) {
+        fprintf(stderr, "%s: could not load %s\n", progName, textPath);
+        exit(1);
+    }
+
+    const int rv = saveTranslations(state, imagePath);
+    deleteTranslatorState(state);
+    if (rv != 0) {
+        fprintf(stderr, "%s: could not write %s\n", progName, imagePath);
+        exit(1);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,169 @@
+/*
+ * tio_keys.c
+ *
+ * Synthetic message generation for the test tools.
+ */
+
+#define _GNU_SOURCE  /* for strndup() */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tio_keys.h"
+#include "translate_agent.h"
+#include "translate_parser.h"
+
+static uint64_t randomState = 88172645463325252ull;
+
+/**
+ * Returns the next number of a xorshift64* sequence, the same every run.
+ */
+uint64_t tioKeyRandom(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 2685821657736338717ull;
+}
+
+/**
+ * Adds a key in the form used by translation files.  A key ending in a =%d
+ * or =%s setter has a value appended to each message; the default key % is
+ * ignored.
+ */
+void tioKeySetAdd(struct TioKeySet *set, const char *key, size_t length)
+{
+    if ((length == 0) || ((length == 1) && (key[0] == '%'))) {
+        return;
+    }
+
+    struct TioKey *keys = realloc(set->keys,
+        (set->count + 1) * sizeof(struct TioKey));
+    if (keys == 0) {
+        dieWithSystemMessage("realloc() of keys failed");
+    }
+    set->keys = keys;
+
+    struct TioKey *entry = &keys[set->count++];
+    entry->setter = 0;
+    if ((length >= 3) && (key[length - 3] == '=') &&
+        (key[length - 2] == '%') &&
+        ((key[length - 1] == 'd') || (key[length - 1] == 's'))) {
+        entry->setter = key[length - 1];
+        length -= 2;
+    }
+    entry->text = strndup(key, length);
+    entry->length = length;
+    if (entry->text == 0) {
+        dieWithSystemMessage("strndup() of key failed");
+    }
+    if (length > set->longest) {
+        set->longest = length;
+    }
+}
+
+/**
+ * Takes the keys of a translation file: the G: keys into gui and the M: keys
+ * into micro.  Either set may be 0.
+ */
+void tioKeySetLoad(const char *path, struct TioKeySet *gui,
+    struct TioKeySet *micro)
+{
+    FILE *file = fopen(path, "r");
+    if (file == 0) {
+        dieWithSystemMessage("could not open translation file");
+    }
+
+    char line[MAX_LINE_SIZE];
+    while (fgets(line, sizeof(line), file) != 0) {
+        if ((line[0] == '\0') || (line[1] != ':')) {
+            continue;
+        }
+        const char *key = line + 2;
+        const size_t length = strcspn(key, ",\r\n");
+        if (key[length] != ',') {
+            continue;
+        }
+
+        if ((line[0] == FROM_GUI) && (gui != 0)) {
+            tioKeySetAdd(gui, key, length);
+        } else if ((line[0] == FROM_MICRO) && (micro != 0)) {
+            tioKeySetAdd(micro, key, length);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * Makes up count keys with integer setters, e.g. "micro12=%d".
+ */
+void tioKeySetMake(struct TioKeySet *set, const char *prefix, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        char key[64];
+        const int length = snprintf(key, sizeof(key), "%s%u=%%d", prefix, i);
+        tioKeySetAdd(set, key, length);
+    }
+}
+
+/**
+ * Sets up the cumulative probabilities for choosing keys; key i is chosen in
+ * proportion to 1 / (i + 1)^skew, so a skew of 0 chooses uniformly.  The set
+ * must not be empty.
+ */
+void tioKeySetPrepare(struct TioKeySet *set, double skew)
+{
+    set->cdf = malloc(set->count * sizeof(double));
+    if (set->cdf == 0) {
+        dieWithSystemMessage("malloc() of key distribution failed");
+    }
+
+    double total = 0;
+    unsigned i;
+    for (i = 0; i < set->count; i++) {
+        total += pow(i + 1, -skew);
+        set->cdf[i] = total;
+    }
+    for (i = 0; i < set->count; i++) {
+        set->cdf[i] /= total;
+    }
+}
+
+/**
+ * Writes one message made from a randomly chosen key, with its value and a
+ * newline.
+ *
+ * @param set the prepared keys
+ * @param buf room for the longest key plus TIO_KEY_VALUE_SIZE characters
+ *
+ * @return size_t the length of the message
+ */
+size_t tioKeySetFormat(const struct TioKeySet *set, char *buf)
+{
+    const double r = (tioKeyRandom() >> 11) * (1.0 / 9007199254740992.0);
+    unsigned low = 0;
+    unsigned high = set->count - 1;
+    while (low < high) {
+        const unsigned mid = (low + high) / 2;
+        if (set->cdf[mid] < r) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    const struct TioKey *key = &set->keys[low];
+
+    char *p = buf;
+    memcpy(p, key->text, key->length);
+    p += key->length;
+    if (key->setter == 'd') {
+        p += sprintf(p, "%u", (unsigned)(tioKeyRandom() % 100000));
+    } else if (key->setter == 's') {
+        p += sprintf(p, "v%u", (unsigned)(tioKeyRandom() % 100000));
+    }
+    *p++ = '\n';
+    return p - buf;
+}
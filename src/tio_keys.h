@@ -0,0 +1,45 @@
+/*
+ * tio_keys.h
+ *
+ * Synthetic message generation shared by the test tools (tio-bench,
+ * tio-translate-bench and fake-sio-agent).  A key set holds the keys
+ * messages are made from, taken from a translation file or made up, and
+ * chooses among them uniformly or with a Zipf skew.  The random sequence is
+ * the same every run.
+ */
+
+#ifndef TIO_KEYS_H_
+#define TIO_KEYS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* room to leave after a key for its value and the newline */
+#define TIO_KEY_VALUE_SIZE 32
+
+struct TioKey
+{
+    char *text;
+    size_t length;
+    char setter;    /* 'd' or 's' to append a value, 0 to send as is */
+};
+
+struct TioKeySet
+{
+    struct TioKey *keys;
+    unsigned count;
+    size_t longest;
+
+    /* the cumulative probability of choosing each key */
+    double *cdf;
+};
+
+uint64_t tioKeyRandom(void);
+void tioKeySetAdd(struct TioKeySet *set, const char *key, size_t length);
+void tioKeySetLoad(const char *path, struct TioKeySet *gui,
+    struct TioKeySet *micro);
+void tioKeySetMake(struct TioKeySet *set, const char *prefix, unsigned count);
+void tioKeySetPrepare(struct TioKeySet *set, double skew);
+size_t tioKeySetFormat(const struct TioKeySet *set, char *buf);
+
+#endif /* TIO_KEYS_H_ */
@@ -0,0 +1,156 @@
+/*
+ * tio_logdump.c
+ *
+ * Prints a binary message trace written by tio-agent -T <file>.  Given the
+ * translation file the agent was using, rules are shown by their key rather
+ * than just their index.
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "translate_agent.h"
+#include "translate_parser.h"
+#include "translate_rules.h"
+
+static void tioLogDumpHelp(const char *progName)
+{
+    fprintf(stderr, "TIO Log Dump %s \n\n", TIO_VERSION);
+
+    fprintf(stderr, "usage: %s [options] <trace file>\n"
+        "  where options are:\n"
+        "    -f<path>      | --file=<path>          translations the agent used\n"
+        "    -h            | -? | --help            print usage information\n",
+        progName);
+}
+
+static const char *tioLogDumpEventName(unsigned event)
+{
+    switch (event) {
+    case TIO_TRACE_RECEIVED:
+        return "received";
+    case TIO_TRACE_FOUND_KEY:
+        return "found key";
+    case TIO_TRACE_DEFAULT:
+        return "default";
+    case TIO_TRACE_UNTRANSLATED:
+        return "untranslated";
+    case TIO_TRACE_SENDING:
+        return "sending";
+    default:
+        return "unknown";
+    }
+}
+
+static void tioLogDumpRecord(const struct TioTraceRecord *record,
+    const TranslatorState *state)
+{
+    const time_t seconds = record->timestamp / 1000000000u;
+    struct tm tm;
+    char when[32];
+    localtime_r(&seconds, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+    printf("%s.%09lu %-5s %-12s length %u", when,
+        (unsigned long)(record->timestamp % 1000000000u),
+        (record->source == TIO_TRACE_FROM_GUI) ? "gui" : "micro",
+        tioLogDumpEventName(record->event), (unsigned)record->length);
+
+    if (record->rule != TIO_TRACE_NO_RULE) {
+        printf(" rule %u", (unsigned)record->rule);
+        if ((state != 0) && (record->rule < state->translationCount)) {
+            const struct translate_msg *translation = getTranslation(state,
+                record->rule);
+            printf(" \"%s\"", arenaString(&state->strings, translation->key));
+        }
+    }
+    putchar('\n');
+}
+
+int main(int argc, char** argv)
+{
+    const char *translatePath = 0;
+
+    /* allocate memory for progName since basename() modifies it */
+    const size_t nameLen = strlen(argv[0]) + 1;
+    char arg0[nameLen];
+    memcpy(arg0, argv[0], nameLen);
+    const char *progName = basename(arg0);
+
+    while (1) {
+        static struct option longOptions[] = {
+            { "file",       required_argument, 0, 'f' },
+            { "help",       no_argument,       0, 'h' },
+            { 0,            0, 0,  0  }
+        };
+        int c = getopt_long(argc, argv, "f:h?", longOptions, 0);
+
+        if (c == -1) {
+            break;  // no more options to process
+        }
+
+        switch (c) {
+        case 'f':
+            translatePath = optarg;
+            break;
+
+        case 'h':
+        case '?':
+        default:
+            tioLogDumpHelp(progName);
+            exit(1);
+        }
+    }
+
+    if ((argc - optind) != 1) {
+        tioLogDumpHelp(progName);
+        exit(1);
+    }
+    const char *tracePath = argv[optind];
+
+    LogOpen(progName, 0, 0, 0);
+
+    TranslatorState *state = 0;
+    if (translatePath != 0) {
+        state = newTranslatorState(0);
+        if (loadTranslations(state, translatePath) != 0) {
+            fprintf(stderr, "%s: could not load %s\n", progName,
+                translatePath);
+            exit(1);
+        }
+    }
+
+    FILE *file = fopen(tracePath, "rb");
+    if (file == 0) {
+        fprintf(stderr, "%s: could not open %s\n", progName, tracePath);
+        exit(1);
+    }
+
+    struct TioTraceHeader header;
+    if ((fread(&header, sizeof(header), 1, file) != 1) ||
+        (memcmp(header.magic, TIO_TRACE_MAGIC, sizeof(header.magic)) != 0)) {
+        fprintf(stderr, "%s: %s is not a trace file\n", progName, tracePath);
+        exit(1);
+    }
+    if ((header.version != TIO_TRACE_VERSION) ||
+        (header.recordSize != sizeof(struct TioTraceRecord))) {
+        fprintf(stderr, "%s: %s was written by a different tio-agent version "
+            "or platform\n", progName, tracePath);
+        exit(1);
+    }
+
+    struct TioTraceRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        tioLogDumpRecord(&record, state);
+    }
+
+    fclose(file);
+    if (state != 0) {
+        deleteTranslatorState(state);
+    }
+    exit(EXIT_SUCCESS);
+}
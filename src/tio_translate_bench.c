@@ -0,0 +1,345 @@
+/*
+ * tio_translate_bench.c
+ *
+ * Microbenchmark of the translation engine on its own.  Rule sets of
+ * increasing size are generated with key shapes like those in real
+ * translation files: dotted names under a few shared prefixes, setters
+ * taking integers and strings, and plain commands.  For each set the time
+ * to load it (as text and as a compiled image) and to translate hits,
+ * misses and setters in both directions is measured.  The results are
+ * written as CSV, one row per rule set and operation.
+ */
+
+#include <getopt.h>
+#include <libgen.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tio_keys.h"
+#include "translate_agent.h"
+#include "translate_parser.h"
+#include "translate_stats.h"
+
+#define DEFAULT_ITERATIONS 1000000
+#define DEFAULT_SIZES "10,100,1000,10000,100000"
+
+/* inputs are generated up front and cycled through while timing */
+#define INPUT_COUNT 4096
+#define INPUT_SIZE 128
+
+/* loads are repeated and the fastest kept */
+#define LOAD_REPEATS 5
+
+static const char *const prefixes[] = {
+    "meter", "meter.pump", "meter.tank", "system.status", "system.config",
+    "alarm", "io.input", "io.output"
+};
+#define PREFIX_COUNT (sizeof(prefixes) / sizeof(prefixes[0]))
+
+static const char *const names[] = {
+    "value", "level", "pressure", "flow", "temperature", "state", "limit",
+    "count"
+};
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+/* the kinds of rule generated, in turn */
+enum BenchRuleShape
+{
+    SHAPE_INTEGER,      /* G:meter.pump.flow3=%d,T:F3=%d */
+    SHAPE_STRING,       /* G:alarm.state4.label=%s,T:L4=%s */
+    SHAPE_PLAIN,        /* G:system.config.count5.reset,T:R5 */
+    SHAPE_MICRO,        /* M:T6=%d,T:meter.tank.level6=%d */
+    SHAPE_COUNT
+};
+
+static void tioTranslateBenchDumpHelp(const char *progName)
+{
+    fprintf(stderr, "TIO Translate Bench %s \n\n", TIO_VERSION);
+
+    fprintf(stderr, "usage: %s [options]\n"
+        "  where options are:\n"
+        "    -d<dir>       | --dir=<dir>            where to write rule sets, default = /tmp\n"
+        "    -n<count>     | --iterations=<count>   translations per measurement, default = %d\n"
+        "    -o<path>      | --output=<path>        write CSV to <path>, default = stdout\n"
+        "    -r<sizes>     | --rules=<sizes>        rule set sizes, default = %s\n"
+        "    -h            | -? | --help            print usage information\n",
+        progName, DEFAULT_ITERATIONS, DEFAULT_SIZES);
+}
+
+/**
+ * Writes the name rule i gets, e.g. "meter.pump.flow3".
+ */
+static int tioTranslateBenchName(char *buf, size_t size, unsigned i)
+{
+    return snprintf(buf, size, "%s.%s%u", prefixes[i % PREFIX_COUNT],
+        names[(i / PREFIX_COUNT) % NAME_COUNT], i);
+}
+
+/**
+ * Writes a rule set of the given size.
+ *
+ * @return int 0 on success, -1 if the file couldn't be written
+ */
+static int tioTranslateBenchWriteRules(const char *path, unsigned count)
+{
+    FILE *file = fopen(path, "w");
+    if (file == 0) {
+        return -1;
+    }
+
+    fprintf(file, "# %u generated rules\n", count);
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        char name[64];
+        tioTranslateBenchName(name, sizeof(name), i);
+        switch (i % SHAPE_COUNT) {
+        case SHAPE_INTEGER:
+            fprintf(file, "G:%s=%%d,T:F%u=%%d\n", name, i);
+            break;
+        case SHAPE_STRING:
+            fprintf(file, "G:%s.label=%%s,T:L%u=%%s\n", name, i);
+            break;
+        case SHAPE_PLAIN:
+            fprintf(file, "G:%s.reset,T:R%u\n", name, i);
+            break;
+        case SHAPE_MICRO:
+        default:
+            fprintf(file, "M:T%u=%%d,T:%s=%%d\n", i, name);
+            break;
+        }
+    }
+    return fclose(file);
+}
+
+/**
+ * Generates inputs matching rules of one shape, or matching none.
+ *
+ * @param inputs INPUT_COUNT buffers of INPUT_SIZE characters
+ * @param lengths receives the length of each input
+ * @param count the number of rules in the set
+ * @param shape the shape of rule to hit, SHAPE_COUNT for misses
+ */
+static void tioTranslateBenchInputs(char *inputs, size_t *lengths,
+    unsigned count, unsigned shape)
+{
+    unsigned i;
+    for (i = 0; i < INPUT_COUNT; i++) {
+        char *input = inputs + i * INPUT_SIZE;
+        const unsigned value = tioKeyRandom() % 100000;
+
+        /* a rule of the wanted shape, or any rule when missing */
+        unsigned rule = tioKeyRandom() % count;
+        if (shape < SHAPE_COUNT) {
+            rule = rule - (rule % SHAPE_COUNT) + shape;
+            if (rule >= count) {
+                rule = shape;
+            }
+        }
+
+        char name[64];
+        tioTranslateBenchName(name, sizeof(name), rule);
+        switch (shape) {
+        case SHAPE_INTEGER:
+            lengths[i] = snprintf(input, INPUT_SIZE, "%s=%u", name, value);
+            break;
+        case SHAPE_STRING:
+            lengths[i] = snprintf(input, INPUT_SIZE, "%s.label=v%u", name,
+                value);
+            break;
+        case SHAPE_PLAIN:
+            lengths[i] = snprintf(input, INPUT_SIZE, "%s.reset", name);
+            break;
+        case SHAPE_MICRO:
+            lengths[i] = snprintf(input, INPUT_SIZE, "T%u=%u", rule, value);
+            break;
+        default:
+            /* same shape as a hit, but no rule has this key */
+            lengths[i] = snprintf(input, INPUT_SIZE, "%s.missing=%u", name,
+                value);
+            break;
+        }
+    }
+}
+
+static void tioTranslateBenchRow(FILE *out, unsigned rules,
+    const char *operation, uint64_t iterations, uint64_t elapsed)
+{
+    fprintf(out, "%u,%s,%llu,%llu,%.1f,%.0f\n", rules, operation,
+        (unsigned long long)iterations, (unsigned long long)elapsed,
+        (double)elapsed / iterations,
+        (elapsed == 0) ? 0.0 : iterations * 1e9 / elapsed);
+    fflush(out);
+}
+
+/**
+ * Times loading a file, keeping the fastest of several loads.
+ */
+static void tioTranslateBenchLoad(FILE *out, unsigned rules,
+    const char *operation, const char *path)
+{
+    uint64_t best = UINT64_MAX;
+    unsigned i;
+    for (i = 0; i < LOAD_REPEATS; i++) {
+        TranslatorState *state = newTranslatorState(0);
+        const uint64_t start = tioStatsNow();
+        if (loadTranslations(state, path) != 0) {
+            fprintf(stderr, "could not load %s\n", path);
+            exit(1);
+        }
+        const uint64_t elapsed = tioStatsNow() - start;
+        deleteTranslatorState(state);
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    tioTranslateBenchRow(out, rules, operation, 1, best);
+}
+
+/**
+ * Times translating inputs of one shape.
+ */
+static void tioTranslateBenchTranslate(FILE *out, unsigned rules,
+    const char *operation, const TranslatorState *state, unsigned shape,
+    uint64_t iterations)
+{
+    static char inputs[INPUT_COUNT * INPUT_SIZE];
+    static size_t lengths[INPUT_COUNT];
+    tioTranslateBenchInputs(inputs, lengths, rules, shape);
+
+    char outMsg[MAX_LINE_SIZE];
+    size_t check = 0;
+    const uint64_t start = tioStatsNow();
+    uint64_t i;
+    for (i = 0; i < iterations; i++) {
+        const unsigned n = i & (INPUT_COUNT - 1);
+        if (shape == SHAPE_MICRO) {
+            check += translate_micro_msg(state, inputs + n * INPUT_SIZE,
+                lengths[n], outMsg, sizeof(outMsg));
+        } else {
+            check += translate_gui_msg(state, inputs + n * INPUT_SIZE,
+                lengths[n], outMsg, sizeof(outMsg));
+        }
+    }
+    const uint64_t elapsed = tioStatsNow() - start;
+
+    /* use the result so the loop can't be optimized away */
+    if (check == 0) {
+        fprintf(stderr, "no output from %s\n", operation);
+    }
+    tioTranslateBenchRow(out, rules, operation, iterations, elapsed);
+}
+
+int main(int argc, char** argv)
+{
+    const char *dir = "/tmp";
+    const char *outPath = 0;
+    const char *sizes = DEFAULT_SIZES;
+    uint64_t iterations = DEFAULT_ITERATIONS;
+
+    /* allocate memory for progName since basename() modifies it */
+    const size_t nameLen = strlen(argv[0]) + 1;
+    char arg0[nameLen];
+    memcpy(arg0, argv[0], nameLen);
+    const char *progName = basename(arg0);
+
+    while (1) {
+        static struct option longOptions[] = {
+            { "dir",        required_argument, 0, 'd' },
+            { "iterations", required_argument, 0, 'n' },
+            { "output",     required_argument, 0, 'o' },
+            { "rules",      required_argument, 0, 'r' },
+            { "help",       no_argument,       0, 'h' },
+            { 0,            0, 0,  0  }
+        };
+        int c = getopt_long(argc, argv, "d:n:o:r:h?", longOptions, 0);
+
+        if (c == -1) {
+            break;  // no more options to process
+        }
+
+        switch (c) {
+        case 'd':
+            dir = optarg;
+            break;
+
+        case 'n':
+            iterations = strtoull(optarg, 0, 10);
+            if (iterations == 0) {
+                iterations = DEFAULT_ITERATIONS;
+            }
+            break;
+
+        case 'o':
+            outPath = optarg;
+            break;
+
+        case 'r':
+            sizes = optarg;
+            break;
+
+        case 'h':
+        case '?':
+        default:
+            tioTranslateBenchDumpHelp(progName);
+            exit(1);
+        }
+    }
+
+    FILE *out = stdout;
+    if ((outPath != 0) && ((out = fopen(outPath, "w")) == 0)) {
+        dieWithSystemMessage("could not open output file");
+    }
+    fprintf(out, "rules,operation,iterations,total_ns,ns_per_op,ops_per_sec\n");
+
+    const char *size;
+    char *end;
+    for (size = sizes; *size != '\0'; size = (*end == ',') ? end + 1 : end) {
+        const unsigned rules = strtoul(size, &end, 10);
+        if (end == size) {
+            break;  // not a number
+        }
+        if (rules < SHAPE_COUNT) {
+            continue;
+        }
+
+        char textPath[4096];
+        char imagePath[4096];
+        snprintf(textPath, sizeof(textPath), "%s/tio-bench-%u.txt", dir, rules);
+        snprintf(imagePath, sizeof(imagePath), "%s/tio-bench-%u.tiob", dir,
+            rules);
+        if (tioTranslateBenchWriteRules(textPath, rules) != 0) {
+            dieWithSystemMessage("could not write rule set");
+        }
+
+        TranslatorState *state = newTranslatorState(0);
+        if ((loadTranslations(state, textPath) != 0) ||
+            (saveTranslations(state, imagePath) != 0)) {
+            fprintf(stderr, "%s: could not compile %s\n", progName, textPath);
+            exit(1);
+        }
+
+        tioTranslateBenchLoad(out, rules, "load_text", textPath);
+        tioTranslateBenchLoad(out, rules, "load_image", imagePath);
+        tioTranslateBenchTranslate(out, rules, "gui_hit_integer", state,
+            SHAPE_INTEGER, iterations);
+        tioTranslateBenchTranslate(out, rules, "gui_hit_string", state,
+            SHAPE_STRING, iterations);
+        tioTranslateBenchTranslate(out, rules, "gui_hit_plain", state,
+            SHAPE_PLAIN, iterations);
+        tioTranslateBenchTranslate(out, rules, "gui_miss", state,
+            SHAPE_COUNT, iterations);
+        tioTranslateBenchTranslate(out, rules, "micro_hit_integer", state,
+            SHAPE_MICRO, iterations);
+
+        deleteTranslatorState(state);
+        remove(textPath);
+        remove(imagePath);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -15,36 +15,77 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/select.h>
 
 #include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_output.h"
 #include "translate_parser.h"
+#include "translate_pipeline.h"
+#include "translate_reload.h"
+#include "translate_stats.h"
 #include "read_line.h"
 
 static int keepGoing;
+static volatile sig_atomic_t statsRequested;
 static const char *progName;
 
+/**
+ * What to do when a connection's output queue grows past its limit.
+ */
+enum TioOverflowPolicy
+{
+    TIO_OVERFLOW_DROP_OLDEST,   /* discard the oldest queued messages */
+    TIO_OVERFLOW_DISCONNECT,    /* close the connection */
+    TIO_OVERFLOW_PAUSE          /* stop reading from whoever fills it */
+};
+
+/**
+ * The settings the agent runs with, filled in from the command line.
+ */
+struct TioAgentOptions
+{
+    const char *translatePath;
+    unsigned refreshDelay;      /* in seconds, 0 = disabled */
+    unsigned short tioPort;     /* 0 means use Unix socket */
+    const char *tioSocketPath;
+    unsigned short sioPort;     /* 0 means use Unix socket */
+    const char *sioSocketPath;
+    unsigned short mapSize;
+    unsigned maxViewers;
+    size_t lineSize;            /* longest message that can be received */
+    int flushImmediate;         /* write each message as it is translated */
+    size_t queueLimit;          /* output queue high watermark in bytes */
+    enum TioOverflowPolicy overflowPolicy;
+    const char *statsSocketPath;    /* 0 = no stats socket */
+    int workers;                /* translate on a thread per direction */
+    int uring;                  /* use the io_uring event engine */
+};
+
 static void tioDumpHelp();
-static void tioAgent(const char *translatePath, unsigned refreshDelay,
-    unsigned short tioPort, const char *tioSocketPath, unsigned short sioPort,
-    const char *sioSocketPath, const unsigned short mapSize);
-static inline int max(int a, int b) { return (a > b) ? a : b; }
+static void tioAgent(const struct TioAgentOptions *options);
 
 int main(int argc, char** argv)
 {
-    const char *transFilePath = TIO_DEFAULT_TRANSLATION_FILE_PATH;
-    unsigned refreshDelay = 0;   /* in seconds, 0 = disabled */
+    struct TioAgentOptions options;
+    memset(&options, 0, sizeof(options));
+    options.translatePath = TIO_DEFAULT_TRANSLATION_FILE_PATH;
+    options.tioSocketPath = TIO_AGENT_UNIX_SOCKET;
+    options.sioSocketPath = SIO_AGENT_UNIX_SOCKET;
+    options.mapSize = MAX_MSG_MAP_SIZE;
+    options.maxViewers = DEFAULT_MAX_VIEWERS;
+    options.lineSize = READ_BUF_SIZE;
+    options.queueLimit = DEFAULT_QUEUE_LIMIT;
+    options.overflowPolicy = TIO_OVERFLOW_DROP_OLDEST;
+
     const char *logFilePath = 0;
+    const char *traceFilePath = 0;
     /* 
      * syslog isn't installed on the target so it's disabled in this program
      * by requiring an argument to -o|--log.
      */ 
     int logToSyslog = 0;
-    unsigned short sioPort = 0;  /* 0 means use Unix socket */
-    unsigned short tioPort = 0;
     int daemonFlag = 0;
     int verboseFlag = 0;
-    unsigned short mapSize = MAX_MSG_MAP_SIZE;
 
     /* allocate memory for progName since basename() modifies it */
     const size_t nameLen = strlen(argv[0]) + 1;
@@ -56,15 +97,25 @@ int main(int argc, char** argv)
         static struct option longOptions[] = {
             { "daemon",     no_argument,       0, 'd' },
             { "file",       required_argument, 0, 'f' },
+            { "line-size",  required_argument, 0, 'l' },
             { "map-size",   optional_argument, 0, 'm' },
+            { "overflow",   required_argument, 0, 'p' },
+            { "queue-size", required_argument, 0, 'q' },
             { "refresh",    optional_argument, 0, 'r' },
             { "sio_port",   optional_argument, 0, 's' },
+            { "stats",      required_argument, 0, 'S' },
             { "tio_port",   optional_argument, 0, 't' },
+            { "trace",      required_argument, 0, 'T' },
+            { "uring",      no_argument,       0, 'u' },
             { "verbose",    no_argument,       0, 'v' },
+            { "viewers",    required_argument, 0, 'n' },
+            { "workers",    no_argument,       0, 'w' },
+            { "immediate",  no_argument,       0, 'i' },
+            { "log",        required_argument, 0, 'o' },
             { "help",       no_argument,       0, 'h' },
             { 0,            0, 0,  0  }
         };
-        int c = getopt_long(argc, argv, "df:m:r::s::t::vh?", longOptions, 0);
+        int c = getopt_long(argc, argv, "df:il:m:n:o:p:q:r::s::S:t::T:uvwh?", longOptions, 0);
 
         if (c == -1) {
             break;  // no more options to process
@@ -76,29 +127,96 @@ int main(int argc, char** argv)
             break;
 
         case 'f':
-            transFilePath = optarg;
+            options.translatePath = optarg;
+            break;
+
+        case 'i':
+            options.flushImmediate = 1;
+            break;
+
+        case 'l':
+            options.lineSize = strtoul(optarg, 0, 10);
+            if (options.lineSize < READ_BUF_SIZE) {
+                options.lineSize = READ_BUF_SIZE;
+            }
             break;
 
         case 'm':
-            mapSize = (optarg == 0) ? MAX_MSG_MAP_SIZE : atoi(optarg);
+            options.mapSize = (optarg == 0) ? MAX_MSG_MAP_SIZE : atoi(optarg);
+            break;
+
+        case 'n': {
+            char *end;
+            const long count = strtol(optarg, &end, 10);
+            if ((end == optarg) || (*end != '\0') || (count <= 0) ||
+                (count > MAX_VIEWERS_LIMIT)) {
+                tioDumpHelp();
+                exit(1);
+            }
+            options.maxViewers = count;
+            break;
+        }
+
+        case 'o':
+            if (strcmp(optarg, "syslog") == 0) {
+                logToSyslog = 1;
+            } else {
+                logFilePath = optarg;
+            }
+            break;
+
+        case 'p':
+            if (strcmp(optarg, "drop") == 0) {
+                options.overflowPolicy = TIO_OVERFLOW_DROP_OLDEST;
+            } else if (strcmp(optarg, "disconnect") == 0) {
+                options.overflowPolicy = TIO_OVERFLOW_DISCONNECT;
+            } else if (strcmp(optarg, "pause") == 0) {
+                options.overflowPolicy = TIO_OVERFLOW_PAUSE;
+            } else {
+                tioDumpHelp();
+                exit(1);
+            }
+            break;
+
+        case 'q':
+            options.queueLimit = strtoul(optarg, 0, 10);
+            if (options.queueLimit == 0) {
+                options.queueLimit = DEFAULT_QUEUE_LIMIT;
+            }
             break;
 
         case 'r':
-            refreshDelay = (optarg == 0) ? DEFAULT_REFRESH_DELAY : atoi(optarg);
+            options.refreshDelay = (optarg == 0) ? DEFAULT_REFRESH_DELAY : atoi(optarg);
             break;
 
         case 's':
-            sioPort = (optarg == 0) ? SIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            options.sioPort = (optarg == 0) ? SIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            break;
+
+        case 'S':
+            options.statsSocketPath = optarg;
             break;
 
         case 't':
-            tioPort = (optarg == 0) ? TIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            options.tioPort = (optarg == 0) ? TIO_DEFAULT_AGENT_PORT : atoi(optarg);
+            break;
+
+        case 'T':
+            traceFilePath = optarg;
+            break;
+
+        case 'u':
+            options.uring = 1;
             break;
 
         case 'v':
             verboseFlag = 1;
             break;
 
+        case 'w':
+            options.workers = 1;
+            break;
+
         case 'h':
         case '?':
         default:
@@ -107,9 +225,6 @@ int main(int argc, char** argv)
         }
     }
 
-    /* set up logging to syslog or file; will be STDERR not told otherwise */
-    LogOpen(progName, logToSyslog, logFilePath, verboseFlag);
-
     /* keep STDIO going for now */
     if (daemonFlag) {
         if (daemon(0, 1) != 0) {
@@ -117,8 +232,16 @@ int main(int argc, char** argv)
         }
     }
 
-    tioAgent(transFilePath, refreshDelay, tioPort, TIO_AGENT_UNIX_SOCKET,
-        sioPort, SIO_AGENT_UNIX_SOCKET, mapSize);
+    /*
+     * set up logging to syslog or file; will be STDERR not told otherwise.
+     * After daemon() since the log writer thread wouldn't survive its fork.
+     */
+    LogOpen(progName, logToSyslog, logFilePath, verboseFlag);
+    if ((traceFilePath != 0) && (LogTraceOpen(traceFilePath) != 0)) {
+        dieWithSystemMessage("could not open trace file");
+    }
+
+    tioAgent(&options);
 
     exit(EXIT_SUCCESS);
 }
@@ -131,13 +254,24 @@ static void tioDumpHelp()
         "  where options are:\n"
         "    -d            | --daemon               run in background\n"
         "    -f<path>      | --file=<path>          use <file> for translations\n"
-        "    -m<map size>  | --map-size=<map-size>  used for translations\n"
-        "    -r<delay>     | --refresh=<delay>      autorefresh translation file\n"
+        "    -i            | --immediate            write each message when translated\n"
+        "    -l<size>      | --line-size=<size>     longest message, default = %d\n"
+        "    -m<map size>  | --map-size=<map-size>  translations to preallocate\n"
+        "    -n<count>     | --viewers=<count>      max qml-viewer connections, 1-%d\n"
+        "    -o<path>      | --log=<path>           log to <path> or \"syslog\"\n"
+        "    -p<policy>    | --overflow=<policy>    full queue: drop, disconnect, pause\n"
+        "    -q<bytes>     | --queue-size=<bytes>   output queue limit, default = %d\n"
+        "    -r[<delay>]   | --refresh[=<delay>]    reload translation file on change\n"
         "    -s[<port>]    | --sio-port[=<port>]    use TCP socket, default = %d\n"
+        "    -S<path>      | --stats=<path>         serve counters on Unix socket\n"
         "    -t[<port>]    | --tio-port[=<port>]    use TCP socket, default = %d\n"
+        "    -T<path>      | --trace=<path>         write binary message trace\n"
+        "    -u            | --uring                use io_uring if the kernel can\n"
         "    -v            | --verbose              print progress messages\n"
+        "    -w            | --workers              translate on a thread per direction\n"
         "    -h            | -? | --help            print usage information\n",
-        progName, SIO_DEFAULT_AGENT_PORT, TIO_DEFAULT_AGENT_PORT);
+        progName, READ_BUF_SIZE, MAX_VIEWERS_LIMIT, DEFAULT_QUEUE_LIMIT,
+        SIO_DEFAULT_AGENT_PORT, TIO_DEFAULT_AGENT_PORT);
 }
 
 static void tioInterruptHandler(int sig)
@@ -145,18 +279,700 @@ static void tioInterruptHandler(int sig)
     keepGoing = 0;
 }
 
-static void tioAgent(const char *translatePath, unsigned refreshDelay,
-    unsigned short tioPort, const char *tioSocketPath, unsigned short sioPort,
-    const char *sioSocketPath, const unsigned short mapSize)
+static void tioStatsHandler(int sig)
+{
+    statsRequested = 1;
+}
+
+struct TioAgent;
+
+/**
+ * A connected qml-viewer.
+ */
+struct TioViewer
+{
+    struct TioAgent *agent;
+    int fd;
+
+    /* characters received from the viewer, not yet a complete line */
+    struct LineBuffer fromQv;
+
+    /* translated micro messages waiting to be written to the viewer */
+    struct TioOutQueue toQv;
+};
+
+/**
+ * Everything the event handlers need to know about the agent's connections.
+ */
+struct TioAgent
+{
+    const struct TioAgentOptions *options;
+
+    /* qml-viewer listening socket, -1 if not open */
+    int listenFd;
+    int listenWatched;
+    int addressFamily;
+
+    /* connected qml-viewers, viewerCount of maxViewers slots in use */
+    struct TioViewer **viewers;
+    unsigned viewerCount;
+
+    /* connection to the sio_agent, -1 while not connected */
+    int sioFd;
+    struct LineBuffer fromSio;
+
+    /* translated qml-viewer messages waiting to be written to sio_agent */
+    struct TioOutQueue toSio;
+
+    /* set when toSio overflowed and the connection is to be dropped */
+    int sioOverflowed;
+
+    /* reading paused by TIO_OVERFLOW_PAUSE until the queues drain */
+    int sioPaused;
+    int viewersPaused;
+
+    /* when the data being split into lines was read, see tioStatsNow() */
+    uint64_t received;
+
+    /* the event engine receives and sends for the connections */
+    int uring;
+
+    /* scratch space for one translated message */
+    char *outMsg;
+    size_t outMsgSize;
+};
+
+static void tioAgentOnListen(int fd, unsigned events, void *context);
+
+/**
+ * Starts watching a connection for reading.  With io_uring the event engine
+ * receives for it and passes the data to onData; handler is then only called
+ * when the connection can be written to.
+ */
+static int tioAgentWatch(struct TioAgent *agent, int fd,
+    TioEventHandler handler, TioRecvHandler onData, void *context)
+{
+    if (agent->uring) {
+        return tioEventAddRecv(fd, TIO_EVENT_READ, handler, onData, context);
+    }
+    return tioEventAdd(fd, TIO_EVENT_READ, handler, context);
+}
+
+static void tioAgentWatchListener(struct TioAgent *agent, int watch)
+{
+    if ((agent->listenFd < 0) || (agent->listenWatched == watch)) {
+        return;
+    }
+
+    if (watch) {
+        if (tioEventAdd(agent->listenFd, TIO_EVENT_READ | TIO_EVENT_EDGE,
+            tioAgentOnListen, agent) != 0) {
+            dieWithSystemMessage("epoll_ctl() on listen socket failed");
+        }
+    } else {
+        tioEventRemove(agent->listenFd);
+    }
+    agent->listenWatched = watch;
+}
+
+static void tioAgentCloseViewer(struct TioAgent *agent, unsigned index)
+{
+    struct TioViewer *viewer = agent->viewers[index];
+
+    /* the fd is -1 if readLine2() already closed the socket */
+    if (viewer->fd >= 0) {
+        tioEventRemove(viewer->fd);
+        close(viewer->fd);
+    }
+    tioOutQueueClear(&viewer->toQv);
+    lineBufferFree(&viewer->fromQv);
+    free(viewer);
+
+    /* keep the in-use slots packed at the front */
+    agent->viewers[index] = agent->viewers[--agent->viewerCount];
+    agent->viewers[agent->viewerCount] = 0;
+    tioStats.viewerDisconnects++;
+    LogMsg(LOG_INFO, "[TIO] qml-viewer disconnected, %d remaining\n",
+        agent->viewerCount);
+
+    /* there is room again for anyone waiting in the listen backlog */
+    tioAgentWatchListener(agent, 1);
+}
+
+static void tioAgentCloseViewers(struct TioAgent *agent)
+{
+    while (agent->viewerCount > 0) {
+        tioAgentCloseViewer(agent, agent->viewerCount - 1);
+    }
+}
+
+static void tioAgentCloseListener(struct TioAgent *agent)
+{
+    if (agent->listenFd >= 0) {
+        tioAgentWatchListener(agent, 0);
+        close(agent->listenFd);
+        agent->listenFd = -1;
+    }
+}
+
+static int tioAgentFindViewer(const struct TioAgent *agent,
+    const struct TioViewer *viewer)
+{
+    unsigned i;
+    for (i = 0; i < agent->viewerCount; i++) {
+        if (agent->viewers[i] == viewer) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Writes as much as sio_agent will take of whatever is queued for it.  If
+ * that fails the messages are dropped; the read side notices the broken
+ * connection and reconnects.
+ *
+ * @return int 0 on success, -1 if the queue had to be dropped
+ */
+static int tioAgentFlushSio(struct TioAgent *agent)
+{
+    if ((agent->sioFd >= 0) &&
+        (tioOutQueueFlush(&agent->toSio, agent->sioFd) < 0)) {
+        perror("send to sio_agent socket failed");
+        tioOutQueueClear(&agent->toSio);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Writes whatever is queued for each qml-viewer, closing any viewer that
+ * can't be written to.
+ */
+static void tioAgentFlushViewers(struct TioAgent *agent)
+{
+    /* walk backwards so closing a viewer doesn't skip the next one */
+    unsigned i = agent->viewerCount;
+    while (i-- > 0) {
+        struct TioViewer *viewer = agent->viewers[i];
+        if (tioOutQueueFlush(&viewer->toQv, viewer->fd) < 0) {
+            perror("send to qml-viewer socket failed");
+            tioAgentCloseViewer(agent, i);
+        }
+    }
+}
+
+/**
+ * Applies the overflow policy to a queue which has just had a message added.
+ *
+ * @param agent the agent
+ * @param queue the queue
+ * @param peer the name of the queue's peer, for messages
+ * @param stats the counters of the direction the queue's messages went
+ *
+ * @return int 1 if the connection should be closed, 0 otherwise
+ */
+static int tioAgentCheckOverflow(struct TioAgent *agent,
+    struct TioOutQueue *queue, const char *peer,
+    struct TioDirectionStats *stats)
+{
+    const struct TioAgentOptions *options = agent->options;
+    if (queue->bytes <= options->queueLimit) {
+        return 0;
+    }
+
+    switch (options->overflowPolicy) {
+    case TIO_OVERFLOW_DROP_OLDEST: {
+        const unsigned dropped = tioOutQueueDropOldest(queue,
+            options->queueLimit / 2);
+        stats->dropped += dropped;
+        LogMsg(LOG_ERR, "[TIO] %s is not keeping up, dropped %u messages\n",
+            peer, dropped);
+        return 0;
+    }
+
+    case TIO_OVERFLOW_DISCONNECT:
+        LogMsg(LOG_ERR, "[TIO] %s is not keeping up, disconnecting\n", peer);
+        tioStats.overflowDisconnects++;
+        return 1;
+
+    case TIO_OVERFLOW_PAUSE:
+    default:
+        /* tioAgentUpdateEvents() stops reading until the queue drains */
+        return 0;
+    }
+}
+
+/**
+ * Registers the events each connection needs: writability while it has
+ * output queued, and readability unless TIO_OVERFLOW_PAUSE has stopped
+ * reading.  Reading from sio_agent is paused while any viewer's queue is over
+ * the limit, and reading from the viewers while the sio_agent queue is, until
+ * the queue is back under half the limit.
+ */
+static void tioAgentUpdateEvents(struct TioAgent *agent)
+{
+    const struct TioAgentOptions *options = agent->options;
+    unsigned i;
+
+    if (options->overflowPolicy == TIO_OVERFLOW_PAUSE) {
+        size_t viewerBytes = 0;
+        for (i = 0; i < agent->viewerCount; i++) {
+            if (agent->viewers[i]->toQv.bytes > viewerBytes) {
+                viewerBytes = agent->viewers[i]->toQv.bytes;
+            }
+        }
+
+        const int sioPaused = agent->sioPaused ?
+            (viewerBytes > (options->queueLimit / 2)) :
+            (viewerBytes > options->queueLimit);
+        if (sioPaused != agent->sioPaused) {
+            LogMsg(LOG_INFO, "[TIO] %s reading from sio-agent\n",
+                sioPaused ? "pausing" : "resuming");
+            agent->sioPaused = sioPaused;
+        }
+
+        const int viewersPaused = agent->viewersPaused ?
+            (agent->toSio.bytes > (options->queueLimit / 2)) :
+            (agent->toSio.bytes > options->queueLimit);
+        if (viewersPaused != agent->viewersPaused) {
+            LogMsg(LOG_INFO, "[TIO] %s reading from qml-viewers\n",
+                viewersPaused ? "pausing" : "resuming");
+            agent->viewersPaused = viewersPaused;
+        }
+    }
+
+    if (agent->sioFd >= 0) {
+        const unsigned events = (agent->sioPaused ? 0 : TIO_EVENT_READ) |
+            ((agent->toSio.count > 0) ? TIO_EVENT_WRITE : 0);
+        if (tioEventModify(agent->sioFd, events) != 0) {
+            LogMsg(LOG_ERR, "[TIO] epoll_ctl() on sio_agent failed, "
+                "errno = %d\n", errno);
+        }
+    }
+
+    for (i = 0; i < agent->viewerCount; i++) {
+        struct TioViewer *viewer = agent->viewers[i];
+        const unsigned events = (agent->viewersPaused ? 0 : TIO_EVENT_READ) |
+            ((viewer->toQv.count > 0) ? TIO_EVENT_WRITE : 0);
+        if (tioEventModify(viewer->fd, events) != 0) {
+            LogMsg(LOG_ERR, "[TIO] epoll_ctl() on viewer failed, "
+                "errno = %d\n", errno);
+        }
+    }
+}
+
+/**
+ * Queues a translated qml-viewer message for sio_agent.
+ */
+static void tioAgentQueueForSio(struct TioAgent *agent, struct TioMsgBuf *buf)
+{
+    buf->latency = &tioStats.fromGui.sendLatency;
+    if (tioOutQueuePush(&agent->toSio, buf) != 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory queueing sio_agent message\n");
+    }
+
+    /* closing sio_agent closes the viewers, so leave it to the main loop */
+    if (tioAgentCheckOverflow(agent, &agent->toSio, "sio-agent",
+        &tioStats.fromGui)) {
+        agent->sioOverflowed = 1;
+    }
+
+    if (agent->options->flushImmediate) {
+        tioAgentFlushSio(agent);
+    }
+}
+
+/**
+ * Translates one message from a qml-viewer and queues the result for
+ * sio_agent, or hands it to the translator thread to do so.
+ */
+static void tioAgentOnViewerLine(char *inMsg, size_t length, void *context)
+{
+    struct TioAgent *agent = context;
+    tioStats.fromGui.messages++;
+    tioStats.fromGui.bytes += length;
+    if (agent->sioFd < 0) {
+        tioStats.fromGui.discarded++;
+        return;
+    }
+
+    LogTrace(TIO_TRACE_RECEIVED, TIO_TRACE_FROM_GUI, TIO_TRACE_NO_RULE,
+        length);
+    if (agent->options->workers) {
+        if (tioPipelinePush(TIO_TRACE_FROM_GUI, inMsg, length,
+            agent->received) != 0) {
+            tioStats.fromGui.dropped++;
+            LogMsg(LOG_ERR, "[TIO] qml-viewer translator is not keeping up, "
+                "dropped a message\n");
+        }
+        return;
+    }
+
+    const size_t outLength = translate_gui_msg(tioTranslatorState(), inMsg,
+        length, agent->outMsg, agent->outMsgSize);
+    tioHistogramRecord(&tioStats.fromGui.translateLatency,
+        tioStatsNow() - agent->received);
+    LogMsg(LOG_INFO, "[TIO] sending => \"%s\"\n", agent->outMsg);
+    LogTrace(TIO_TRACE_SENDING, TIO_TRACE_FROM_GUI, TIO_TRACE_NO_RULE,
+        outLength);
+    tioStats.fromGui.sent++;
+    tioStats.fromGui.sentBytes += outLength;
+
+    struct TioMsgBuf *buf = tioMsgBufCreate(agent->outMsg, outLength, "\r");
+    if (buf == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for sio_agent message\n");
+        return;
+    }
+    buf->received = agent->received;
+    tioAgentQueueForSio(agent, buf);
+    tioMsgBufUnref(buf);
+}
+
+static void tioAgentOnViewer(int fd, unsigned events, void *context)
+{
+    struct TioViewer *viewer = context;
+    struct TioAgent *agent = viewer->agent;
+
+    if ((events & TIO_EVENT_WRITE) &&
+        (tioOutQueueFlush(&viewer->toQv, fd) < 0)) {
+        perror("send to qml-viewer socket failed");
+        tioAgentCloseViewer(agent, tioAgentFindViewer(agent, viewer));
+        return;
+    }
+
+    /* connected qml-viewer has something to say */
+    if (!(events & (TIO_EVENT_READ | TIO_EVENT_ERROR))) {
+        return;
+    }
+    agent->received = tioStatsNow();
+    if (readLine2(fd, &viewer->fromQv, "qml-viewer", tioAgentOnViewerLine,
+        agent) < 0) {
+        /* readLine2() closed the socket; make sure it isn't closed twice */
+        tioEventRemove(fd);
+        viewer->fd = -1;
+        tioAgentCloseViewer(agent, tioAgentFindViewer(agent, viewer));
+    }
+}
+
+static void tioAgentOnViewerData(int fd, char *data, ssize_t length,
+    void *context)
+{
+    struct TioViewer *viewer = context;
+    struct TioAgent *agent = viewer->agent;
+
+    if (length <= 0) {
+        LogMsg(LOG_INFO, "[TIO] recv() from qml-viewer failed, client closed\n");
+        tioAgentCloseViewer(agent, tioAgentFindViewer(agent, viewer));
+        return;
+    }
+    agent->received = tioStatsNow();
+    lineBufferFeed(&viewer->fromQv, data, length, "qml-viewer",
+        tioAgentOnViewerLine, agent);
+}
+
+static void tioAgentOnListen(int fd, unsigned events, void *context)
+{
+    struct TioAgent *agent = context;
+
+    /* edge triggered, so accept everything that is queued */
+    while (agent->viewerCount < agent->options->maxViewers) {
+        const int connectedFd = tioQvSocketAccept(fd, agent->addressFamily);
+        if (connectedFd < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                LogMsg(LOG_ERR, "[TIO] accept() failed, errno = %d\n", errno);
+            }
+            return;
+        }
+
+        struct TioViewer *viewer = calloc(1, sizeof(struct TioViewer));
+        if (viewer == 0) {
+            LogMsg(LOG_ERR, "[TIO] out of memory for qml-viewer\n");
+            close(connectedFd);
+            return;
+        }
+        viewer->agent = agent;
+        viewer->fd = connectedFd;
+        tioOutQueueInit(&viewer->toQv);
+        if (tioSetNonBlocking(connectedFd) != 0) {
+            LogMsg(LOG_ERR, "[TIO] fcntl() on viewer failed, errno = %d\n",
+                errno);
+        }
+        if ((agent->options->tioPort != 0) &&
+            (tioSocketSetNoDelay(connectedFd) != 0)) {
+            LogMsg(LOG_ERR, "[TIO] TCP_NODELAY on viewer failed, errno = %d\n",
+                errno);
+        }
+        if (lineBufferInit(&viewer->fromQv, agent->options->lineSize) != 0) {
+            LogMsg(LOG_ERR, "[TIO] out of memory for qml-viewer\n");
+            close(connectedFd);
+            free(viewer);
+            return;
+        }
+
+        if (tioAgentWatch(agent, connectedFd, tioAgentOnViewer,
+            tioAgentOnViewerData, viewer) != 0) {
+            LogMsg(LOG_ERR, "[TIO] epoll_ctl() on viewer failed, errno = %d\n",
+                errno);
+            close(connectedFd);
+            lineBufferFree(&viewer->fromQv);
+            free(viewer);
+            return;
+        }
+        agent->viewers[agent->viewerCount++] = viewer;
+        tioStats.viewerConnects++;
+        LogMsg(LOG_INFO, "[TIO] qml-viewer connected, %d of %d\n",
+            agent->viewerCount, agent->options->maxViewers);
+    }
+
+    /* full, leave further connections in the backlog until a viewer leaves */
+    tioAgentWatchListener(agent, 0);
+}
+
+/**
+ * Queues one translated micro message for every connected viewer.  Each
+ * viewer's queue references the same buffer.
+ */
+static void tioAgentQueueForViewers(struct TioAgent *agent,
+    struct TioMsgBuf *buf)
+{
+    buf->latency = &tioStats.fromMicro.sendLatency;
+
+    /* walk backwards so closing a viewer doesn't skip the next one */
+    unsigned i = agent->viewerCount;
+    while (i-- > 0) {
+        struct TioViewer *viewer = agent->viewers[i];
+        if (tioOutQueuePush(&viewer->toQv, buf) != 0) {
+            LogMsg(LOG_ERR, "[TIO] out of memory queueing qml-viewer message\n");
+        }
+        if (tioAgentCheckOverflow(agent, &viewer->toQv, "qml-viewer",
+            &tioStats.fromMicro)) {
+            tioAgentCloseViewer(agent, i);
+        }
+    }
+
+    if (agent->options->flushImmediate) {
+        tioAgentFlushViewers(agent);
+    }
+}
+
+/**
+ * Sends one translated micro message to every connected viewer.  The message
+ * and its terminator are copied once into a shared buffer.
+ */
+static void tioAgentFanOut(struct TioAgent *agent, const char *msg,
+    size_t length)
+{
+    LogMsg(LOG_INFO, "[TIO] sending => \"%s\"\n", msg);
+
+    struct TioMsgBuf *buf = tioMsgBufCreate(msg, length, "\n");
+    if (buf == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for qml-viewer message\n");
+        return;
+    }
+    buf->received = agent->received;
+    tioAgentQueueForViewers(agent, buf);
+    tioMsgBufUnref(buf);
+}
+
+/**
+ * Translates one message from sio_agent and sends the result to every
+ * qml-viewer, or hands it to the translator thread to do so.
+ */
+static void tioAgentOnSioLine(char *inMsg, size_t length, void *context)
+{
+    struct TioAgent *agent = context;
+    tioStats.fromMicro.messages++;
+    tioStats.fromMicro.bytes += length;
+    if (agent->viewerCount == 0) {
+        tioStats.fromMicro.discarded++;
+        return;
+    }
+
+    LogTrace(TIO_TRACE_RECEIVED, TIO_TRACE_FROM_MICRO, TIO_TRACE_NO_RULE,
+        length);
+    if (agent->options->workers) {
+        if (tioPipelinePush(TIO_TRACE_FROM_MICRO, inMsg, length,
+            agent->received) != 0) {
+            tioStats.fromMicro.dropped++;
+            LogMsg(LOG_ERR, "[TIO] sio-agent translator is not keeping up, "
+                "dropped a message\n");
+        }
+        return;
+    }
+
+    const size_t outLength = translate_micro_msg(tioTranslatorState(), inMsg,
+        length, agent->outMsg, agent->outMsgSize);
+    tioHistogramRecord(&tioStats.fromMicro.translateLatency,
+        tioStatsNow() - agent->received);
+    LogTrace(TIO_TRACE_SENDING, TIO_TRACE_FROM_MICRO, TIO_TRACE_NO_RULE,
+        outLength);
+    tioStats.fromMicro.sent++;
+    tioStats.fromMicro.sentBytes += outLength;
+    tioAgentFanOut(agent, agent->outMsg, outLength);
+}
+
+/**
+ * Sends on a message translated by a translator thread.  The translate
+ * latency covers getting the translation back to the event loop.
+ */
+static void tioAgentOnTranslated(unsigned source, struct TioMsgBuf *buf,
+    void *context)
+{
+    struct TioAgent *agent = context;
+    const int fromGui = (source == TIO_TRACE_FROM_GUI);
+    struct TioDirectionStats *stats = fromGui ? &tioStats.fromGui :
+        &tioStats.fromMicro;
+
+    /* whoever it was for may have gone while it was being translated */
+    if (fromGui ? (agent->sioFd < 0) : (agent->viewerCount == 0)) {
+        stats->discarded++;
+        return;
+    }
+
+    /* less the terminator */
+    const size_t outLength = buf->length - 1;
+    tioHistogramRecord(&stats->translateLatency,
+        tioStatsNow() - buf->received);
+    LogMsg(LOG_INFO, "[TIO] sending => \"%.*s\"\n", (int)outLength,
+        buf->data);
+    LogTrace(TIO_TRACE_SENDING, source, TIO_TRACE_NO_RULE, outLength);
+    stats->sent++;
+    stats->sentBytes += outLength;
+
+    if (fromGui) {
+        tioAgentQueueForSio(agent, buf);
+    } else {
+        tioAgentQueueForViewers(agent, buf);
+    }
+}
+
+/**
+ * Drops everything and goes back to reopening the sio_agent connection.  The
+ * socket must already be closed.
+ */
+static void tioAgentDropSio(struct TioAgent *agent)
+{
+    agent->sioFd = -1;
+    agent->sioOverflowed = 0;
+    tioStats.sioDisconnects++;
+    agent->sioPaused = 0;
+    agent->viewersPaused = 0;
+    lineBufferReset(&agent->fromSio);
+    tioOutQueueClear(&agent->toSio);
+    tioAgentCloseViewers(agent);
+    tioAgentCloseListener(agent);
+}
+
+static void tioAgentOnSio(int fd, unsigned events, void *context)
+{
+    struct TioAgent *agent = context;
+
+    /*
+     * sio_agent socket port has something to send to the tio_agent, if
+     * connected; a single read may carry several messages
+     */
+    if ((events & TIO_EVENT_WRITE) && (tioAgentFlushSio(agent) != 0)) {
+        return;
+    }
+
+    if (!(events & (TIO_EVENT_READ | TIO_EVENT_ERROR))) {
+        return;
+    }
+    agent->received = tioStatsNow();
+    if (readLine2(fd, &agent->fromSio, "sio-agent", tioAgentOnSioLine,
+        agent) < 0) {
+        /* readLine2() closed the socket; make sure it isn't closed twice */
+        tioEventRemove(fd);
+        tioAgentDropSio(agent);
+    }
+}
+
+static void tioAgentOnSioData(int fd, char *data, ssize_t length,
+    void *context)
 {
-    fd_set currFdSet;
-    int connectedFd = -1;  /* not currently connected */
-    time_t lastCheckTime = 0;
-    time_t lastModTime = 0;
-    int addressFamily = 0;
+    struct TioAgent *agent = context;
+
+    if (length <= 0) {
+        LogMsg(LOG_INFO, "[TIO] recv() from sio-agent failed, client closed\n");
+        tioEventRemove(fd);
+        close(fd);
+        tioAgentDropSio(agent);
+        return;
+    }
+    agent->received = tioStatsNow();
+    lineBufferFeed(&agent->fromSio, data, length, "sio-agent",
+        tioAgentOnSioLine, agent);
+}
+
+/**
+ * Tries to open the connection to the sio_agent and, once that succeeds, the
+ * listening socket for the qml-viewers.
+ *
+ * @return int 0 if connected or still trying, -1 if the agent can't continue
+ */
+static int tioAgentConnect(struct TioAgent *agent)
+{
+    const struct TioAgentOptions *options = agent->options;
+
+    agent->sioFd = tioSioSocketInit(options->sioPort, options->sioSocketPath);
+    if (agent->sioFd < 0) {
+        return 0;
+    }
 
-    TranslatorState *translatorState = GetTranslatorState();
-    initTranslations(translatorState, mapSize);
+    if (tioSetNonBlocking(agent->sioFd) != 0) {
+        dieWithSystemMessage("fcntl() on sio_agent socket failed");
+    }
+    if (tioAgentWatch(agent, agent->sioFd, tioAgentOnSio, tioAgentOnSioData,
+        agent) != 0) {
+        dieWithSystemMessage("epoll_ctl() on sio_agent socket failed");
+    }
+    tioStats.sioConnects++;
+
+    /* output is already gathered into as few writes as possible */
+    if ((options->sioPort != 0) && (tioSocketSetNoDelay(agent->sioFd) != 0)) {
+        LogMsg(LOG_ERR, "[TIO] TCP_NODELAY on sio_agent failed, errno = %d\n",
+            errno);
+    }
+
+    /* open socket for qml viewer */
+    agent->listenFd = tioQvSocketInit(options->tioPort, &agent->addressFamily,
+        options->tioSocketPath);
+    if (agent->listenFd < 0) {
+        /* open failed, can't continue */
+        LogMsg(LOG_ERR, "[TIO] could not open server socket\n");
+        return -1;
+    }
+
+    /* the listener is drained by accepting until EAGAIN */
+    if (tioSetNonBlocking(agent->listenFd) != 0) {
+        dieWithSystemMessage("fcntl() on listen socket failed");
+    }
+    tioAgentWatchListener(agent, 1);
+    return 0;
+}
+
+static void tioAgent(const struct TioAgentOptions *options)
+{
+    struct TioAgent agent;
+    memset(&agent, 0, sizeof(agent));
+    agent.options = options;
+    agent.listenFd = -1;
+    agent.sioFd = -1;
+    agent.viewers = calloc(options->maxViewers, sizeof(struct TioViewer *));
+    if (agent.viewers == 0) {
+        dieWithSystemMessage("calloc() of viewer table failed");
+    }
+    if (lineBufferInit(&agent.fromSio, options->lineSize) != 0) {
+        dieWithSystemMessage("malloc() of sio_agent buffer failed");
+    }
+
+    /* a translation can add up to a translation file line to a message */
+    agent.outMsgSize = options->lineSize + MAX_LINE_SIZE;
+    agent.outMsg = malloc(agent.outMsgSize);
+    if (agent.outMsg == 0) {
+        dieWithSystemMessage("malloc() of message buffer failed");
+    }
 
     {
         /* install a signal handler to remove the socket file */
@@ -171,173 +987,118 @@ static void tioAgent(const char *translatePath, unsigned refreshDelay,
             LogMsg(LOG_ERR, "[TIO] sigaction(SIGTERM) failed, errno = %d\n", errno);
             exit(1);
         }
+
+        /* SIGUSR1 logs the latency percentiles */
+        a.sa_handler = tioStatsHandler;
+        if (sigaction(SIGUSR1, &a, 0) != 0) {
+            LogMsg(LOG_ERR, "[TIO] sigaction(SIGUSR1) failed, errno = %d\n", errno);
+            exit(1);
+        }
     }
 
-    /* buffers for collection characters from each side */
-    struct LineBuffer fromSio;
-    fromSio.pos = 0;
-    struct LineBuffer fromQv;
-    fromQv.pos = 0;
+    if (options->uring) {
+        if (tioEventInitUring() == 0) {
+            agent.uring = 1;
+        } else {
+            LogMsg(LOG_ERR, "[TIO] io_uring not available, errno = %d, "
+                "using epoll\n", errno);
+        }
+    }
+    if (!agent.uring && (tioEventInit() != 0)) {
+        dieWithSystemMessage("epoll_create1() failed");
+    }
 
     /* do initial load, may get reloaded in while loop, below */
-    lastModTime = loadTranslations(translatorState, translatePath, 0);
-    lastCheckTime = time(0);
+    if (tioReloadInit(options->translatePath, options->mapSize,
+        options->refreshDelay) != 0) {
+        dieWithSystemMessage("setting up translation reload failed");
+    }
 
-    /* 
-     * This is the select loop which waits for characters to be received on the
+    if (options->workers &&
+        (tioPipelineInit(agent.outMsgSize, tioAgentOnTranslated, &agent) != 0)) {
+        dieWithSystemMessage("starting translator threads failed");
+    }
+
+    if ((options->statsSocketPath != 0) &&
+        (tioStatsInit(options->statsSocketPath) != 0)) {
+        dieWithSystemMessage("opening stats socket failed");
+    }
+
+    /*
+     * This is the event loop which waits for characters to be received on the
      * sio_agent descriptor and on either the listen socket (meaning an
-     * incoming connection is queued) or on a connected socket descriptor.  If
-     * not connected to the sio_agent, make select() time out to keep trying to
-     * open a connection to it.
+     * incoming connection is queued) or on a connected socket descriptor.  The
+     * handlers registered for each descriptor do the work.  If not connected
+     * to the sio_agent, make the wait time out to keep trying to open a
+     * connection to it.
      */
-    /* 100ms retry timeout for opening socket to sio_agent */
-    struct  timeval timeout;
-    int     sioFd       = -1;
-    int     listenFd    = -1;
-    int     nfds        = 0;
     keepGoing = 1;
     while (keepGoing) {
         /* try opening a connection to the sio_agent */
-        if (sioFd < 0) {
-            sioFd = tioSioSocketInit(sioPort, sioSocketPath);
-            if (sioFd >= 0) {
-                FD_ZERO(&currFdSet);
-                FD_SET(sioFd, &currFdSet);
-                nfds = max(sioFd,
-                    (connectedFd >= 0) ? connectedFd : listenFd) + 1;
-
-                /* open socket for qml viewer */
-                listenFd = tioQvSocketInit(tioPort, &addressFamily,
-                    tioSocketPath);
-                if (listenFd < 0) {
-                    /* open failed, can't continue */
-                    LogMsg(LOG_ERR, "[TIO] could not open server socket\n");
-                    return;
-                }
-                FD_SET(listenFd, &currFdSet);
-                nfds = listenFd + 1;
+        if (agent.sioFd < 0) {
+            if (tioAgentConnect(&agent) != 0) {
+                break;
             }
         }
 
-        /* figure out timeout value address */
-        struct timeval *pTimeout = 0;
-        if (sioFd < 0) {
-            /* Linux modifies the timeout value in select() so initialize it */
-            timeout.tv_sec = 0;
-            timeout.tv_usec = 100000;
-            pTimeout = &timeout;
-        }
-
-        fd_set readFdSet = currFdSet;
-        const int sel = select(nfds, &readFdSet, 0, 0, pTimeout);
-        if (sel == -1) {
+        /* 100ms retry timeout for opening socket to sio_agent */
+        const int timeoutMs = (agent.sioFd < 0) ? 100 : -1;
+        if (tioEventWait(timeoutMs) == -1) {
             if (errno != EINTR) {
-                dieWithSystemMessage("select() returned -1");
-            }
-            /* else keepGoing was set to 0 in signal handler */
-        } else if (sel > 0) {
-            /* check for a new connection to accept */
-            if (FD_ISSET(listenFd, &readFdSet)) {
-                /* new connection is here, accept it */
-                connectedFd = tioQvSocketAccept(listenFd, addressFamily);
-                if (connectedFd >= 0) {
-                    FD_CLR(listenFd, &currFdSet);
-                    FD_SET(connectedFd, &currFdSet);
-                    nfds = max(sioFd, connectedFd) + 1;
-                }
+                dieWithSystemMessage("epoll_wait() returned -1");
             }
+            /* else a signal handler cleared keepGoing or set statsRequested */
+        } /* else handled, or timeout to retry opening sio_agent socket */
 
-            /* see about auto reloading the translation file */
-            if ((refreshDelay > 0) &&
-                (time(0) > (lastCheckTime + refreshDelay))) {
-                lastModTime = loadTranslations(translatorState, translatePath, lastModTime);
-                lastCheckTime = time(0);
-            }
+        if (statsRequested) {
+            statsRequested = 0;
+            tioStatsLog();
+        }
 
-            /* check for packet received from qml-viewer */
-            if ((connectedFd >= 0) && FD_ISSET(connectedFd, &readFdSet)) {
-                /* connected qml-viewer has something to say */
-                char inMsg[READ_BUF_SIZE];
-                const int readCount = readLine2(connectedFd, inMsg,
-                    sizeof(inMsg), &fromSio, "qml-viewer");
-                if (readCount < 0) {
-                    /* socket closed, stop watching this file descriptor */
-                    FD_CLR(connectedFd, &currFdSet);
-                    FD_SET(listenFd, &currFdSet);
-                    connectedFd = -1;
-                    nfds = max(sioFd, listenFd) + 1;
-                } else if (readCount > 0) {
-                    if (sioFd >= 0) {
-                        /* 
-                         * this is a normal message from qml-viewer, translate
-                         * it and send the result to sio_agent 
-                         */ 
-                        char outMsg[READ_BUF_SIZE];
-                        translate_gui_msg(translatorState, inMsg, outMsg,
-                            sizeof(outMsg));
-                        tioSioSocketWrite(sioFd, outMsg);
-                        tioSioSocketWrite(sioFd, "\r");
-                    }
-                }
-            }
+        /* hand the lines the handlers read to the translators */
+        tioPipelineKick();
+        tioReloadCollect();
 
-            /* check for anything from sio_agent connection */
-            if ((sioFd >= 0) && FD_ISSET(sioFd, &readFdSet)) {
-                /* 
-                 * sio_agent socket port has something to send to the 
-                 * tio_agent, if connected 
-                 */
-                char inMsg[READ_BUF_SIZE];
-                int readCount = readLine2(sioFd, inMsg, sizeof(inMsg),
-                    &fromQv, "sio-agent");
-                if (readCount < 0) {
-                    /* fall out of this loop to reopen connection to sio_agent */
-                    FD_CLR(sioFd, &currFdSet);
-                    sioFd = -1;
-                    if(connectedFd >=0) {
-                        close(connectedFd);
-                    }
-                    connectedFd = -1;
-                    FD_CLR(connectedFd, &currFdSet);
-                    if(listenFd >=0) {
-                        close(listenFd);
-                    }
-                    listenFd = -1;
-                    FD_CLR(listenFd, &currFdSet);
-                    nfds = 0;
-                } else if ((readCount > 0) && (connectedFd >= 0)) {
-                    char outMsg[READ_BUF_SIZE];
-                    translate_micro_msg(translatorState, inMsg, outMsg,
-                        sizeof(outMsg));
-                    tioQvSocketWrite(connectedFd, outMsg);
-                    tioQvSocketWrite(connectedFd, "\n");
-                }
-            }
-        } /* else timeout to retry opening sio_agent socket */
+        if (agent.sioOverflowed) {
+            tioEventRemove(agent.sioFd);
+            close(agent.sioFd);
+            tioAgentDropSio(&agent);
+        }
+
+        /* write everything the handlers translated in one go per connection */
+        tioAgentFlushSio(&agent);
+        tioAgentFlushViewers(&agent);
+        tioAgentUpdateEvents(&agent);
     }
 
     LogMsg(LOG_INFO, "[TIO] cleaning up\n");
-    freeTranslations(translatorState);
-
-    if (connectedFd >= 0) {
-        close(connectedFd);
-    }
-    if (listenFd >= 0) {
-        close(listenFd);
+    tioAgentCloseViewers(&agent);
+    tioAgentCloseListener(&agent);
+    if (agent.sioFd >= 0) {
+        tioEventRemove(agent.sioFd);
+        close(agent.sioFd);
     }
-    if (sioFd >= 0) {
-        close(sioFd);
+    tioOutQueueClear(&agent.toSio);
+    tioStatsClose();
+    if (options->workers) {
+        tioPipelineClose();
     }
-    
-    if (tioPort == 0) {
+    tioReloadClose();
+    tioEventClose();
+    free(agent.viewers);
+    lineBufferFree(&agent.fromSio);
+    free(agent.outMsg);
+
+    if (options->tioPort == 0) {
         /* best effort removal of socket */
-        const int rv = unlink(tioSocketPath);
+        const int rv = unlink(options->tioSocketPath);
         if (rv == 0) {
-            LogMsg(LOG_INFO, "[TIO] socket file %s unlinked\n", tioSocketPath);
+            LogMsg(LOG_INFO, "[TIO] socket file %s unlinked\n",
+                options->tioSocketPath);
         } else {
-            LogMsg(LOG_INFO, "[TIO] socket file %s unlink failed\n", tioSocketPath);
+            LogMsg(LOG_INFO, "[TIO] socket file %s unlink failed\n",
+                options->tioSocketPath);
         }
     }
 
 }
-
@@ -8,6 +8,7 @@
 #ifndef TRANSLATE_AGENT_H_
 #define TRANSLATE_AGENT_H_
 
+#include <stdint.h>
 #include <syslog.h>
 #include <sys/stat.h>
 
@@ -22,6 +23,9 @@
 #define BACKLOG 5
 #define READ_BUF_SIZE 2048
 #define DEFAULT_REFRESH_DELAY 1
+#define DEFAULT_MAX_VIEWERS 4
+#define MAX_VIEWERS_LIMIT 1024
+#define DEFAULT_QUEUE_LIMIT 65536
 
 struct LineBuffer;
 
@@ -29,11 +33,10 @@ struct LineBuffer;
 int tioQvSocketInit(unsigned short port, int *addressFamily,
     const char *socketPath);
 int tioQvSocketAccept(int listenFd, int addressFamily);
-void tioQvSocketWrite(int socketFd, const char *buf);
+int tioSocketSetNoDelay(int fd);
 
 /* functions exported from translate_sio.c */
 int tioSioSocketInit(unsigned short port, const char *socketName);
-void tioSioSocketWrite(int sioSocketfd, const char *buf);
 
 /* functions exported from die_with_message.c */
 void dieWithSystemMessage(const char *msg);
@@ -41,7 +44,83 @@ void dieWithSystemMessage(const char *msg);
 /* functions exported from logmsg.c */
 void LogOpen(const char *ident, int logToSyslog, const char *logFilePath,
     int verboseFlag);
-void LogMsg(int level, const char *fmt, ...);
+void LogWrite(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int LogTraceOpen(const char *traceFilePath);
+void LogTraceWrite(unsigned event, unsigned source, uint32_t rule,
+    uint32_t length);
+extern int logThreshold;
+extern int traceEnabled;
+
+/*
+ * Messages less important than LOG_COMPILE_LEVEL are compiled out entirely,
+ * e.g. make LOG_LEVEL=LOG_NOTICE for a build without LOG_INFO and LOG_DEBUG
+ * messages.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * Logs a message if its syslog level is at or above the threshold set by
+ * LogOpen().  The arguments are only evaluated when the message is logged.
+ */
+#define LogMsg(level, ...) \
+    do { \
+        if (((level) <= LOG_COMPILE_LEVEL) && ((level) <= logThreshold)) { \
+            LogWrite((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+/*
+ * Binary trace of the messages going through the agent, enabled by
+ * LogTraceOpen().  A trace file is a TioTraceHeader followed by
+ * TioTraceRecords in the byte order of the agent; tio-logdump prints it.
+ */
+#define TIO_TRACE_MAGIC "TIOT"
+#define TIO_TRACE_VERSION 1
+
+/* trace events */
+#define TIO_TRACE_RECEIVED      1   /* length of the message received */
+#define TIO_TRACE_FOUND_KEY     2   /* rule matched and length of its key */
+#define TIO_TRACE_DEFAULT       3   /* default used, length of the key */
+#define TIO_TRACE_UNTRANSLATED  4   /* passed through, length of the key */
+#define TIO_TRACE_SENDING       5   /* length of the translated message */
+
+/* where the message came from */
+#define TIO_TRACE_FROM_GUI      0
+#define TIO_TRACE_FROM_MICRO    1
+
+/* rule for events without one */
+#define TIO_TRACE_NO_RULE 0xffffffffu
+
+struct TioTraceHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+};
+
+struct TioTraceRecord
+{
+    uint64_t timestamp;     /* CLOCK_REALTIME in nanoseconds */
+    uint16_t event;
+    uint16_t source;
+    uint32_t rule;          /* index of the rule in the translation file */
+    uint32_t length;
+    uint32_t reserved;
+};
+
+#ifdef TIO_NO_TRACE
+#define LogTrace(event, source, rule, length) do { } while (0)
+#else
+#define LogTrace(event, source, rule, length) \
+    do { \
+        if (traceEnabled) { \
+            LogTraceWrite((event), (source), (rule), (length)); \
+        } \
+    } while (0)
+#endif
 
 /* qml-viewer should use these same socket specifications */
 #define	TIO_DEFAULT_AGENT_PORT 7885
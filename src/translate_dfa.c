@@ -0,0 +1,798 @@
+/*
+ * translate_dfa.c
+ *
+ * Pattern rules compiled into one deterministic automaton per direction.  A
+ * rule whose key starts with ~ has a pattern instead of a key, e.g.
+ * M:~CH[0-9][0-9]:TEMP=%d,T:temp=%d.  Once a translation file has been read
+ * every pattern of a direction is parsed into a Thompson NFA, the NFAs are
+ * joined under one start state, and the subset construction turns the
+ * result into a DFA whose states know which rule they accept.  Matching a
+ * key is then one table lookup per character, without backtracking, however
+ * many patterns there are.
+ *
+ * A pattern has to match the whole key.  It is made of
+ *
+ *   c          the character c, unless it is one of those below
+ *   \c         the character c
+ *   .          any character
+ *   [...]      any of the characters listed, with ranges such as 0-9;
+ *              [^...] any character not listed
+ *   (...)      a group
+ *   x|y        x or y
+ *   x* x+ x?   zero or more, one or more, or zero or one of x
+ *
+ * When several patterns match a key, the one first in the file wins.
+ *
+ * Transitions are indexed by byte class rather than by byte: bytes which no
+ * pattern tells apart share a class, which keeps the table small.  The
+ * tables are flat arrays which can be saved in an image and used from a
+ * loaded image as they are.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "translate_parser.h"
+#include "translate_rules.h"
+#include "read_line.h"
+
+/* a direction's patterns are dropped if they need more states than this */
+#define DFA_MAX_STATES 65536
+
+/* the state no key can leave, and the state matching starts in */
+#define DFA_DEAD 0
+#define DFA_START 1
+
+typedef enum { NFA_EPSILON, NFA_SET, NFA_ACCEPT } nfa_state_type;
+
+struct ByteSet {
+    uint32_t bits[8];
+};
+
+/**
+ * A state of the NFA.  An epsilon state leads to out1 and out2 (-1 for
+ * none) without taking a character, a set state to out1 on any character in
+ * its set, and an accept state ends a rule's pattern.
+ */
+struct NfaState {
+    uint8_t type;
+    uint32_t set;
+    int32_t out1;
+    int32_t out2;
+    uint32_t rule;
+};
+
+struct Nfa {
+    struct NfaState *states;
+    unsigned count;
+    unsigned capacity;
+
+    struct ByteSet *sets;
+    unsigned setCount;
+    unsigned setCapacity;
+};
+
+/**
+ * A piece of NFA built from part of a pattern.  Its end is an epsilon state
+ * with nowhere to go yet.
+ */
+struct Fragment {
+    int32_t start;
+    int32_t end;
+};
+
+struct PatternParser {
+    struct Nfa *nfa;
+    const char *pos;
+    const char *end;
+    int error;
+};
+
+/**
+ * The subset construction's state: the DFA so far and the NFA states each of
+ * its states stands for.
+ */
+struct DfaBuilder {
+    const struct Nfa *nfa;
+    struct TranslationDfa *dfa;
+    unsigned stateCapacity;
+
+    /* the sorted NFA states of DFA state i are members[memberStart[i]...] */
+    uint32_t *members;
+    size_t memberCount;
+    size_t memberCapacity;
+    size_t *memberStart;
+    uint32_t *memberLength;
+
+    /* DFA states by their NFA states, open addressing, state + 1 or 0 */
+    uint32_t *table;
+    unsigned tableCapacity;
+
+    /* scratch space for computing closures */
+    uint32_t *mark;
+    uint32_t generation;
+    int32_t *stack;
+    uint32_t *closure;
+    unsigned closureCount;
+};
+
+static inline int byteSetHas(const struct ByteSet *set, unsigned char c)
+{
+    return (set->bits[c >> 5] >> (c & 31)) & 1;
+}
+
+static inline void byteSetAdd(struct ByteSet *set, unsigned char c)
+{
+    set->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static int32_t nfaAddState(struct Nfa *nfa, nfa_state_type type)
+{
+    if (nfa->count == nfa->capacity) {
+        const unsigned capacity = (nfa->capacity == 0) ? 256 :
+            nfa->capacity * 2;
+        struct NfaState *states = realloc(nfa->states,
+            capacity * sizeof(struct NfaState));
+        if (states == 0) {
+            dieWithSystemMessage("realloc() of pattern NFA failed");
+        }
+        nfa->states = states;
+        nfa->capacity = capacity;
+    }
+
+    struct NfaState *state = &nfa->states[nfa->count];
+    state->type = type;
+    state->set = 0;
+    state->out1 = -1;
+    state->out2 = -1;
+    state->rule = 0;
+    return nfa->count++;
+}
+
+/**
+ * Makes a fragment taking one character from a set.
+ */
+static struct Fragment nfaAddSet(struct Nfa *nfa, const struct ByteSet *set)
+{
+    if (nfa->setCount == nfa->setCapacity) {
+        const unsigned capacity = (nfa->setCapacity == 0) ? 64 :
+            nfa->setCapacity * 2;
+        struct ByteSet *sets = realloc(nfa->sets,
+            capacity * sizeof(struct ByteSet));
+        if (sets == 0) {
+            dieWithSystemMessage("realloc() of pattern NFA failed");
+        }
+        nfa->sets = sets;
+        nfa->setCapacity = capacity;
+    }
+    nfa->sets[nfa->setCount] = *set;
+
+    struct Fragment fragment;
+    fragment.start = nfaAddState(nfa, NFA_SET);
+    fragment.end = nfaAddState(nfa, NFA_EPSILON);
+    nfa->states[fragment.start].set = nfa->setCount++;
+    nfa->states[fragment.start].out1 = fragment.end;
+    return fragment;
+}
+
+static struct Fragment parseAlternation(struct PatternParser *p);
+
+/**
+ * Reads one character of a pattern, or of a class, taking a \ as making the
+ * next one literal.
+ */
+static unsigned char parseChar(struct PatternParser *p)
+{
+    if ((*p->pos == '\\') && ((p->pos + 1) < p->end)) {
+        p->pos++;
+    } else if (*p->pos == '\\') {
+        p->error = 1;
+    }
+    return *p->pos++;
+}
+
+/**
+ * Parses the rest of a [...] class, after the [.
+ */
+static struct Fragment parseClass(struct PatternParser *p)
+{
+    struct ByteSet set;
+    memset(&set, 0, sizeof(set));
+
+    int negate = 0;
+    if ((p->pos < p->end) && (*p->pos == '^')) {
+        negate = 1;
+        p->pos++;
+    }
+
+    /* a ] first in the class is one of its characters */
+    int first = 1;
+    while ((p->pos < p->end) && ((*p->pos != ']') || first)) {
+        first = 0;
+        const unsigned char lo = parseChar(p);
+        unsigned char hi = lo;
+        if (((p->pos + 1) < p->end) && (*p->pos == '-') &&
+            (p->pos[1] != ']')) {
+            p->pos++;
+            hi = parseChar(p);
+        }
+        if (hi < lo) {
+            p->error = 1;
+        }
+
+        unsigned c;
+        for (c = lo; c <= hi; c++) {
+            byteSetAdd(&set, c);
+        }
+    }
+    if (p->pos == p->end) {
+        /* no ] */
+        p->error = 1;
+    } else {
+        p->pos++;
+    }
+
+    if (negate) {
+        unsigned i;
+        for (i = 0; i < 8; i++) {
+            set.bits[i] = ~set.bits[i];
+        }
+    }
+    return nfaAddSet(p->nfa, &set);
+}
+
+static struct Fragment parseAtom(struct PatternParser *p)
+{
+    struct ByteSet set;
+    memset(&set, 0, sizeof(set));
+
+    switch (*p->pos) {
+    case '(': {
+        p->pos++;
+        const struct Fragment group = parseAlternation(p);
+        if ((p->pos == p->end) || (*p->pos != ')')) {
+            p->error = 1;
+        } else {
+            p->pos++;
+        }
+        return group;
+    }
+
+    case '[':
+        p->pos++;
+        return parseClass(p);
+
+    case '.':
+        p->pos++;
+        memset(&set, 0xff, sizeof(set));
+        return nfaAddSet(p->nfa, &set);
+
+    case '*':
+    case '+':
+    case '?':
+        /* nothing to repeat */
+        p->error = 1;
+        p->pos++;
+        return nfaAddSet(p->nfa, &set);
+
+    default:
+        byteSetAdd(&set, parseChar(p));
+        return nfaAddSet(p->nfa, &set);
+    }
+}
+
+static struct Fragment parseRepeat(struct PatternParser *p)
+{
+    struct Fragment atom = parseAtom(p);
+    while (!p->error && (p->pos < p->end) &&
+        ((*p->pos == '*') || (*p->pos == '+') || (*p->pos == '?'))) {
+        const char op = *p->pos++;
+        struct Nfa *nfa = p->nfa;
+        const int32_t start = nfaAddState(nfa, NFA_EPSILON);
+        const int32_t end = nfaAddState(nfa, NFA_EPSILON);
+
+        nfa->states[start].out1 = atom.start;
+        switch (op) {
+        case '*':
+            nfa->states[start].out2 = end;
+            nfa->states[atom.end].out1 = atom.start;
+            nfa->states[atom.end].out2 = end;
+            break;
+
+        case '+':
+            nfa->states[atom.end].out1 = atom.start;
+            nfa->states[atom.end].out2 = end;
+            break;
+
+        case '?':
+        default:
+            nfa->states[start].out2 = end;
+            nfa->states[atom.end].out1 = end;
+            break;
+        }
+        atom.start = start;
+        atom.end = end;
+    }
+    return atom;
+}
+
+static struct Fragment parseConcatenation(struct PatternParser *p)
+{
+    struct Fragment whole;
+    whole.start = whole.end = nfaAddState(p->nfa, NFA_EPSILON);
+    while (!p->error && (p->pos < p->end) && (*p->pos != '|') &&
+        (*p->pos != ')')) {
+        const struct Fragment next = parseRepeat(p);
+        p->nfa->states[whole.end].out1 = next.start;
+        whole.end = next.end;
+    }
+    return whole;
+}
+
+static struct Fragment parseAlternation(struct PatternParser *p)
+{
+    struct Fragment left = parseConcatenation(p);
+    while (!p->error && (p->pos < p->end) && (*p->pos == '|')) {
+        p->pos++;
+        const struct Fragment right = parseConcatenation(p);
+        struct Nfa *nfa = p->nfa;
+        const int32_t start = nfaAddState(nfa, NFA_EPSILON);
+        const int32_t end = nfaAddState(nfa, NFA_EPSILON);
+        nfa->states[start].out1 = left.start;
+        nfa->states[start].out2 = right.start;
+        nfa->states[left.end].out1 = end;
+        nfa->states[right.end].out1 = end;
+        left.start = start;
+        left.end = end;
+    }
+    return left;
+}
+
+/**
+ * Adds a rule's pattern to the NFA.
+ *
+ * @return int32_t the state the pattern starts at, -1 if it is malformed
+ */
+static int32_t nfaAddPattern(struct Nfa *nfa, const char *pattern,
+    size_t length, uint32_t rule)
+{
+    struct PatternParser p;
+    p.nfa = nfa;
+    p.pos = pattern;
+    p.end = pattern + length;
+    p.error = 0;
+
+    const struct Fragment fragment = parseAlternation(&p);
+    if (p.error || (p.pos != p.end)) {
+        return -1;
+    }
+
+    const int32_t accept = nfaAddState(nfa, NFA_ACCEPT);
+    nfa->states[accept].rule = rule;
+    nfa->states[fragment.end].out1 = accept;
+    return fragment.start;
+}
+
+/**
+ * Splits the bytes into classes which no set of the NFA tells apart.
+ *
+ * @return unsigned the number of classes
+ */
+static unsigned computeClasses(const struct Nfa *nfa, uint8_t *classes)
+{
+    memset(classes, 0, 256);
+    unsigned classCount = 1;
+
+    unsigned i;
+    for (i = 0; i < nfa->setCount; i++) {
+        /* each class splits into the bytes in the set and those not */
+        int16_t split[256][2];
+        memset(split, 0xff, sizeof(split));
+        unsigned newCount = 0;
+        unsigned c;
+        for (c = 0; c < 256; c++) {
+            const int in = byteSetHas(&nfa->sets[i], c);
+            if (split[classes[c]][in] < 0) {
+                split[classes[c]][in] = newCount++;
+            }
+            classes[c] = split[classes[c]][in];
+        }
+        classCount = newCount;
+    }
+    return classCount;
+}
+
+static uint32_t hashMembers(const uint32_t *members, unsigned count)
+{
+    uint32_t hash = 2166136261u;
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        hash ^= members[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int compareMembers(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/**
+ * Follows the epsilon transitions from the seeds on the builder's stack,
+ * leaving the set and accept states reached, sorted, in the closure.
+ */
+static void computeClosure(struct DfaBuilder *b, unsigned seedCount)
+{
+    const struct NfaState *states = b->nfa->states;
+    unsigned depth = seedCount;
+    b->generation++;
+    b->closureCount = 0;
+
+    while (depth > 0) {
+        const int32_t s = b->stack[--depth];
+        if (b->mark[s] == b->generation) {
+            continue;
+        }
+        b->mark[s] = b->generation;
+
+        if (states[s].type == NFA_EPSILON) {
+            if (states[s].out1 >= 0) {
+                b->stack[depth++] = states[s].out1;
+            }
+            if (states[s].out2 >= 0) {
+                b->stack[depth++] = states[s].out2;
+            }
+        } else {
+            b->closure[b->closureCount++] = s;
+        }
+    }
+    qsort(b->closure, b->closureCount, sizeof(uint32_t), compareMembers);
+}
+
+/**
+ * Returns the DFA state for the NFA states in the closure, adding it if it
+ * is new.
+ *
+ * @return uint32_t the state, or DFA_DEAD if there are too many states
+ */
+static uint32_t findState(struct DfaBuilder *b)
+{
+    struct TranslationDfa *dfa = b->dfa;
+    const uint32_t hash = hashMembers(b->closure, b->closureCount);
+    const unsigned mask = b->tableCapacity - 1;
+    unsigned i = hash & mask;
+    while (b->table[i] != 0) {
+        const uint32_t state = b->table[i] - 1;
+        if ((b->memberLength[state] == b->closureCount) &&
+            (memcmp(b->members + b->memberStart[state], b->closure,
+                b->closureCount * sizeof(uint32_t)) == 0)) {
+            return state;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (dfa->stateCount == DFA_MAX_STATES) {
+        return DFA_DEAD;
+    }
+    if (dfa->stateCount == b->stateCapacity) {
+        const unsigned capacity = b->stateCapacity * 2;
+        uint32_t *transitions = realloc(dfa->transitions,
+            (size_t)capacity * dfa->classCount * sizeof(uint32_t));
+        if (transitions != 0) {
+            dfa->transitions = transitions;
+        }
+        uint32_t *accept = realloc(dfa->accept, capacity * sizeof(uint32_t));
+        if (accept != 0) {
+            dfa->accept = accept;
+        }
+        size_t *memberStart = realloc(b->memberStart,
+            capacity * sizeof(size_t));
+        if (memberStart != 0) {
+            b->memberStart = memberStart;
+        }
+        uint32_t *memberLength = realloc(b->memberLength,
+            capacity * sizeof(uint32_t));
+        if (memberLength != 0) {
+            b->memberLength = memberLength;
+        }
+        if ((transitions == 0) || (accept == 0) || (memberStart == 0) ||
+            (memberLength == 0)) {
+            dieWithSystemMessage("realloc() of pattern DFA failed");
+        }
+        b->stateCapacity = capacity;
+    }
+    if ((b->memberCount + b->closureCount) > b->memberCapacity) {
+        size_t capacity = b->memberCapacity * 2;
+        while (capacity < (b->memberCount + b->closureCount)) {
+            capacity *= 2;
+        }
+        uint32_t *members = realloc(b->members, capacity * sizeof(uint32_t));
+        if (members == 0) {
+            dieWithSystemMessage("realloc() of pattern DFA failed");
+        }
+        b->members = members;
+        b->memberCapacity = capacity;
+    }
+
+    const uint32_t state = dfa->stateCount++;
+    b->memberStart[state] = b->memberCount;
+    b->memberLength[state] = b->closureCount;
+    memcpy(b->members + b->memberCount, b->closure,
+        b->closureCount * sizeof(uint32_t));
+    b->memberCount += b->closureCount;
+    b->table[i] = state + 1;
+
+    /* the rule first in the file wins */
+    uint32_t accept = 0;
+    unsigned j;
+    for (j = 0; j < b->closureCount; j++) {
+        const struct NfaState *s = &b->nfa->states[b->closure[j]];
+        if ((s->type == NFA_ACCEPT) &&
+            ((accept == 0) || (s->rule < (accept - 1)))) {
+            accept = s->rule + 1;
+        }
+    }
+    dfa->accept[state] = accept;
+
+    /* keep the table at most half full */
+    if ((dfa->stateCount * 2) > b->tableCapacity) {
+        const unsigned capacity = b->tableCapacity * 2;
+        uint32_t *table = calloc(capacity, sizeof(uint32_t));
+        if (table == 0) {
+            dieWithSystemMessage("calloc() of pattern DFA failed");
+        }
+        uint32_t k;
+        for (k = 0; k < dfa->stateCount; k++) {
+            unsigned slot = hashMembers(b->members + b->memberStart[k],
+                b->memberLength[k]) & (capacity - 1);
+            while (table[slot] != 0) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            table[slot] = k + 1;
+        }
+        free(b->table);
+        b->table = table;
+        b->tableCapacity = capacity;
+    }
+    return state;
+}
+
+/**
+ * Runs the subset construction from the NFA's start state.
+ *
+ * @return int 0 on success, -1 if the DFA needs too many states
+ */
+static int buildDfa(struct DfaBuilder *b, int32_t start)
+{
+    struct TranslationDfa *dfa = b->dfa;
+
+    /* a representative byte of each class */
+    uint8_t representative[256];
+    unsigned c;
+    for (c = 256; c-- > 0; ) {
+        representative[dfa->classes[c]] = c;
+    }
+
+    /* the dead state has no NFA states */
+    b->closureCount = 0;
+    findState(b);
+    b->stack[0] = start;
+    computeClosure(b, 1);
+    findState(b);
+
+    /* nothing leaves the dead state */
+    for (c = 0; c < dfa->classCount; c++) {
+        dfa->transitions[c] = DFA_DEAD;
+    }
+
+    uint32_t state;
+    for (state = DFA_START; state < dfa->stateCount; state++) {
+        for (c = 0; c < dfa->classCount; c++) {
+            /* where the set states take the class */
+            unsigned seedCount = 0;
+            uint32_t i;
+            for (i = 0; i < b->memberLength[state]; i++) {
+                const struct NfaState *s =
+                    &b->nfa->states[b->members[b->memberStart[state] + i]];
+                if ((s->type == NFA_SET) &&
+                    byteSetHas(&b->nfa->sets[s->set], representative[c])) {
+                    b->stack[seedCount++] = s->out1;
+                }
+            }
+
+            uint32_t next = DFA_DEAD;
+            if (seedCount > 0) {
+                computeClosure(b, seedCount);
+                next = findState(b);
+                if ((next == DFA_DEAD) && (b->closureCount > 0)) {
+                    return -1;
+                }
+            }
+            dfa->transitions[(size_t)state * dfa->classCount + c] = next;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Adds a pattern rule to the rules a DFA will be built from.
+ *
+ * @param dfa the direction's DFA
+ * @param rule the position of the translation in the pool
+ */
+void dfaAddRule(struct TranslationDfa *dfa, uint32_t rule)
+{
+    if (dfa->pendingCount == dfa->pendingCapacity) {
+        const unsigned capacity = (dfa->pendingCapacity == 0) ? 64 :
+            dfa->pendingCapacity * 2;
+        uint32_t *pending = realloc(dfa->pending,
+            capacity * sizeof(uint32_t));
+        if (pending == 0) {
+            dieWithSystemMessage("realloc() of pattern rules failed");
+        }
+        dfa->pending = pending;
+        dfa->pendingCapacity = capacity;
+    }
+    dfa->pending[dfa->pendingCount++] = rule;
+}
+
+/**
+ * Compiles the pattern rules added to a DFA.  Malformed patterns are
+ * reported and left out.  If the patterns together need more than
+ * DFA_MAX_STATES states none of them are used.
+ *
+ * @param state the translations the rules belong to, all loaded
+ * @param dfa the direction's DFA
+ * @param mapName the name of the direction, for messages
+ */
+void dfaBuild(const TranslatorState *state, struct TranslationDfa *dfa,
+    const char *mapName)
+{
+    if (dfa->pendingCount == 0) {
+        return;
+    }
+
+    /* one NFA for all the patterns, each under its own split state */
+    struct Nfa nfa;
+    memset(&nfa, 0, sizeof(nfa));
+    int32_t start = -1;
+    unsigned i;
+    for (i = 0; i < dfa->pendingCount; i++) {
+        const struct translate_msg *translation = getTranslation(state,
+            dfa->pending[i]);
+        const char *key = arenaString(&state->strings, translation->key);
+        const int32_t patternStart = nfaAddPattern(&nfa, key + 1,
+            arenaLength(&state->strings, translation->key) - 1,
+            dfa->pending[i]);
+        if (patternStart < 0) {
+            LogMsg(LOG_ERR, "[TIO] bad pattern \"%s\" on line %d in %s map\n",
+                key, translation->lineNumber, mapName);
+            continue;
+        }
+
+        const int32_t split = nfaAddState(&nfa, NFA_EPSILON);
+        nfa.states[split].out1 = patternStart;
+        nfa.states[split].out2 = start;
+        start = split;
+    }
+    dfa->pendingCount = 0;
+    if (start < 0) {
+        free(nfa.states);
+        free(nfa.sets);
+        return;
+    }
+
+    struct DfaBuilder b;
+    memset(&b, 0, sizeof(b));
+    b.nfa = &nfa;
+    b.dfa = dfa;
+    b.stateCapacity = 64;
+    b.memberCapacity = 1024;
+    b.tableCapacity = 128;
+    b.members = malloc(b.memberCapacity * sizeof(uint32_t));
+    b.memberStart = malloc(b.stateCapacity * sizeof(size_t));
+    b.memberLength = malloc(b.stateCapacity * sizeof(uint32_t));
+    b.table = calloc(b.tableCapacity, sizeof(uint32_t));
+    b.mark = calloc(nfa.count, sizeof(uint32_t));
+    b.stack = malloc(nfa.count * 2 * sizeof(int32_t));
+    b.closure = malloc(nfa.count * sizeof(uint32_t));
+
+    if (dfa->classes == 0) {
+        dfa->classes = malloc(256);
+    }
+    if (dfa->classes != 0) {
+        dfa->classCount = computeClasses(&nfa, dfa->classes);
+    }
+    uint32_t *transitions = realloc(dfa->transitions,
+        (size_t)b.stateCapacity * dfa->classCount * sizeof(uint32_t));
+    if (transitions != 0) {
+        dfa->transitions = transitions;
+    }
+    uint32_t *accept = realloc(dfa->accept,
+        b.stateCapacity * sizeof(uint32_t));
+    if (accept != 0) {
+        dfa->accept = accept;
+    }
+    if ((b.members == 0) || (b.memberStart == 0) || (b.memberLength == 0) ||
+        (b.table == 0) || (b.mark == 0) || (b.stack == 0) ||
+        (b.closure == 0) || (dfa->classes == 0) || (transitions == 0) ||
+        (accept == 0)) {
+        dieWithSystemMessage("malloc() of pattern DFA failed");
+    }
+
+    dfa->stateCount = 0;
+    if (buildDfa(&b, start) != 0) {
+        LogMsg(LOG_ERR, "[TIO] patterns in %s map need more than %d states, "
+            "not using them\n", mapName, DFA_MAX_STATES);
+        dfa->stateCount = 0;
+    } else {
+        LogMsg(LOG_INFO, "[TIO] compiled %s map patterns into %u states of "
+            "%u classes\n", mapName, dfa->stateCount, dfa->classCount);
+    }
+
+    free(b.members);
+    free(b.memberStart);
+    free(b.memberLength);
+    free(b.table);
+    free(b.mark);
+    free(b.stack);
+    free(b.closure);
+    free(nfa.states);
+    free(nfa.sets);
+}
+
+/**
+ * Finds the pattern rule matching a key.
+ *
+ * @param dfa the direction's DFA
+ * @param key the key to match, not necessarily nul terminated
+ * @param length the number of characters in the key
+ *
+ * @return uint32_t one more than the index of the translation in the pool, or
+ *         0 if no pattern matches
+ */
+uint32_t dfaLookup(const struct TranslationDfa *dfa, const char *key,
+    size_t length)
+{
+    if (dfa->stateCount == 0) {
+        return 0;
+    }
+
+    const uint32_t *const transitions = dfa->transitions;
+    const uint8_t *const classes = dfa->classes;
+    const unsigned classCount = dfa->classCount;
+    uint32_t state = DFA_START;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        state = transitions[(size_t)state * classCount +
+            classes[(unsigned char)key[i]]];
+        if (state == DFA_DEAD) {
+            return 0;
+        }
+    }
+    return dfa->accept[state];
+}
+
+/**
+ * Removes every rule from a DFA, keeping its arrays for reuse.
+ */
+void dfaClear(struct TranslationDfa *dfa)
+{
+    dfa->stateCount = 0;
+    dfa->pendingCount = 0;
+}
+
+/**
+ * Releases a DFA's arrays.  Not for a DFA in a loaded image.
+ */
+void dfaFree(struct TranslationDfa *dfa)
+{
+    free(dfa->classes);
+    free(dfa->transitions);
+    free(dfa->accept);
+    free(dfa->pending);
+    memset(dfa, 0, sizeof(struct TranslationDfa));
+}
@@ -0,0 +1,354 @@
+/*
+ * translate_event.c
+ *
+ * epoll(7) based event engine.  Each registered descriptor has a slot, indexed
+ * by the descriptor number, which holds its handler.  The epoll data word
+ * carries the descriptor and the slot's generation so that events still
+ * queued for a descriptor that was removed (and possibly reused) by an
+ * earlier handler in the same batch are dropped.
+ *
+ * Once tioEventInitUring() has succeeded every call is passed on to the
+ * io_uring backend in translate_uring.c instead.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "translate_event.h"
+#include "translate_uring.h"
+
+#define MAX_EVENTS_PER_WAIT 32
+
+struct TioEventSlot
+{
+    TioEventHandler handler;
+    void *context;
+    unsigned events;
+    uint32_t generation;
+};
+
+static int epollFd = -1;
+static int uring;
+static struct TioEventSlot *slots;
+static int slotCount;
+
+static uint32_t toEpollEvents(unsigned events)
+{
+    uint32_t epollEvents = 0;
+    if (events & TIO_EVENT_READ) {
+        epollEvents |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & TIO_EVENT_WRITE) {
+        epollEvents |= EPOLLOUT;
+    }
+    if (events & TIO_EVENT_EDGE) {
+        epollEvents |= EPOLLET;
+    }
+    return epollEvents;
+}
+
+static unsigned fromEpollEvents(uint32_t epollEvents)
+{
+    unsigned events = 0;
+    if (epollEvents & (EPOLLIN | EPOLLRDHUP)) {
+        events |= TIO_EVENT_READ;
+    }
+    if (epollEvents & EPOLLOUT) {
+        events |= TIO_EVENT_WRITE;
+    }
+    if (epollEvents & (EPOLLERR | EPOLLHUP)) {
+        /* let the handler see the error through its next read */
+        events |= TIO_EVENT_ERROR | TIO_EVENT_READ;
+    }
+    return events;
+}
+
+static struct TioEventSlot *getSlot(int fd)
+{
+    if (fd >= slotCount) {
+        int newCount = (slotCount == 0) ? 64 : slotCount;
+        while (newCount <= fd) {
+            newCount *= 2;
+        }
+        struct TioEventSlot *newSlots = realloc(slots,
+            newCount * sizeof(struct TioEventSlot));
+        if (newSlots == 0) {
+            return 0;
+        }
+        memset(newSlots + slotCount, 0,
+            (newCount - slotCount) * sizeof(struct TioEventSlot));
+        slots = newSlots;
+        slotCount = newCount;
+    }
+    return &slots[fd];
+}
+
+/**
+ * Creates the event engine.  Must be called before any other tioEvent
+ * function.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioEventInit(void)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return (epollFd < 0) ? -1 : 0;
+}
+
+/**
+ * Creates the event engine on io_uring.  Use instead of tioEventInit(), and
+ * fall back to that if this fails because the kernel can't do everything
+ * the backend needs.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioEventInitUring(void)
+{
+    if (tioUringInit() != 0) {
+        return -1;
+    }
+    uring = 1;
+    return 0;
+}
+
+/**
+ * Releases the event engine.  Registered descriptors are not closed.
+ */
+void tioEventClose(void)
+{
+    if (uring) {
+        tioUringClose();
+        uring = 0;
+        return;
+    }
+
+    if (epollFd >= 0) {
+        close(epollFd);
+        epollFd = -1;
+    }
+    free(slots);
+    slots = 0;
+    slotCount = 0;
+}
+
+/**
+ * Starts watching a descriptor.
+ *
+ * @param fd the descriptor to watch
+ * @param events TIO_EVENT_READ and/or TIO_EVENT_WRITE, optionally with
+ *               TIO_EVENT_EDGE
+ * @param handler the function called when the descriptor is ready
+ * @param context passed unchanged to the handler
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioEventAdd(int fd, unsigned events, TioEventHandler handler,
+    void *context)
+{
+    if (uring) {
+        return tioUringAdd(fd, events, handler, 0, context);
+    }
+
+    struct TioEventSlot *slot = getSlot(fd);
+    if (slot == 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    slot->generation++;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = toEpollEvents(events);
+    ev.data.u64 = ((uint64_t)slot->generation << 32) | (uint32_t)fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return -1;
+    }
+
+    slot->handler = handler;
+    slot->context = context;
+    slot->events = events;
+    return 0;
+}
+
+/**
+ * Changes the set of events watched on an already registered descriptor.
+ *
+ * @param fd the registered descriptor
+ * @param events the new TIO_EVENT_* flags
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioEventModify(int fd, unsigned events)
+{
+    if (uring) {
+        return tioUringModify(fd, events);
+    }
+
+    if ((fd < 0) || (fd >= slotCount) || (slots[fd].handler == 0)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    struct TioEventSlot *slot = &slots[fd];
+    if (slot->events == events) {
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = toEpollEvents(events);
+    ev.data.u64 = ((uint64_t)slot->generation << 32) | (uint32_t)fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+        return -1;
+    }
+    slot->events = events;
+    return 0;
+}
+
+/**
+ * Stops watching a descriptor.  Any events already collected for it are
+ * discarded.  Call it before closing the descriptor; calling it afterwards
+ * only releases the slot since the kernel drops closed descriptors itself.
+ *
+ * @param fd the descriptor to stop watching
+ */
+void tioEventRemove(int fd)
+{
+    if (uring) {
+        tioUringRemove(fd);
+        return;
+    }
+
+    if ((fd < 0) || (fd >= slotCount) || (slots[fd].handler == 0)) {
+        return;
+    }
+
+    /* failure here only means the fd was already closed */
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, 0);
+    slots[fd].handler = 0;
+    slots[fd].context = 0;
+    slots[fd].events = 0;
+    slots[fd].generation++;
+}
+
+/**
+ * Waits for registered descriptors to become ready and calls their handlers.
+ *
+ * @param timeoutMs maximum time to wait in milliseconds, -1 waits forever
+ *
+ * @return int the number of handlers called, 0 on timeout or -1 on failure
+ *         with errno set (EINTR when interrupted by a signal)
+ */
+int tioEventWait(int timeoutMs)
+{
+    if (uring) {
+        return tioUringWait(timeoutMs);
+    }
+
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+    const int count = epoll_wait(epollFd, events, MAX_EVENTS_PER_WAIT,
+        timeoutMs);
+    if (count <= 0) {
+        return count;
+    }
+
+    int dispatched = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        const int fd = (int)(uint32_t)events[i].data.u64;
+        const uint32_t generation = (uint32_t)(events[i].data.u64 >> 32);
+        if ((fd >= slotCount) || (slots[fd].handler == 0) ||
+            (slots[fd].generation != generation)) {
+            /* removed by an earlier handler in this batch */
+            continue;
+        }
+        slots[fd].handler(fd, fromEpollEvents(events[i].events),
+            slots[fd].context);
+        dispatched++;
+    }
+
+    return dispatched;
+}
+
+/**
+ * Starts watching a stream socket whose data the engine receives itself,
+ * which only the io_uring backend does.  TIO_EVENT_READ in events has the
+ * data passed to onData instead of calling handler; handler is called with
+ * TIO_EVENT_WRITE after each tioEventSend() on the socket finishes while
+ * TIO_EVENT_WRITE is set.
+ *
+ * @param fd the socket to watch
+ * @param events TIO_EVENT_READ and/or TIO_EVENT_WRITE
+ * @param handler the function called when the socket is writable
+ * @param onData the function called with the data received
+ * @param context passed unchanged to the handlers
+ *
+ * @return int 0 on success, -1 on failure with errno set (EOPNOTSUPP with
+ *             epoll)
+ */
+int tioEventAddRecv(int fd, unsigned events, TioEventHandler handler,
+    TioRecvHandler onData, void *context)
+{
+    if (uring) {
+        return tioUringAdd(fd, events, handler, onData, context);
+    }
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+/**
+ * Tells whether tioEventSend() can be used on a descriptor.
+ *
+ * @return int non-zero if the descriptor was registered with
+ *             tioEventAddRecv()
+ */
+int tioEventCanSend(int fd)
+{
+    return uring && tioUringCanSend(fd);
+}
+
+/**
+ * Starts sending data on a socket registered with tioEventAddRecv().  The
+ * data is copied, so it may change once this returns; the send itself is
+ * made together with the next wait for events.  Only one send per socket
+ * should be in progress at a time.
+ *
+ * @param fd the socket to write to
+ * @param iov the data to send
+ * @param iovCount the number of entries in iov
+ * @param onSent called when the send has finished, unless the socket is
+ *               removed first
+ * @param context passed unchanged to onSent
+ *
+ * @return int 0 if started, -1 on failure with errno set
+ */
+int tioEventSend(int fd, const struct iovec *iov, unsigned iovCount,
+    TioSendHandler onSent, void *context)
+{
+    if (uring) {
+        return tioUringSend(fd, iov, iovCount, onSent, context);
+    }
+    errno = EOPNOTSUPP;
+    return -1;
+}
+
+/**
+ * Puts a descriptor into non-blocking mode.
+ *
+ * @param fd the descriptor to change
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioSetNonBlocking(int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
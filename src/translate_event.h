@@ -0,0 +1,72 @@
+/*
+ * translate_event.h
+ *
+ * Event engine used by the agent's main loop.  File descriptors are
+ * registered together with a handler which is called whenever the descriptor
+ * becomes ready.
+ *
+ * The engine is based on epoll(7), or on io_uring(7) if tioEventInitUring()
+ * succeeds.  With io_uring, stream sockets can be registered with
+ * tioEventAddRecv() to have the engine receive for them, and can send
+ * through tioEventSend(); both are batched into the one system call that
+ * waits for events.
+ */
+
+#ifndef TRANSLATE_EVENT_H_
+#define TRANSLATE_EVENT_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* event flags used both for registration and for reporting readiness */
+#define TIO_EVENT_READ  0x01
+#define TIO_EVENT_WRITE 0x02
+#define TIO_EVENT_EDGE  0x04    /* edge triggered, the handler must drain */
+#define TIO_EVENT_ERROR 0x08    /* reported only: hangup or error on the fd */
+
+/**
+ * Called when a registered descriptor is ready.
+ *
+ * @param fd the descriptor which is ready
+ * @param events the TIO_EVENT_* flags describing the readiness
+ * @param context the pointer supplied when the descriptor was registered
+ */
+typedef void (*TioEventHandler)(int fd, unsigned events, void *context);
+
+/**
+ * Called with data the engine received on a descriptor registered with
+ * tioEventAddRecv().
+ *
+ * @param fd the descriptor the data came from
+ * @param data the data, which the handler may modify but not keep
+ * @param length the number of bytes at data, 0 at end of file or -errno
+ * @param context the pointer supplied when the descriptor was registered
+ */
+typedef void (*TioRecvHandler)(int fd, char *data, ssize_t length,
+    void *context);
+
+/**
+ * Called when a send started by tioEventSend() has finished.
+ *
+ * @param fd the descriptor written to
+ * @param result the number of bytes sent or -errno
+ * @param context the pointer supplied to tioEventSend()
+ */
+typedef void (*TioSendHandler)(int fd, ssize_t result, void *context);
+
+int tioEventInit(void);
+int tioEventInitUring(void);
+void tioEventClose(void);
+int tioEventAdd(int fd, unsigned events, TioEventHandler handler,
+    void *context);
+int tioEventAddRecv(int fd, unsigned events, TioEventHandler handler,
+    TioRecvHandler onData, void *context);
+int tioEventModify(int fd, unsigned events);
+void tioEventRemove(int fd);
+int tioEventWait(int timeoutMs);
+int tioEventCanSend(int fd);
+int tioEventSend(int fd, const struct iovec *iov, unsigned iovCount,
+    TioSendHandler onSent, void *context);
+int tioSetNonBlocking(int fd);
+
+#endif /* TRANSLATE_EVENT_H_ */
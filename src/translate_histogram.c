@@ -0,0 +1,47 @@
+/*
+ * translate_histogram.c
+ *
+ * Reading values back out of a TioHistogram.
+ */
+
+#include "translate_histogram.h"
+
+/**
+ * Returns the value below which a given share of the recorded values fall,
+ * accurate to the histogram's resolution.
+ *
+ * @param histogram the histogram
+ * @param perMillion the share, e.g. 990000 for the 99th percentile
+ *
+ * @return uint64_t the largest value the percentile's bucket holds, at most
+ *         the largest value recorded; 0 if the histogram is empty
+ */
+uint64_t tioHistogramPercentile(const struct TioHistogram *histogram,
+    unsigned perMillion)
+{
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    /* the rank of the value wanted, rounded up */
+    const uint64_t rank = (histogram->count * perMillion + 999999) / 1000000;
+    uint64_t seen = 0;
+    unsigned bucket;
+    for (bucket = 0; bucket < TIO_HISTOGRAM_BUCKETS; bucket++) {
+        seen += histogram->buckets[bucket];
+        if ((seen >= rank) && (seen > 0)) {
+            break;
+        }
+    }
+
+    uint64_t upper;
+    if (bucket < TIO_HISTOGRAM_SUB_COUNT) {
+        upper = bucket;
+    } else {
+        const unsigned shift = (bucket >> TIO_HISTOGRAM_SUB_BITS) - 1;
+        const uint64_t sub = TIO_HISTOGRAM_SUB_COUNT +
+            (bucket & (TIO_HISTOGRAM_SUB_COUNT - 1));
+        upper = ((sub + 1) << shift) - 1;
+    }
+    return (upper < histogram->max) ? upper : histogram->max;
+}
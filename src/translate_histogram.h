@@ -0,0 +1,53 @@
+/*
+ * translate_histogram.h
+ *
+ * Latency histograms for the agent's statistics and for tio-bench.
+ */
+
+#ifndef TRANSLATE_HISTOGRAM_H_
+#define TRANSLATE_HISTOGRAM_H_
+
+#include <stdint.h>
+
+/*
+ * A log-linear histogram: values below 2^TIO_HISTOGRAM_SUB_BITS each have a
+ * bucket, and every power of two above that is split into
+ * 2^TIO_HISTOGRAM_SUB_BITS equal buckets, so a value is recorded to within
+ * about 6% whatever its size.  Recording is a few instructions and needs no
+ * allocation.
+ */
+#define TIO_HISTOGRAM_SUB_BITS 4
+#define TIO_HISTOGRAM_SUB_COUNT (1u << TIO_HISTOGRAM_SUB_BITS)
+#define TIO_HISTOGRAM_BUCKETS \
+    ((64 - TIO_HISTOGRAM_SUB_BITS + 1) * TIO_HISTOGRAM_SUB_COUNT)
+
+struct TioHistogram
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[TIO_HISTOGRAM_BUCKETS];
+};
+
+static inline void tioHistogramRecord(struct TioHistogram *histogram,
+    uint64_t value)
+{
+    unsigned bucket;
+    if (value < TIO_HISTOGRAM_SUB_COUNT) {
+        bucket = value;
+    } else {
+        const unsigned exponent = 63 - __builtin_clzll(value);
+        const unsigned shift = exponent - TIO_HISTOGRAM_SUB_BITS;
+        bucket = ((shift + 1) << TIO_HISTOGRAM_SUB_BITS) +
+            ((value >> shift) & (TIO_HISTOGRAM_SUB_COUNT - 1));
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+uint64_t tioHistogramPercentile(const struct TioHistogram *histogram,
+    unsigned perMillion);
+
+#endif /* TRANSLATE_HISTOGRAM_H_ */
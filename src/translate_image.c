@@ -0,0 +1,737 @@
+/*
+ * translate_image.c
+ *
+ * Compiled translation images.  tio-compile parses a translation file and
+ * saves the resulting string arena, translation records, output templates,
+ * both hash indexes, both wildcard tries and both pattern DFAs into one file
+ * with saveTranslations().  loadTranslations() recognizes such a file by its
+ * magic number and reads it in one go instead of parsing it, so loading
+ * takes the same time whatever the number of translations.  The image is
+ * read into private memory rather than mapped: a file mapping would fault
+ * with SIGBUS if the file were truncated or rewritten in place while the
+ * agent is using it.
+ *
+ * Images are not portable: they are only accepted by a build with the same
+ * byte order and record layout as the tio-compile which wrote them.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "translate_parser.h"
+#include "translate_rules.h"
+#include "read_line.h"
+
+#define TRANSLATION_IMAGE_MAGIC "TIOB"
+#define TRANSLATION_IMAGE_VERSION 5
+#define TRANSLATION_IMAGE_BYTE_ORDER 0x0102
+
+/* every section starts on a multiple of this */
+#define TRANSLATION_IMAGE_ALIGN 8
+
+/**
+ * The start of an image file.  All offsets are from the start of the file.
+ */
+struct TranslationImageHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t byteOrder;
+    uint32_t recordSize;
+
+    uint32_t translationCount;
+    uint32_t guiDefault;
+    uint32_t microDefault;
+    uint32_t guiCapacity;
+    uint32_t guiCount;
+    uint32_t microCapacity;
+    uint32_t microCount;
+    uint32_t segmentCount;
+    uint32_t reserved;
+    struct TemplateRef guiDefaultOutput;
+    struct TemplateRef microDefaultOutput;
+    uint32_t guiTrieNodeCount;
+    uint32_t guiTrieRuleCount;
+    uint32_t microTrieNodeCount;
+    uint32_t microTrieRuleCount;
+    uint32_t guiDfaStateCount;
+    uint32_t guiDfaClassCount;
+    uint32_t microDfaStateCount;
+    uint32_t microDfaClassCount;
+
+    uint64_t translationsOffset;
+    uint64_t guiSlotsOffset;
+    uint64_t microSlotsOffset;
+    uint64_t segmentsOffset;
+    uint64_t guiTrieNodesOffset;
+    uint64_t guiTrieRulesOffset;
+    uint64_t microTrieNodesOffset;
+    uint64_t microTrieRulesOffset;
+    uint64_t guiDfaClassesOffset;
+    uint64_t guiDfaTransitionsOffset;
+    uint64_t guiDfaAcceptOffset;
+    uint64_t microDfaClassesOffset;
+    uint64_t microDfaTransitionsOffset;
+    uint64_t microDfaAcceptOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+    uint64_t imageSize;
+};
+
+/* a DFA's byte class table, which is left out when it has no states */
+static inline uint64_t dfaClassesSize(uint32_t stateCount)
+{
+    return (stateCount > 0) ? 256 : 0;
+}
+
+static inline uint64_t dfaTransitionsSize(uint32_t stateCount,
+    uint32_t classCount)
+{
+    return (uint64_t)stateCount * classCount * sizeof(uint32_t);
+}
+
+static inline uint64_t alignImageOffset(uint64_t offset)
+{
+    return (offset + TRANSLATION_IMAGE_ALIGN - 1) &
+        ~(uint64_t)(TRANSLATION_IMAGE_ALIGN - 1);
+}
+
+/**
+ * Writes the zero padding needed after a section of the given size to align
+ * what comes next.
+ *
+ * @return int 0 on success, -1 on a write error
+ */
+static int writePadding(FILE *file, size_t size)
+{
+    static const char padding[TRANSLATION_IMAGE_ALIGN];
+
+    const size_t padSize = alignImageOffset(size) - size;
+    if ((padSize > 0) && (fwrite(padding, padSize, 1, file) != 1)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Writes data followed by the padding needed to align what comes next.
+ *
+ * @return int 0 on success, -1 on a write error
+ */
+static int writeSection(FILE *file, const void *data, size_t size)
+{
+    if ((size > 0) && (fwrite(data, size, 1, file) != 1)) {
+        return -1;
+    }
+    return writePadding(file, size);
+}
+
+/**
+ * Saves a set of translations as a compiled image.  The image is written to
+ * a temporary file which is then renamed over filePath, so an agent watching
+ * filePath never sees a half written image.
+ *
+ * @param state the translations to save, typically just loaded from a text
+ *              file
+ * @param filePath the image file to write
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int saveTranslations(const TranslatorState *state, const char *filePath)
+{
+    struct TranslationImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRANSLATION_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = TRANSLATION_IMAGE_VERSION;
+    header.byteOrder = TRANSLATION_IMAGE_BYTE_ORDER;
+    header.recordSize = sizeof(struct translate_msg);
+    header.translationCount = state->translationCount;
+    header.guiDefault = state->guiDefault;
+    header.microDefault = state->microDefault;
+    header.guiCapacity = state->guiTranslationMap.capacity;
+    header.guiCount = state->guiTranslationMap.count;
+    header.microCapacity = state->microTranslationMap.capacity;
+    header.microCount = state->microTranslationMap.count;
+    header.segmentCount = state->segmentCount;
+    header.guiDefaultOutput = state->guiDefaultOutput;
+    header.microDefaultOutput = state->microDefaultOutput;
+    header.guiTrieNodeCount = state->guiTrie.nodeCount;
+    header.guiTrieRuleCount = state->guiTrie.ruleCount;
+    header.microTrieNodeCount = state->microTrie.nodeCount;
+    header.microTrieRuleCount = state->microTrie.ruleCount;
+    header.guiDfaStateCount = state->guiDfa.stateCount;
+    header.guiDfaClassCount = state->guiDfa.classCount;
+    header.microDfaStateCount = state->microDfa.stateCount;
+    header.microDfaClassCount = state->microDfa.classCount;
+
+    const size_t translationsSize = (size_t)state->translationCount *
+        sizeof(struct translate_msg);
+    const size_t guiSlotsSize = (size_t)header.guiCapacity *
+        sizeof(struct TranslationSlot);
+    const size_t microSlotsSize = (size_t)header.microCapacity *
+        sizeof(struct TranslationSlot);
+    const size_t segmentsSize = (size_t)state->segmentCount *
+        sizeof(struct TemplateSegment);
+    const size_t guiTrieNodesSize = (size_t)header.guiTrieNodeCount *
+        sizeof(struct TrieNode);
+    const size_t guiTrieRulesSize = (size_t)header.guiTrieRuleCount *
+        sizeof(uint32_t);
+    const size_t microTrieNodesSize = (size_t)header.microTrieNodeCount *
+        sizeof(struct TrieNode);
+    const size_t microTrieRulesSize = (size_t)header.microTrieRuleCount *
+        sizeof(uint32_t);
+    const size_t guiDfaClassesSize = dfaClassesSize(header.guiDfaStateCount);
+    const size_t guiDfaTransitionsSize = dfaTransitionsSize(
+        header.guiDfaStateCount, header.guiDfaClassCount);
+    const size_t guiDfaAcceptSize = (size_t)header.guiDfaStateCount *
+        sizeof(uint32_t);
+    const size_t microDfaClassesSize = dfaClassesSize(
+        header.microDfaStateCount);
+    const size_t microDfaTransitionsSize = dfaTransitionsSize(
+        header.microDfaStateCount, header.microDfaClassCount);
+    const size_t microDfaAcceptSize = (size_t)header.microDfaStateCount *
+        sizeof(uint32_t);
+
+    header.translationsOffset = alignImageOffset(sizeof(header));
+    header.guiSlotsOffset = header.translationsOffset +
+        alignImageOffset(translationsSize);
+    header.microSlotsOffset = header.guiSlotsOffset +
+        alignImageOffset(guiSlotsSize);
+    header.segmentsOffset = header.microSlotsOffset +
+        alignImageOffset(microSlotsSize);
+    header.guiTrieNodesOffset = header.segmentsOffset +
+        alignImageOffset(segmentsSize);
+    header.guiTrieRulesOffset = header.guiTrieNodesOffset +
+        alignImageOffset(guiTrieNodesSize);
+    header.microTrieNodesOffset = header.guiTrieRulesOffset +
+        alignImageOffset(guiTrieRulesSize);
+    header.microTrieRulesOffset = header.microTrieNodesOffset +
+        alignImageOffset(microTrieNodesSize);
+    header.guiDfaClassesOffset = header.microTrieRulesOffset +
+        alignImageOffset(microTrieRulesSize);
+    header.guiDfaTransitionsOffset = header.guiDfaClassesOffset +
+        alignImageOffset(guiDfaClassesSize);
+    header.guiDfaAcceptOffset = header.guiDfaTransitionsOffset +
+        alignImageOffset(guiDfaTransitionsSize);
+    header.microDfaClassesOffset = header.guiDfaAcceptOffset +
+        alignImageOffset(guiDfaAcceptSize);
+    header.microDfaTransitionsOffset = header.microDfaClassesOffset +
+        alignImageOffset(microDfaClassesSize);
+    header.microDfaAcceptOffset = header.microDfaTransitionsOffset +
+        alignImageOffset(microDfaTransitionsSize);
+    header.stringsOffset = header.microDfaAcceptOffset +
+        alignImageOffset(microDfaAcceptSize);
+    header.stringsSize = state->strings.size;
+    header.imageSize = header.stringsOffset +
+        alignImageOffset(state->strings.size);
+
+    char tmpPath[PATH_MAX];
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", filePath) >=
+        sizeof(tmpPath)) {
+        LogMsg(LOG_ERR, "[TIO] image path %s is too long\n", filePath);
+        return -1;
+    }
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == 0) {
+        LogMsg(LOG_ERR, "[TIO] error creating file %s, errno = %d\n",
+            tmpPath, errno);
+        return -1;
+    }
+
+    int rv = writeSection(file, &header, sizeof(header));
+
+    /* the pool is chunked in memory but contiguous in the image */
+    unsigned written = 0;
+    while ((rv == 0) && (written < state->translationCount)) {
+        unsigned count = state->translationCount - written;
+        if (count > TRANSLATION_CHUNK_SIZE) {
+            count = TRANSLATION_CHUNK_SIZE;
+        }
+        if (fwrite(getTranslation(state, written),
+            sizeof(struct translate_msg), count, file) != count) {
+            rv = -1;
+        }
+        written += count;
+    }
+    if (rv == 0) {
+        rv = writePadding(file, translationsSize);
+    }
+
+    if (rv == 0) {
+        rv = writeSection(file, state->guiTranslationMap.slots, guiSlotsSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microTranslationMap.slots,
+            microSlotsSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->segments, segmentsSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->guiTrie.nodes, guiTrieNodesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->guiTrie.rules, guiTrieRulesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microTrie.nodes, microTrieNodesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microTrie.rules, microTrieRulesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->guiDfa.classes, guiDfaClassesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->guiDfa.transitions,
+            guiDfaTransitionsSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->guiDfa.accept, guiDfaAcceptSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microDfa.classes, microDfaClassesSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microDfa.transitions,
+            microDfaTransitionsSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->microDfa.accept, microDfaAcceptSize);
+    }
+    if (rv == 0) {
+        rv = writeSection(file, state->strings.data, state->strings.size);
+    }
+
+    if ((fclose(file) != 0) || (rv != 0)) {
+        LogMsg(LOG_ERR, "[TIO] error writing file %s, errno = %d\n", tmpPath,
+            errno);
+        unlink(tmpPath);
+        return -1;
+    }
+
+    if (rename(tmpPath, filePath) != 0) {
+        LogMsg(LOG_ERR, "[TIO] error renaming %s to %s, errno = %d\n",
+            tmpPath, filePath, errno);
+        unlink(tmpPath);
+        return -1;
+    }
+
+    LogMsg(LOG_INFO, "[TIO] wrote %d translations to \"%s\"\n",
+        state->translationCount, filePath);
+    return 0;
+}
+
+/**
+ * Checks whether an open file starts with the image magic number.
+ *
+ * @param fd the open file, its position is not changed
+ *
+ * @return int 1 if the file is an image, 0 otherwise
+ */
+int isTranslationImage(int fd)
+{
+    char magic[sizeof(TRANSLATION_IMAGE_MAGIC) - 1];
+    return (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+        (memcmp(magic, TRANSLATION_IMAGE_MAGIC, sizeof(magic)) == 0);
+}
+
+static int isSectionValid(const struct TranslationImageHeader *header,
+    uint64_t offset, uint64_t size)
+{
+    return ((offset % TRANSLATION_IMAGE_ALIGN) == 0) &&
+        (offset >= sizeof(*header)) && (offset <= header->imageSize) &&
+        (size <= (header->imageSize - offset));
+}
+
+static int isIndexValid(uint32_t capacity, uint32_t count)
+{
+    if (capacity == 0) {
+        return count == 0;
+    }
+    return ((capacity & (capacity - 1)) == 0) && (count < capacity);
+}
+
+/* a DFA needs its dead and start states, and no more classes than bytes */
+static int isDfaValid(uint32_t stateCount, uint32_t classCount)
+{
+    if (stateCount == 0) {
+        return 1;
+    }
+    return (stateCount >= 2) && (classCount > 0) && (classCount <= 256);
+}
+
+static int isTemplateValid(const struct TranslationImageHeader *header,
+    struct TemplateRef output)
+{
+    return (output.first <= header->segmentCount) &&
+        (output.count <= (header->segmentCount - output.first));
+}
+
+/**
+ * Checks that an image was written by a compatible tio-compile and that its
+ * sections lie within the file.
+ */
+static int isImageValid(const struct TranslationImageHeader *header,
+    size_t fileSize, const char *filePath)
+{
+    if ((header->version != TRANSLATION_IMAGE_VERSION) ||
+        (header->byteOrder != TRANSLATION_IMAGE_BYTE_ORDER) ||
+        (header->recordSize != sizeof(struct translate_msg))) {
+        LogMsg(LOG_ERR, "[TIO] %s was compiled for a different tio-agent "
+            "version or platform\n", filePath);
+        return 0;
+    }
+
+    if ((header->imageSize != fileSize) ||
+        !isSectionValid(header, header->translationsOffset,
+            (uint64_t)header->translationCount * header->recordSize) ||
+        !isSectionValid(header, header->guiSlotsOffset,
+            (uint64_t)header->guiCapacity * sizeof(struct TranslationSlot)) ||
+        !isSectionValid(header, header->microSlotsOffset,
+            (uint64_t)header->microCapacity * sizeof(struct TranslationSlot)) ||
+        !isSectionValid(header, header->segmentsOffset,
+            (uint64_t)header->segmentCount * sizeof(struct TemplateSegment)) ||
+        !isSectionValid(header, header->guiTrieNodesOffset,
+            (uint64_t)header->guiTrieNodeCount * sizeof(struct TrieNode)) ||
+        !isSectionValid(header, header->guiTrieRulesOffset,
+            (uint64_t)header->guiTrieRuleCount * sizeof(uint32_t)) ||
+        !isSectionValid(header, header->microTrieNodesOffset,
+            (uint64_t)header->microTrieNodeCount * sizeof(struct TrieNode)) ||
+        !isSectionValid(header, header->microTrieRulesOffset,
+            (uint64_t)header->microTrieRuleCount * sizeof(uint32_t)) ||
+        !isSectionValid(header, header->guiDfaClassesOffset,
+            dfaClassesSize(header->guiDfaStateCount)) ||
+        !isSectionValid(header, header->guiDfaTransitionsOffset,
+            dfaTransitionsSize(header->guiDfaStateCount,
+                header->guiDfaClassCount)) ||
+        !isSectionValid(header, header->guiDfaAcceptOffset,
+            (uint64_t)header->guiDfaStateCount * sizeof(uint32_t)) ||
+        !isSectionValid(header, header->microDfaClassesOffset,
+            dfaClassesSize(header->microDfaStateCount)) ||
+        !isSectionValid(header, header->microDfaTransitionsOffset,
+            dfaTransitionsSize(header->microDfaStateCount,
+                header->microDfaClassCount)) ||
+        !isSectionValid(header, header->microDfaAcceptOffset,
+            (uint64_t)header->microDfaStateCount * sizeof(uint32_t)) ||
+        !isDfaValid(header->guiDfaStateCount, header->guiDfaClassCount) ||
+        !isDfaValid(header->microDfaStateCount, header->microDfaClassCount) ||
+        !isSectionValid(header, header->stringsOffset, header->stringsSize) ||
+        !isIndexValid(header->guiCapacity, header->guiCount) ||
+        !isIndexValid(header->microCapacity, header->microCount) ||
+        (header->guiDefault >= header->stringsSize) ||
+        (header->microDefault >= header->stringsSize) ||
+        !isTemplateValid(header, header->guiDefaultOutput) ||
+        !isTemplateValid(header, header->microDefaultOutput)) {
+        LogMsg(LOG_ERR, "[TIO] %s is truncated or corrupt\n", filePath);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Checks that an arena offset refers to a whole, nul terminated entry.
+ */
+static int isStringValid(const char *strings, uint64_t stringsSize,
+    uint32_t offset)
+{
+    if (((offset % sizeof(uint16_t)) != 0) ||
+        ((uint64_t)offset + sizeof(uint16_t) > stringsSize)) {
+        return 0;
+    }
+    const uint64_t end = (uint64_t)offset + sizeof(uint16_t) +
+        *(const uint16_t *)(strings + offset);
+    return (end < stringsSize) && (strings[end] == '\0');
+}
+
+/**
+ * Checks that every slot of an index refers to a translation and that the
+ * index has as many used slots as it claims, so probes always end.
+ */
+static int isIndexContentValid(const struct TranslationImageHeader *header,
+    const struct TranslationSlot *slots, uint32_t capacity, uint32_t count)
+{
+    uint32_t used = 0;
+    uint32_t i;
+    for (i = 0; i < capacity; i++) {
+        if (slots[i].rule != 0) {
+            if (slots[i].rule > header->translationCount) {
+                return 0;
+            }
+            used++;
+        }
+    }
+    return used == count;
+}
+
+/**
+ * Checks that a trie's labels lie within the arena, that its child and rule
+ * ranges lie within its arrays, that children come after their parent so a
+ * walk down always ends, and that its rules are wildcard rules.
+ */
+static int isTrieValid(const struct TranslationImageHeader *header,
+    const struct translate_msg *records, const struct TrieNode *nodes,
+    uint32_t nodeCount, const uint32_t *rules, uint32_t ruleCount)
+{
+    uint32_t i;
+    for (i = 0; i < ruleCount; i++) {
+        if ((rules[i] >= header->translationCount) ||
+            (records[rules[i]].wildcard == 0)) {
+            return 0;
+        }
+    }
+
+    for (i = 0; i < nodeCount; i++) {
+        const struct TrieNode *node = &nodes[i];
+        if ((node->label >= header->stringsSize) ||
+            (((uint64_t)node->label + node->labelLength) >
+                header->stringsSize) ||
+            (((uint64_t)node->firstChild + node->childCount) > nodeCount) ||
+            ((node->childCount > 0) && (node->firstChild <= i)) ||
+            (((uint64_t)node->firstRule + node->ruleCount) > ruleCount)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Checks that a DFA's classes, transitions and accepted rules are in range.
+ */
+static int isDfaContentValid(const struct TranslationImageHeader *header,
+    const uint8_t *classes, uint32_t classCount, uint32_t stateCount,
+    const uint32_t *transitions, const uint32_t *accept)
+{
+    if (stateCount == 0) {
+        return 1;
+    }
+
+    unsigned c;
+    for (c = 0; c < 256; c++) {
+        if (classes[c] >= classCount) {
+            return 0;
+        }
+    }
+
+    const uint64_t transitionCount = (uint64_t)stateCount * classCount;
+    uint64_t i;
+    for (i = 0; i < transitionCount; i++) {
+        if (transitions[i] >= stateCount) {
+            return 0;
+        }
+    }
+    for (i = 0; i < stateCount; i++) {
+        if (accept[i] > header->translationCount) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Checks every offset and index stored in the sections of an image which
+ * isImageValid() accepted, so that a corrupt image is rejected at load
+ * rather than crashing the translator later.
+ */
+static int isImageContentValid(const struct TranslationImageHeader *header,
+    const char *image, const char *filePath)
+{
+    const char *strings = image + header->stringsOffset;
+    const uint64_t stringsSize = header->stringsSize;
+    const struct translate_msg *records = (const struct translate_msg *)
+        (image + header->translationsOffset);
+    const struct TemplateSegment *segments = (const struct TemplateSegment *)
+        (image + header->segmentsOffset);
+    int valid = isStringValid(strings, stringsSize, header->guiDefault) &&
+        isStringValid(strings, stringsSize, header->microDefault);
+
+    uint32_t i;
+    for (i = 0; valid && (i < header->translationCount); i++) {
+        const struct translate_msg *record = &records[i];
+        valid = isStringValid(strings, stringsSize, record->key) &&
+            isStringValid(strings, stringsSize, record->msg) &&
+            isTemplateValid(header, record->output) &&
+            (record->wildcard <=
+                (*(const uint16_t *)(strings + record->key) + 1));
+    }
+
+    for (i = 0; valid && (i < header->segmentCount); i++) {
+        const struct TemplateSegment *segment = &segments[i];
+        valid = (segment->type <= SEGMENT_CAPTURE) &&
+            (((uint64_t)segment->offset + segment->length) <= stringsSize);
+    }
+
+    valid = valid &&
+        isIndexContentValid(header, (const struct TranslationSlot *)
+            (image + header->guiSlotsOffset), header->guiCapacity,
+            header->guiCount) &&
+        isIndexContentValid(header, (const struct TranslationSlot *)
+            (image + header->microSlotsOffset), header->microCapacity,
+            header->microCount) &&
+        isTrieValid(header, records, (const struct TrieNode *)
+            (image + header->guiTrieNodesOffset), header->guiTrieNodeCount,
+            (const uint32_t *)(image + header->guiTrieRulesOffset),
+            header->guiTrieRuleCount) &&
+        isTrieValid(header, records, (const struct TrieNode *)
+            (image + header->microTrieNodesOffset),
+            header->microTrieNodeCount,
+            (const uint32_t *)(image + header->microTrieRulesOffset),
+            header->microTrieRuleCount) &&
+        isDfaContentValid(header,
+            (const uint8_t *)(image + header->guiDfaClassesOffset),
+            header->guiDfaClassCount, header->guiDfaStateCount,
+            (const uint32_t *)(image + header->guiDfaTransitionsOffset),
+            (const uint32_t *)(image + header->guiDfaAcceptOffset)) &&
+        isDfaContentValid(header,
+            (const uint8_t *)(image + header->microDfaClassesOffset),
+            header->microDfaClassCount, header->microDfaStateCount,
+            (const uint32_t *)(image + header->microDfaTransitionsOffset),
+            (const uint32_t *)(image + header->microDfaAcceptOffset));
+
+    if (!valid) {
+        LogMsg(LOG_ERR, "[TIO] %s is truncated or corrupt\n", filePath);
+    }
+    return valid;
+}
+
+/**
+ * Replaces the contents of a set of translations with a compiled image.
+ * The image is read into one block which the arena, pool, templates,
+ * indexes, tries and DFAs point into, released by freeTranslations().
+ *
+ * @param state the set of translations to fill
+ * @param fd the open image file
+ * @param filePath the name of the image file, for messages
+ *
+ * @return int 0 on success, -1 on failure
+ */
+int loadTranslationImage(TranslatorState *state, int fd, const char *filePath)
+{
+    struct stat filestat;
+    if (fstat(fd, &filestat) != 0) {
+        LogMsg(LOG_ERR, "[TIO] fstat() of %s failed, errno = %d\n", filePath,
+            errno);
+        return -1;
+    }
+    if (filestat.st_size < sizeof(struct TranslationImageHeader)) {
+        LogMsg(LOG_ERR, "[TIO] %s is truncated or corrupt\n", filePath);
+        return -1;
+    }
+
+    /* malloc() alignment is enough for the sections' */
+    void *image = malloc(filestat.st_size);
+    if (image == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for image %s\n", filePath);
+        return -1;
+    }
+    off_t done = 0;
+    while (done < filestat.st_size) {
+        const ssize_t numRead = pread(fd, (char *)image + done,
+            filestat.st_size - done, done);
+        if (numRead <= 0) {
+            if ((numRead == -1) && (errno == EINTR)) {
+                continue;
+            }
+            if (numRead == -1) {
+                LogMsg(LOG_ERR, "[TIO] error reading file %s, errno = %d\n",
+                    filePath, errno);
+            } else {
+                /* the file shrank since fstat() */
+                LogMsg(LOG_ERR, "[TIO] %s is truncated or corrupt\n",
+                    filePath);
+            }
+            free(image);
+            return -1;
+        }
+        done += numRead;
+    }
+
+    const struct TranslationImageHeader *header = image;
+    if (!isImageValid(header, filestat.st_size, filePath) ||
+        !isImageContentValid(header, image, filePath)) {
+        free(image);
+        return -1;
+    }
+
+    /* point the pool's chunks at consecutive runs of the image's records */
+    const unsigned chunkCount = (header->translationCount +
+        TRANSLATION_CHUNK_SIZE - 1) >> TRANSLATION_CHUNK_SHIFT;
+    struct translate_msg **chunks = malloc((chunkCount + 1) *
+        sizeof(struct translate_msg *));
+    if (chunks == 0) {
+        free(image);
+        return -1;
+    }
+    struct translate_msg *records = (struct translate_msg *)
+        ((char *)image + header->translationsOffset);
+    unsigned i;
+    for (i = 0; i < chunkCount; i++) {
+        chunks[i] = records + ((size_t)i << TRANSLATION_CHUNK_SHIFT);
+    }
+
+    /* drop whatever was preallocated for parsing */
+    freeTranslations(state);
+
+    state->image = image;
+    state->imageSize = filestat.st_size;
+    state->translationChunks = chunks;
+    state->chunkCount = chunkCount;
+    state->translationCount = header->translationCount;
+    state->guiDefault = header->guiDefault;
+    state->microDefault = header->microDefault;
+    state->guiDefaultOutput = header->guiDefaultOutput;
+    state->microDefaultOutput = header->microDefaultOutput;
+    state->segments = (struct TemplateSegment *)
+        ((char *)image + header->segmentsOffset);
+    state->segmentCount = header->segmentCount;
+    state->segmentCapacity = header->segmentCount;
+    state->strings.data = (char *)image + header->stringsOffset;
+    state->strings.size = header->stringsSize;
+    state->strings.capacity = header->stringsSize;
+    state->guiTranslationMap.slots = (struct TranslationSlot *)
+        ((char *)image + header->guiSlotsOffset);
+    state->guiTranslationMap.capacity = header->guiCapacity;
+    state->guiTranslationMap.count = header->guiCount;
+    state->microTranslationMap.slots = (struct TranslationSlot *)
+        ((char *)image + header->microSlotsOffset);
+    state->microTranslationMap.capacity = header->microCapacity;
+    state->microTranslationMap.count = header->microCount;
+    state->guiTrie.nodes = (struct TrieNode *)
+        ((char *)image + header->guiTrieNodesOffset);
+    state->guiTrie.nodeCount = header->guiTrieNodeCount;
+    state->guiTrie.rules = (uint32_t *)
+        ((char *)image + header->guiTrieRulesOffset);
+    state->guiTrie.ruleCount = header->guiTrieRuleCount;
+    state->microTrie.nodes = (struct TrieNode *)
+        ((char *)image + header->microTrieNodesOffset);
+    state->microTrie.nodeCount = header->microTrieNodeCount;
+    state->microTrie.rules = (uint32_t *)
+        ((char *)image + header->microTrieRulesOffset);
+    state->microTrie.ruleCount = header->microTrieRuleCount;
+    state->guiDfa.classes = (uint8_t *)image + header->guiDfaClassesOffset;
+    state->guiDfa.classCount = header->guiDfaClassCount;
+    state->guiDfa.stateCount = header->guiDfaStateCount;
+    state->guiDfa.transitions = (uint32_t *)
+        ((char *)image + header->guiDfaTransitionsOffset);
+    state->guiDfa.accept = (uint32_t *)
+        ((char *)image + header->guiDfaAcceptOffset);
+    state->microDfa.classes = (uint8_t *)image + header->microDfaClassesOffset;
+    state->microDfa.classCount = header->microDfaClassCount;
+    state->microDfa.stateCount = header->microDfaStateCount;
+    state->microDfa.transitions = (uint32_t *)
+        ((char *)image + header->microDfaTransitionsOffset);
+    state->microDfa.accept = (uint32_t *)
+        ((char *)image + header->microDfaAcceptOffset);
+
+    LogMsg(LOG_INFO, "[TIO] read %d translations from image \"%s\"\n",
+        state->translationCount, filePath);
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * translate_output.c
+ *
+ * Reference counted message buffers and per-connection output queues.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "translate_event.h"
+#include "translate_output.h"
+#include "translate_stats.h"
+
+#define INITIAL_QUEUE_CAPACITY 16
+
+/* buffers gathered into one sendmsg() */
+#define MAX_FLUSH_IOVECS 64
+
+/**
+ * Allocates a buffer holding a message followed by its terminator.  The
+ * caller owns the single reference the buffer starts with.
+ *
+ * @param msg the message text
+ * @param length the number of characters in msg
+ * @param terminator appended to the message, may be 0
+ *
+ * @return struct TioMsgBuf* the new buffer or 0 if out of memory
+ */
+struct TioMsgBuf *tioMsgBufCreate(const char *msg, size_t length,
+    const char *terminator)
+{
+    const size_t termLength = (terminator == 0) ? 0 : strlen(terminator);
+    struct TioMsgBuf *buf = malloc(sizeof(struct TioMsgBuf) + length +
+        termLength);
+    if (buf == 0) {
+        return 0;
+    }
+
+    buf->refCount = 1;
+    buf->length = length + termLength;
+    buf->received = 0;
+    buf->latency = 0;
+    memcpy(buf->data, msg, length);
+    memcpy(buf->data + length, terminator, termLength);
+    return buf;
+}
+
+struct TioMsgBuf *tioMsgBufRef(struct TioMsgBuf *buf)
+{
+    buf->refCount++;
+    return buf;
+}
+
+void tioMsgBufUnref(struct TioMsgBuf *buf)
+{
+    if (--buf->refCount == 0) {
+        free(buf);
+    }
+}
+
+void tioOutQueueInit(struct TioOutQueue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+}
+
+/**
+ * Drops every queued buffer and releases the queue's storage.  The queue can
+ * be reused afterwards.
+ *
+ * @param queue the queue to empty
+ */
+void tioOutQueueClear(struct TioOutQueue *queue)
+{
+    while (queue->count > 0) {
+        tioMsgBufUnref(queue->entries[queue->head]);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    free(queue->entries);
+    tioOutQueueInit(queue);
+}
+
+/**
+ * Appends a buffer to a queue.  The queue takes its own reference.
+ *
+ * @param queue the connection's queue
+ * @param buf the message to be written
+ *
+ * @return int 0 on success, -1 if out of memory
+ */
+int tioOutQueuePush(struct TioOutQueue *queue, struct TioMsgBuf *buf)
+{
+    if (queue->count == queue->capacity) {
+        const unsigned newCapacity = (queue->capacity == 0) ?
+            INITIAL_QUEUE_CAPACITY : queue->capacity * 2;
+        struct TioMsgBuf **entries = malloc(newCapacity * sizeof(*entries));
+        if (entries == 0) {
+            return -1;
+        }
+
+        /* unwrap the ring into the new array */
+        unsigned i;
+        for (i = 0; i < queue->count; i++) {
+            entries[i] = queue->entries[(queue->head + i) % queue->capacity];
+        }
+        free(queue->entries);
+        queue->entries = entries;
+        queue->capacity = newCapacity;
+        queue->head = 0;
+    }
+
+    queue->entries[(queue->head + queue->count) % queue->capacity] =
+        tioMsgBufRef(buf);
+    queue->count++;
+    queue->bytes += buf->length;
+    return 0;
+}
+
+/**
+ * Discards the oldest buffers until no more than limit bytes are queued.  A
+ * buffer which has been partly written is kept so the peer never sees half a
+ * message, and so are the buffers a send in progress is writing.
+ *
+ * @param queue the connection's queue
+ * @param limit the number of bytes that may stay queued
+ *
+ * @return unsigned the number of buffers discarded
+ */
+unsigned tioOutQueueDropOldest(struct TioOutQueue *queue, size_t limit)
+{
+    const unsigned keep = queue->sending ? queue->sendCount :
+        ((queue->offset > 0) ? 1 : 0);
+    unsigned dropped = 0;
+    while ((queue->bytes > limit) && (queue->count > keep)) {
+        /* drop the entry after the ones kept, moving those up */
+        unsigned i = (queue->head + keep) % queue->capacity;
+        struct TioMsgBuf *buf = queue->entries[i];
+        unsigned k;
+        for (k = 0; k < keep; k++) {
+            const unsigned prev = (i + queue->capacity - 1) % queue->capacity;
+            queue->entries[i] = queue->entries[prev];
+            i = prev;
+        }
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->bytes -= buf->length;
+        tioMsgBufUnref(buf);
+        dropped++;
+    }
+    return dropped;
+}
+
+/**
+ * Releases the buffers a write finished, recording their latency if they
+ * have one, and notes how much of the next one went out.
+ */
+static void tioOutQueueConsume(struct TioOutQueue *queue, size_t sent)
+{
+    queue->bytes -= sent;
+    sent += queue->offset;
+    uint64_t now = 0;
+    while (queue->count > 0) {
+        struct TioMsgBuf *buf = queue->entries[queue->head];
+        if (sent < buf->length) {
+            break;
+        }
+        sent -= buf->length;
+        if (buf->latency != 0) {
+            if (now == 0) {
+                now = tioStatsNow();
+            }
+            tioHistogramRecord(buf->latency, now - buf->received);
+        }
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        tioMsgBufUnref(buf);
+    }
+    queue->offset = sent;
+}
+
+/**
+ * Gathers up to MAX_FLUSH_IOVECS buffers from the head of a queue, skipping
+ * what has already been written of the first.
+ *
+ * @return unsigned the number of entries filled in
+ */
+static unsigned tioOutQueueGather(const struct TioOutQueue *queue,
+    struct iovec *iov)
+{
+    unsigned iovCount = 0;
+    while ((iovCount < queue->count) && (iovCount < MAX_FLUSH_IOVECS)) {
+        struct TioMsgBuf *buf =
+            queue->entries[(queue->head + iovCount) % queue->capacity];
+        iov[iovCount].iov_base = buf->data;
+        iov[iovCount].iov_len = buf->length;
+        iovCount++;
+    }
+    iov[0].iov_base = (char *)iov[0].iov_base + queue->offset;
+    iov[0].iov_len -= queue->offset;
+    return iovCount;
+}
+
+static void tioOutQueueOnSent(int fd, ssize_t result, void *context)
+{
+    struct TioOutQueue *queue = context;
+    queue->sending = 0;
+    queue->sendCount = 0;
+    if (result < 0) {
+        queue->sendError = -result;
+    } else {
+        tioOutQueueConsume(queue, result);
+    }
+}
+
+/**
+ * Writes queued buffers to a socket, oldest first, releasing each one once
+ * it has been sent completely and recording its latency if it has one.  Up
+ * to MAX_FLUSH_IOVECS buffers go out in a single sendmsg(), so a batch of
+ * messages costs one system call.  The socket should be non-blocking; a
+ * partial write leaves the rest queued.
+ *
+ * If the event engine can send on the socket, the buffers are handed to
+ * tioEventSend() instead and the queue is busy until that send finishes;
+ * flushing again meanwhile does nothing.
+ *
+ * @param queue the connection's queue
+ * @param fd the connection's socket
+ *
+ * @return int 0 when the queue was emptied, 1 if the socket can't take any
+ *             more yet, -1 on a send error with errno set
+ */
+int tioOutQueueFlush(struct TioOutQueue *queue, int fd)
+{
+    struct iovec iov[MAX_FLUSH_IOVECS];
+
+    if (queue->sendError != 0) {
+        errno = queue->sendError;
+        return -1;
+    }
+    if (queue->sending) {
+        return 1;
+    }
+    if ((queue->count > 0) && tioEventCanSend(fd)) {
+        const unsigned iovCount = tioOutQueueGather(queue, iov);
+        if (tioEventSend(fd, iov, iovCount, tioOutQueueOnSent, queue) != 0) {
+            return -1;
+        }
+        queue->sending = 1;
+        queue->sendCount = iovCount;
+        return 1;
+    }
+
+    while (queue->count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = tioOutQueueGather(queue, iov);
+        ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return 1;
+            }
+            return -1;
+        }
+
+        /* release everything that went out completely */
+        tioOutQueueConsume(queue, sent);
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * translate_output.h
+ *
+ * Reference counted message buffers and the per-connection queues that hold
+ * them until they are written.  A message going to several connections is
+ * formatted once into a TioMsgBuf and each connection's queue takes a
+ * reference to it.  Queues are written with non-blocking sends, or through
+ * the event engine where it can send; whatever the socket doesn't take stays
+ * queued for the next flush.
+ */
+
+#ifndef TRANSLATE_OUTPUT_H_
+#define TRANSLATE_OUTPUT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct TioHistogram;
+
+struct TioMsgBuf
+{
+    unsigned refCount;
+    size_t length;
+
+    /*
+     * when the message it was translated from was read (tioStatsNow()), and
+     * where to record how long it took to be written; latency may be 0
+     */
+    uint64_t received;
+    struct TioHistogram *latency;
+
+    char data[];
+};
+
+struct TioOutQueue
+{
+    /* ring of buffers waiting to be written, oldest at head */
+    struct TioMsgBuf **entries;
+    unsigned capacity;
+    unsigned head;
+    unsigned count;
+
+    /* number of bytes of the head entry already written */
+    size_t offset;
+
+    /* number of bytes still to be written */
+    size_t bytes;
+
+    /*
+     * with tioEventSend(), whether a send is in progress, how many entries
+     * from head it covers, and the errno it failed with if it did
+     */
+    int sending;
+    unsigned sendCount;
+    int sendError;
+};
+
+struct TioMsgBuf *tioMsgBufCreate(const char *msg, size_t length,
+    const char *terminator);
+struct TioMsgBuf *tioMsgBufRef(struct TioMsgBuf *buf);
+void tioMsgBufUnref(struct TioMsgBuf *buf);
+
+void tioOutQueueInit(struct TioOutQueue *queue);
+void tioOutQueueClear(struct TioOutQueue *queue);
+int tioOutQueuePush(struct TioOutQueue *queue, struct TioMsgBuf *buf);
+unsigned tioOutQueueDropOldest(struct TioOutQueue *queue, size_t limit);
+int tioOutQueueFlush(struct TioOutQueue *queue, int fd);
+
+#endif /* TRANSLATE_OUTPUT_H_ */
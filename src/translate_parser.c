@@ -4,142 +4,688 @@
  *  Created on: Oct 7, 2011
  *      Author: jhorn
  */
+#define _GNU_SOURCE     /* for memrchr() */
+
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>     /* Commonly used string-handling functions */
-#include <sys/stat.h>
 #include <unistd.h>
 
 #include "translate_parser.h"
+#include "translate_rules.h"
 #include "read_line.h"
 
+/* size of the blocks a translation file is read in */
+#define LOAD_BLOCK_SIZE 65536
+
 /* forward function declarations */
 void translate_add_mapping(TranslatorState *state, const char*,
     unsigned lineNumber);
 void translate_reset_mapping(TranslatorState *state);
-int compareTranslations(const struct rbtree_node *first,
-    const struct rbtree_node *second);
-void initTranslations(TranslatorState *state, const unsigned short mapSize);
-void freeTranslations(TranslatorState *state);
+static void initTranslations(TranslatorState *state,
+    const unsigned short mapSize);
+
+/**
+ * Makes sure the pool has room for at least the given number of
+ * translations.
+ *
+ * @return int 0 on success, -1 if out of memory
+ */
+static int reserveTranslations(TranslatorState *state, unsigned count)
+{
+    const unsigned chunksNeeded = (count + TRANSLATION_CHUNK_SIZE - 1) >>
+        TRANSLATION_CHUNK_SHIFT;
+    if (chunksNeeded <= state->chunkCount) {
+        return 0;
+    }
+
+    struct translate_msg **chunks = realloc(state->translationChunks,
+        chunksNeeded * sizeof(struct translate_msg *));
+    if (chunks == 0) {
+        return -1;
+    }
+    state->translationChunks = chunks;
+
+    while (state->chunkCount < chunksNeeded) {
+        struct translate_msg *chunk = malloc(TRANSLATION_CHUNK_SIZE *
+            sizeof(struct translate_msg));
+        if (chunk == 0) {
+            return -1;
+        }
+        chunks[state->chunkCount++] = chunk;
+    }
+    return 0;
+}
+
+/**
+ * Takes the next free translation from the pool.
+ *
+ * @return struct translate_msg* the translation or 0 if out of memory
+ */
+static struct translate_msg *allocTranslation(TranslatorState *state)
+{
+    if (reserveTranslations(state, state->translationCount + 1) != 0) {
+        return 0;
+    }
+    return getTranslation(state, state->translationCount++);
+}
+
+/**
+ * Copies a string into the arena.
+ *
+ * @param arena the arena to add to
+ * @param str the characters to copy, not necessarily nul terminated
+ * @param length the number of characters to copy, less than MAX_LINE_SIZE
+ *
+ * @return uint32_t the offset of the new entry
+ */
+static uint32_t arenaAdd(struct StringArena *arena, const char *str,
+    size_t length)
+{
+    const size_t entrySize = (sizeof(uint16_t) + length + 1 + 1) &
+        ~(size_t)1;
+    if ((arena->size + entrySize) > arena->capacity) {
+        size_t capacity = (arena->capacity == 0) ? 4096 : arena->capacity;
+        while (capacity < (arena->size + entrySize)) {
+            capacity *= 2;
+        }
+        char *data = realloc(arena->data, capacity);
+        if (data == 0) {
+            dieWithSystemMessage("realloc() of translation strings failed");
+        }
+        arena->data = data;
+        arena->capacity = capacity;
+    }
+
+    const uint32_t offset = arena->size;
+    *(uint16_t *)(arena->data + offset) = length;
+    memcpy(arena->data + offset + sizeof(uint16_t), str, length);
+    arena->data[offset + sizeof(uint16_t) + length] = '\0';
+    arena->size += entrySize;
+    return offset;
+}
 
-int maxMappingSize = -1;
+/**
+ * Empties the arena, leaving only the empty string at offset 0.
+ */
+static void arenaReset(struct StringArena *arena)
+{
+    arena->size = 0;
+    arenaAdd(arena, "", 0);
+}
 
 /**
- * This structure is a single record of information which is placed into a
- * red/black tree.
+ * Appends a segment to the state's segment array.
  */
-struct translate_msg {
-    char key[MAX_LINE_SIZE];
-    char msg[MAX_LINE_SIZE];
-    format_spec fmt_spec;
-    unsigned lineNumber;
-    struct rbtree_node node;
-};
+static void addSegment(TranslatorState *state, segment_type type,
+    uint32_t offset, size_t length)
+{
+    if (state->segmentCount == state->segmentCapacity) {
+        const unsigned capacity = (state->segmentCapacity == 0) ? 256 :
+            state->segmentCapacity * 2;
+        struct TemplateSegment *segments = realloc(state->segments,
+            capacity * sizeof(struct TemplateSegment));
+        if (segments == 0) {
+            dieWithSystemMessage("realloc() of template segments failed");
+        }
+        state->segments = segments;
+        state->segmentCapacity = capacity;
+    }
+
+    struct TemplateSegment *segment = &state->segments[state->segmentCount++];
+    segment->offset = offset;
+    segment->length = length;
+    segment->type = type;
+    segment->reserved = 0;
+}
 
 /**
- * This structure represents the state of the translation maps used by the 
- * agent.  It contains the free store of translations, maps for both directions 
- * of message traversal and default messages for each. 
+ * Compiles a message from the translation file into an output template.  The
+ * only conversions recognized are %d (or %i), which is replaced by the
+ * input's value as an integer, %s, which is replaced by the value as is, %*,
+ * which is replaced by the text a wildcard rule's * matched, and %% for a
+ * single %.  Anything else, including other printf conversions, is literal
+ * text.  Literal segments refer to the message text in the arena so
+ * nothing is copied.
+ *
+ * @param state the translations the message belongs to
+ * @param msg the arena offset of the message
+ *
+ * @return struct TemplateRef the compiled template
  */
-struct TranslatorState
+static struct TemplateRef compileTemplate(TranslatorState *state,
+    uint32_t msg)
 {
-    /* the number of translations allocated from translations array */
-    unsigned translationCount;
+    const char *text = arenaString(&state->strings, msg);
+    const size_t length = arenaLength(&state->strings, msg);
+    const uint32_t base = text - state->strings.data;
+
+    struct TemplateRef ref;
+    ref.first = state->segmentCount;
+
+    size_t literalStart = 0;
+    size_t i = 0;
+    while ((i + 1) < length) {
+        if (text[i] != '%') {
+            i++;
+            continue;
+        }
+
+        segment_type type;
+        switch (text[i + 1]) {
+        case 'd':
+        case 'i':
+            type = SEGMENT_INTEGER;
+            break;
+
+        case 's':
+            type = SEGMENT_STRING;
+            break;
 
-    /* the default message to use for messages from the GUI */
-    char guiDefault[MAX_LINE_SIZE];
+        case '*':
+            type = SEGMENT_CAPTURE;
+            break;
+
+        case '%':
+            /* keep the first % as the end of the literal, skip the second */
+            addSegment(state, SEGMENT_LITERAL, base + literalStart,
+                i + 1 - literalStart);
+            i += 2;
+            literalStart = i;
+            continue;
+
+        default:
+            i++;
+            continue;
+        }
 
-    /* the default message to use for messages from the micro */
-    char microDefault[MAX_LINE_SIZE];
+        if (i > literalStart) {
+            addSegment(state, SEGMENT_LITERAL, base + literalStart,
+                i - literalStart);
+        }
+        addSegment(state, type, 0, 0);
+        i += 2;
+        literalStart = i;
+    }
+    if (length > literalStart) {
+        addSegment(state, SEGMENT_LITERAL, base + literalStart,
+            length - literalStart);
+    }
 
-    /* the pool of translation structures that will be put into the maps */
-    struct translate_msg* translations;
+    ref.count = state->segmentCount - ref.first;
+    return ref;
+}
 
-    /* the map of translation messages for messages received from the GUI */
-    struct rbtree guiTranslationMap;
+/**
+ * Writes the decimal representation of an integer.
+ *
+ * @param value the integer
+ * @param buf receives the digits, at least 12 characters
+ *
+ * @return size_t the number of characters written
+ */
+static size_t formatInteger(int value, char *buf)
+{
+    char digits[12];
+    size_t count = 0;
+    unsigned magnitude = (value < 0) ? -(unsigned)value : (unsigned)value;
+    do {
+        digits[count++] = '0' + (magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
 
-    /* the map of translation messages for messages received from the micro */
-    struct rbtree microTranslationMap;
-};
+    size_t length = 0;
+    if (value < 0) {
+        buf[length++] = '-';
+    }
+    while (count > 0) {
+        buf[length++] = digits[--count];
+    }
+    return length;
+}
 
 /**
- * The program has one set of translations.  One such structure is statically 
- * allocated in this function and its address is returned by it in order for 
- * the program to gain access to it. 
- * 
- * @return TranslatorState* 
+ * Converts the start of a value which need not be nul terminated the same way
+ * atoi() would: leading white space, an optional sign and then digits up to
+ * the first non-digit.
+ */
+static int parseInteger(const char *value, size_t length)
+{
+    const char *end = value + length;
+    while ((value < end) && isspace((unsigned char)*value)) {
+        value++;
+    }
+
+    int negative = 0;
+    if ((value < end) && ((*value == '-') || (*value == '+'))) {
+        negative = (*value == '-');
+        value++;
+    }
+
+    unsigned magnitude = 0;
+    while ((value < end) && (*value >= '0') && (*value <= '9')) {
+        magnitude = (magnitude * 10) + (*value - '0');
+        value++;
+    }
+    return negative ? -(int)magnitude : (int)magnitude;
+}
+
+/**
+ * Produces an output message from a compiled template.
+ *
+ * @param state the translations the template belongs to
+ * @param output the template
+ * @param value the value from the input message substituted for %s and, as
+ *              an integer, for %d
+ * @param valueLength the number of characters in value
+ * @param capture the text matched by a wildcard rule's *, substituted for %*
+ * @param captureLength the number of characters in capture
+ * @param outMsg receives the nul terminated output, truncated if necessary
+ * @param outMsgSize the number of characters available at outMsg
+ *
+ * @return size_t the number of characters written, not counting the nul
+ */
+static size_t renderTemplate(const TranslatorState *state,
+    struct TemplateRef output, const char *value, size_t valueLength,
+    const char *capture, size_t captureLength, char *outMsg,
+    size_t outMsgSize)
+{
+    const size_t limit = outMsgSize - 1;
+    size_t length = 0;
+    char number[12];
+
+    uint32_t i;
+    for (i = 0; (i < output.count) && (length < limit); i++) {
+        const struct TemplateSegment *segment =
+            &state->segments[output.first + i];
+        const char *piece;
+        size_t pieceLength;
+
+        switch (segment->type) {
+        case SEGMENT_INTEGER:
+            pieceLength = formatInteger(parseInteger(value, valueLength),
+                number);
+            piece = number;
+            break;
+
+        case SEGMENT_STRING:
+            piece = value;
+            pieceLength = valueLength;
+            break;
+
+        case SEGMENT_CAPTURE:
+            piece = capture;
+            pieceLength = captureLength;
+            break;
+
+        case SEGMENT_LITERAL:
+        default:
+            piece = state->strings.data + segment->offset;
+            pieceLength = segment->length;
+            break;
+        }
+
+        if (pieceLength > (limit - length)) {
+            pieceLength = limit - length;
+        }
+        memcpy(outMsg + length, piece, pieceLength);
+        length += pieceLength;
+    }
+    outMsg[length] = '\0';
+    return length;
+}
+
+/**
+ * 32 bit FNV-1a hash of a key.
+ *
+ * @param key the first character of the key, not necessarily nul terminated
+ * @param length the number of characters in the key
+ *
+ * @return uint32_t the hash
+ */
+static uint32_t hashKey(const char *key, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Finds the translation for a key.
+ *
+ * @param state the translations the index refers to
+ * @param index the map to search
+ * @param key the key to look for, not necessarily nul terminated
+ * @param length the number of characters in the key
+ *
+ * @return uint32_t one more than the index of the translation in the pool, or
+ *         0 if not found
+ */
+static uint32_t indexLookup(const TranslatorState *state,
+    const struct TranslationIndex *index, const char *key, size_t length)
+{
+    if (index->count == 0) {
+        return 0;
+    }
+
+    const uint32_t hash = hashKey(key, length);
+    const unsigned mask = index->capacity - 1;
+    unsigned i = hash & mask;
+    while (index->slots[i].rule != 0) {
+        if (index->slots[i].hash == hash) {
+            const struct translate_msg *translation =
+                getTranslation(state, index->slots[i].rule - 1);
+            if ((arenaLength(&state->strings, translation->key) == length) &&
+                (memcmp(arenaString(&state->strings, translation->key), key,
+                    length) == 0)) {
+                return index->slots[i].rule;
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+/**
+ * Places a slot into an index's slot array without checking for duplicates.
+ */
+static void indexPlace(struct TranslationSlot *slots, unsigned capacity,
+    uint32_t hash, uint32_t rule)
+{
+    const unsigned mask = capacity - 1;
+    unsigned i = hash & mask;
+    while (slots[i].rule != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].rule = rule;
+}
+
+/**
+ * Makes room in an index for at least the given number of keys.
+ *
+ * @return int 0 on success, -1 if out of memory
+ */
+static int indexReserve(struct TranslationIndex *index, unsigned count)
+{
+    unsigned capacity = (index->capacity == 0) ? 16 : index->capacity;
+    while (capacity < (count * 2)) {
+        capacity *= 2;
+    }
+    if (capacity == index->capacity) {
+        return 0;
+    }
+
+    struct TranslationSlot *slots = calloc(capacity,
+        sizeof(struct TranslationSlot));
+    if (slots == 0) {
+        return -1;
+    }
+
+    unsigned i;
+    for (i = 0; i < index->capacity; i++) {
+        if (index->slots[i].rule != 0) {
+            indexPlace(slots, capacity, index->slots[i].hash,
+                index->slots[i].rule);
+        }
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    return 0;
+}
+
+/**
+ * Adds a translation to an index unless its key is already there.
+ *
+ * @param state the translations the index refers to
+ * @param index the map to add the translation to
+ * @param rule the position of the translation in the pool
+ *
+ * @return const struct translate_msg* 0 if added, otherwise the translation
+ *         already using the key (or the new one itself if out of memory)
+ */
+static const struct translate_msg *indexInsert(const TranslatorState *state,
+    struct TranslationIndex *index, unsigned rule)
+{
+    const struct translate_msg *translation = getTranslation(state, rule);
+    const char *key = arenaString(&state->strings, translation->key);
+    const size_t keyLength = arenaLength(&state->strings, translation->key);
+    const uint32_t existing = indexLookup(state, index, key, keyLength);
+    if (existing != 0) {
+        return getTranslation(state, existing - 1);
+    }
+
+    if (indexReserve(index, index->count + 1) != 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory adding translation\n");
+        return translation;
+    }
+    indexPlace(index->slots, index->capacity,
+        hashKey(key, keyLength), rule + 1);
+    index->count++;
+    return 0;
+}
+
+/**
+ * Removes every key from an index, keeping its slot array for reuse.
+ */
+static void indexClear(struct TranslationIndex *index)
+{
+    if (index->slots != 0) {
+        memset(index->slots, 0,
+            index->capacity * sizeof(struct TranslationSlot));
+    }
+    index->count = 0;
+}
+
+/**
+ * Allocates an empty set of translations.  Each load or reload of the
+ * translation file fills a new one so the set in use is never modified.
+ *
+ * @param mapSize the number of translations to make room for up front
+ *
+ * @return TranslatorState* the new, empty set of translations
+ */
+TranslatorState *newTranslatorState(const unsigned short mapSize)
+{
+    TranslatorState *state = calloc(1, sizeof(TranslatorState));
+    if (state == 0) {
+        dieWithSystemMessage("calloc() of translator state failed");
+    }
+    initTranslations(state, mapSize);
+    return state;
+}
+
+/**
+ * Releases a set of translations allocated by newTranslatorState().
+ *
+ * @param state the set of translations, no longer used by anyone
+ */
+void deleteTranslatorState(TranslatorState *state)
+{
+    freeTranslations(state);
+    free(state);
+}
+
+/**
+ * Allocates zeroed usage counters sized for the translations loaded.  Without
+ * them translation still works, it just isn't counted.
+ */
+static void allocStats(TranslatorState *state)
+{
+    free(state->stats);
+    state->stats = calloc(1, sizeof(struct TranslationStats) +
+        state->translationCount * sizeof(uint64_t));
+    if (state->stats == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for translation counters\n");
+    }
+}
+
+/**
+ * Adds the translation on one line of a translation file.  A line ending in
+ * \r\n has the \r removed; any other \r also ends a line, as in files
+ * written with old Mac line endings.
+ *
+ * @param state the set of translations to add to
+ * @param line the start of the line, not nul terminated
+ * @param length the number of characters in the line, without the \n
+ * @param lineNumber the number of the line, advanced past it
  */
-TranslatorState *GetTranslatorState()
+static void loadTranslationLine(TranslatorState *state, const char *line,
+    size_t length, unsigned *lineNumber)
 {
-    static TranslatorState state;        
-    return &state;
+    char buf[MAX_LINE_SIZE];
+
+    if ((length > 0) && (line[length - 1] == '\r')) {
+        length--;
+    }
+
+    const char *const end = line + length;
+    do {
+        const char *cr = memchr(line, '\r', end - line);
+        const size_t pieceLength = ((cr == 0) ? end : cr) - line;
+
+        /* like readLine(), keep what fits and discard the excess */
+        const size_t copyLength = (pieceLength < sizeof(buf)) ?
+            pieceLength : sizeof(buf) - 1;
+        memcpy(buf, line, copyLength);
+        buf[copyLength] = '\0';
+        translate_add_mapping(state, buf, (*lineNumber)++);
+
+        line = (cr == 0) ? end : cr + 1;
+    } while (line < end);
 }
 
 /**
- * This function will possibly load the translation maps from a file.  Whether 
- * this occurrs or not depends on the file's modification time and the time 
- * argument passed in. 
- *  
- * Typical use is to do the initial load by passing in 0 as the lastModTime 
- * then using the return value the next time the function is called.  This way 
- * the translations will be reloaded only if the file has been modified. 
+ * This function loads the translation maps from a file.  The state should be 
+ * freshly allocated; a reload builds a new state and publishes it only if 
+ * this function succeeds, so a failed load never becomes visible. 
+ * 
+ * The file is either a text translation file or an image compiled from one 
+ * by tio-compile, which is read into memory as it is rather than parsed. 
  * 
- * @param state the program's set of translations, etc.
+ * @param state the set of translations to fill
  * @param filePath the file system path name to the file containing the 
  *                 translations to be loaded
- * @param lastModTime the time of the previous check for reloading the 
- *                    translations; this can be 0 to force the load to take
- *                    place
  * 
- * @return time_t the modification time of the file specified by filePath
+ * @return int 0 if the file was loaded, -1 if it couldn't be read
  */
-time_t loadTranslations(TranslatorState *state, const char* filePath,
-    time_t lastModTime)
+int loadTranslations(TranslatorState *state, const char* filePath)
 {
-	int inputFd;
-	int numRead = 0;
-	char buf[MAX_LINE_SIZE];
-    struct stat filestat;
-
-    int doReload = 0;
-    if (stat(filePath, &filestat) != 0) {
-        perror("stat() failed");
-        memset(&filestat, 0, sizeof(filestat));
-        doReload = 1;
-    } else {
-        doReload = filestat.st_mtime > lastModTime;
+    const int inputFd = open(filePath, O_RDONLY);
+    if (inputFd == -1) {
+        LogMsg(LOG_ERR, "[TIO] error opening file %s\n", filePath);
+        return -1;
     }
 
-    if (doReload) {
-        inputFd = open(filePath, O_RDONLY);
-        if (inputFd == -1) {
-            LogMsg(LOG_ERR, "[TIO] error opening file %s\n", filePath);
-            return 0;
+    if (isTranslationImage(inputFd)) {
+        const int rv = loadTranslationImage(state, inputFd, filePath);
+        close(inputFd);
+        if (rv == 0) {
+            allocStats(state);
         }
+        return rv;
+    }
 
-        /* remove all current translations */
-        translate_reset_mapping(state);
+    char *block = malloc(LOAD_BLOCK_SIZE);
+    if (block == 0) {
+        close(inputFd);
+        LogMsg(LOG_ERR, "[TIO] out of memory reading file %s\n", filePath);
+        return -1;
+    }
+
+    /* remove all current translations */
+    translate_reset_mapping(state);
+
+    /*
+     * Read the file in large blocks and split each one into lines.  A line
+     * which runs past the end of a block is moved to the front to be
+     * completed by the next read.
+     */
+    unsigned lineNumber = 1;
+    size_t pending = 0;
+    int skipping = 0;
+    ssize_t numRead;
+    for (;;) {
+        numRead = read(inputFd, block + pending, LOAD_BLOCK_SIZE - pending);
+        if (numRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
 
-        unsigned lineNumber = 1;
-        while ((numRead = readLine(inputFd, buf, MAX_LINE_SIZE)) > 0) {
-            //Check for windows cr
-            if (buf[strlen(buf) -1] == '\r')
-                buf[strlen(buf) - 1] = 0;
-            translate_add_mapping(state, buf, lineNumber++);
+        const char *line = block;
+        const char *const end = block + pending + numRead;
+        if (numRead == 0) {
+            /* the last line needn't have a terminator */
+            if ((pending > 0) && !skipping) {
+                loadTranslationLine(state, line, pending, &lineNumber);
+            }
+            break;
         }
 
-        if (numRead == -1)
-            dieWithSystemMessage("read()");
+        const char *newline;
+        while ((newline = memchr(line, '\n', end - line)) != 0) {
+            if (!skipping) {
+                loadTranslationLine(state, line, newline - line, &lineNumber);
+            } else {
+                /* the rest of a line too long to use */
+                skipping = 0;
+                lineNumber++;
+            }
+            line = newline + 1;
+        }
 
-        if (close(inputFd) == -1) {
-            dieWithSystemMessage("error closing file");
+        pending = end - line;
+        if (pending == LOAD_BLOCK_SIZE) {
+            const char *cr = memrchr(line, '\r', pending);
+            if (cr != 0) {
+                /* lines ended by \r alone */
+                if (!skipping) {
+                    loadTranslationLine(state, line, cr - line, &lineNumber);
+                }
+                skipping = 0;
+                line = cr + 1;
+                pending = end - line;
+                memmove(block, line, pending);
+            } else {
+                /* no terminator in a whole block; use the start, drop the rest */
+                if (!skipping) {
+                    loadTranslationLine(state, line, pending, &lineNumber);
+                    lineNumber--;
+                    skipping = 1;
+                }
+                pending = 0;
+            }
+        } else if (line != block) {
+            memmove(block, line, pending);
         }
+    }
 
-        LogMsg(LOG_INFO, "[TIO] loaded translation file \"%s\"\n", filePath);
+    free(block);
+    close(inputFd);
+    if (numRead == -1) {
+        LogMsg(LOG_ERR, "[TIO] error reading file %s, errno = %d\n",
+            filePath, errno);
+        return -1;
     }
 
-    return filestat.st_mtime;
+    trieBuild(state, &state->guiTrie, "GUI");
+    trieBuild(state, &state->microTrie, "micro");
+    dfaBuild(state, &state->guiDfa, "GUI");
+    dfaBuild(state, &state->microDfa, "micro");
+    allocStats(state);
+    LogMsg(LOG_INFO, "[TIO] loaded translation file \"%s\"\n", filePath);
+    return 0;
 }
 
 /**
@@ -181,6 +727,14 @@ void translate_add_mapping(TranslatorState *state, const char *msg,
      *
      *  * The key can contain a "setter" of the form "=%d" or "=%s" which
      *    allows for numeric or string substitutions into the message.
+     *
+     *    A * in the key makes a wildcard rule matching any text there,
+     *    e.g. G:meter*.value=%d.  The message gets the text matched in
+     *    place of %*.
+     *
+     *    A key starting with ~ is a pattern rule: the rest of the key is
+     *    a pattern the whole key must match, e.g. G:~CH[0-9][0-9]:TEMP=%d.
+     *    See translate_dfa.c for the syntax.
      */
 
     /* find all the delimiters */
@@ -206,13 +760,25 @@ void translate_add_mapping(TranslatorState *state, const char *msg,
 
     /* check for default */
     if (key[0] == '%') {
+        char defaultMsg[MAX_LINE_SIZE];
+        const int length = snprintf(defaultMsg, sizeof(defaultMsg), "%s\n",
+            message);
+        const size_t defaultLength = (length < sizeof(defaultMsg)) ?
+            length : sizeof(defaultMsg) - 1;
+
         switch (*origin) {
         case FROM_GUI:
-            snprintf(state->microDefault, MAX_LINE_SIZE, "%s\n", message);
+            state->guiDefault = arenaAdd(&state->strings, defaultMsg,
+                defaultLength);
+            state->guiDefaultOutput = compileTemplate(state,
+                state->guiDefault);
             break;
 
         case FROM_MICRO:
-            snprintf(state->microDefault, MAX_LINE_SIZE, "%s\n", message);
+            state->microDefault = arenaAdd(&state->strings, defaultMsg,
+                defaultLength);
+            state->microDefaultOutput = compileTemplate(state,
+                state->microDefault);
             break;
 
         default:
@@ -222,173 +788,233 @@ void translate_add_mapping(TranslatorState *state, const char *msg,
         return;
     }
 
-    /* allocate a translation from array of them if any left */
-    if (state->translationCount >= maxMappingSize) {
-        static int errorPrinted = 0;
-        if (!errorPrinted) {
-            LogMsg(LOG_ERR,
-                "[TIO] too many translation rules, maximum of %d allowed\n",
-                maxMappingSize);
-            errorPrinted = 1;
-        }
-    } else {
-        struct translate_msg *translation =
-            &state->translations[state->translationCount++];
-
-        /* clear the key and message */
-        memset(translation, 0, sizeof(struct translate_msg));
-
-        /* set line number */
-        translation->lineNumber = lineNumber;
-
-        /* check for = in the key and make sure we have more than just an = */
-        setter = strstr(key, "=");
-        if (setter != NULL && strlen(setter) > 2) {
-            /* look at the setter to see if it is a format specifier */
-            if (setter[1] == '%') {
-                /* we have a setter so remove the specifier from the key */
-                safe_strncpy(translation->key, key, setter - key + 2);
-                switch (setter[2]) {
-                case 's':
-                    translation->fmt_spec = SPEC_STRING; break;
-                case 'd':
-                    translation->fmt_spec = SPEC_INTEGER; break;
-                }
-                /* we need to find the format specifier */
-            } else {
-                /* the setter is a string so just copy the full key */
-                safe_strncpy(translation->key, key, strlen(key) + 1);
+    /* allocate a translation from the pool, growing it if needed */
+    struct translate_msg *translation = allocTranslation(state);
+    if (translation == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for translation on line %d\n",
+            lineNumber);
+        return;
+    }
+
+    /* clear the key and message */
+    memset(translation, 0, sizeof(struct translate_msg));
+
+    /* set line number */
+    translation->lineNumber = lineNumber;
+
+    /* check for = in the key and make sure we have more than just an = */
+    size_t keyLength = strlen(key);
+    setter = strstr(key, "=");
+    if (setter != NULL && strlen(setter) > 2) {
+        /* look at the setter to see if it is a format specifier */
+        if (setter[1] == '%') {
+            /* we have a setter so remove the specifier from the key */
+            keyLength = setter - key + 1;
+            switch (setter[2]) {
+            case 's':
+                translation->fmt_spec = SPEC_STRING; break;
+            case 'd':
+                translation->fmt_spec = SPEC_INTEGER; break;
             }
-        } else {
-            /* copy over full key */
-            safe_strncpy(translation->key, key, strlen(key) + 1);
         }
+        /* else the setter is a string so keep the full key */
+    }
 
-        /* copy the message over */
-        snprintf(translation->msg, sizeof(translation->msg), "%s", message);
+    /* a ~ makes it a pattern rule, failing that a * a wildcard rule */
+    const int pattern = (key[0] == '~');
+    const char *star = memchr(key, '*', keyLength);
+    if (!pattern && (star != 0)) {
+        translation->wildcard = star - key + 1;
+    }
 
-        /* add message to map */
-        const char *mapName = 0;
-        struct rbtree *map = 0;
-        switch (*origin) {
-        case FROM_GUI:
-            mapName = "GUI";
-            map = &state->guiTranslationMap;
-            break;
+    /* copy the key and message into the arena, noting where they start */
+    const size_t stringsSize = state->strings.size;
+    const unsigned segmentCount = state->segmentCount;
+    translation->key = arenaAdd(&state->strings, key, keyLength);
+    translation->msg = arenaAdd(&state->strings, message,
+        strlen(message));
+    translation->output = compileTemplate(state, translation->msg);
 
-        case FROM_MICRO:
-            mapName = "micro";
-            map = &state->microTranslationMap;
-            break;
-        }
-        const struct rbtree_node *ret = rbtree_insert(&translation->node, map);
-        if (ret != 0) {
-            const struct translate_msg *originalNode = rbtree_container_of(ret,
-                struct translate_msg, node);
+    /* add message to map */
+    const char *mapName = 0;
+    struct TranslationIndex *map = 0;
+    struct TranslationTrie *trie = 0;
+    struct TranslationDfa *dfa = 0;
+    switch (*origin) {
+    case FROM_GUI:
+        mapName = "GUI";
+        map = &state->guiTranslationMap;
+        trie = &state->guiTrie;
+        dfa = &state->guiDfa;
+        break;
+
+    case FROM_MICRO:
+        mapName = "micro";
+        map = &state->microTranslationMap;
+        trie = &state->microTrie;
+        dfa = &state->microDfa;
+        break;
+    }
+    if (map == 0) {
+        /* unknown origin, give the translation and its text back */
+        state->translationCount--;
+        state->strings.size = stringsSize;
+        state->segmentCount = segmentCount;
+        return;
+    }
+    if (pattern) {
+        /* the patterns are compiled, and checked, once the file is read */
+        dfaAddRule(dfa, state->translationCount - 1);
+        return;
+    }
+    if (translation->wildcard != 0) {
+        /* the trie is built, and duplicates found, once the file is read */
+        trieAddRule(trie, state->translationCount - 1);
+        return;
+    }
+    const struct translate_msg *originalNode = indexInsert(state, map,
+        state->translationCount - 1);
+    if (originalNode != 0) {
+        if (originalNode != translation) {
             LogMsg(LOG_ERR, "[TIO] translation for key \"%s\" on line %d in %s map "
                 "already defined on line %d.\n", key, lineNumber, mapName,
                 originalNode->lineNumber);
         }
+        state->translationCount--;
+        state->strings.size = stringsSize;
+        state->segmentCount = segmentCount;
+    }
+
+}
+
+/**
+ * Copies a message which need not be nul terminated, truncating it if
+ * necessary.  The copy is nul terminated.
+ *
+ * @return size_t the number of characters copied, not counting the nul
+ */
+static size_t copyMessage(char *outMsg, size_t outMsgSize, const char *msg,
+    size_t length)
+{
+    if (length >= outMsgSize) {
+        length = outMsgSize - 1;
     }
+    memcpy(outMsg, msg, length);
+    outMsg[length] = '\0';
+    return length;
 }
 
 /**
  * Provides a translated message out from an input line. If the key part of the 
- * input message matches a key in the specified tree, the message from the map 
- * is substituted.  If no match is found, then the default message (if defined) 
- * is returned.  If the default message is zero length, the input message is 
+ * input message matches a key in the specified map, the message from the map 
+ * is substituted, failing that the message of the longest matching wildcard 
+ * rule, failing that the message of the first matching pattern rule.  If no
+ * match is found, then the default message (if defined) is 
+ * returned.  If the default message is zero length, the input message is 
  * returned, unchanged, in the output message. 
  * 
- * @param inMsg the message to be translated
+ * @param state the program's set of translations
+ * @param inMsg the message to be translated, need not be nul terminated
+ * @param inLength the number of characters in inMsg
  * @param outMsg the translated message
  * @param outMsgSize the number of characters available at outMsg
  * @param map the map to search for the message key
- * @param defaultMsg the message to use as default if the map doesn't have a 
- *                   match
+ * @param trie the wildcard rules to try if the map has no match
+ * @param dfa the pattern rules to try if no wildcard rule matches
+ * @param defaultMsg the arena offset of the message to use as default if the 
+ *                   map doesn't have a match
+ * @param defaultOutput the default message compiled into a template
+ * @param source TIO_TRACE_FROM_GUI or TIO_TRACE_FROM_MICRO, for tracing
+ *
+ * @return size_t the length of the translated message
  */
-static void translate_msg(const char* inMsg, char* outMsg, size_t outMsgSize,
-    const struct rbtree *map, const char *defaultMsg)
+static size_t translate_msg(const TranslatorState *state, const char* inMsg,
+    size_t inLength, char* outMsg, size_t outMsgSize,
+    const struct TranslationIndex *map, const struct TranslationTrie *trie,
+    const struct TranslationDfa *dfa, uint32_t defaultMsg, struct TemplateRef defaultOutput, unsigned source)
 {
-    char *setter, *end_msg = 0;
-    int value;
-    Boolean has_value = FALSE;
-    char message[MAX_LINE_SIZE];
-    char tmp[MAX_LINE_SIZE];
-
     /* check for empty message */
-    if (inMsg == 0 || *inMsg == '\n' || *inMsg == '\r' || *inMsg == '\0') {
-        strncpy(outMsg, "\n", outMsgSize);
-        return;
+    if (inMsg == 0 || inLength == 0 || *inMsg == '\n' || *inMsg == '\r' ||
+        *inMsg == '\0') {
+        return copyMessage(outMsg, outMsgSize, "\n", 1);
     }
 
+    /* the message ends at a \n, if there is one */
+    const char *newline = memchr(inMsg, '\n', inLength);
+    const size_t msgLength = (newline == 0) ? inLength : (newline - inMsg);
+
     /* if we don't have any mappings bail */
-    if (rbtree_first(map) == 0) {
-        safe_strncpy(outMsg, inMsg, outMsgSize);
-        return;
+    struct TranslationStats *const stats = state->stats;
+    if ((map->count == 0) && (trie->nodeCount == 0) &&
+        (dfa->stateCount == 0)) {
+        if (stats != 0) {
+            statsIncrement(&stats->counts[source].untranslated);
+        }
+        LogTrace(TIO_TRACE_UNTRANSLATED, source, TIO_TRACE_NO_RULE, msgLength);
+        return copyMessage(outMsg, outMsgSize, inMsg, inLength);
     }
 
-    /* clear the message */
-    memset(message, 0, MAX_LINE_SIZE);
-
-    /* make a copy so strtok() can change the contents */
-    safe_strncpy(tmp, inMsg, sizeof(tmp));
+    /* see if we have a setter; if so the key includes the = */
+    const char *setter = memchr(inMsg, '=', msgLength);
+    const size_t keyLength = (setter == 0) ? msgLength : (setter - inMsg + 1);
 
-    /* see if we have a setter */
-    setter = strstr(tmp, "=");
-    if (setter == NULL) {
-        /* no setter so get up to the \n */
-        setter = strtok(tmp,"\n");
-        safe_strncpy(message, setter, sizeof(message));
-    } else {
-        strncpy(message, inMsg, strlen(inMsg) - strlen(setter) + 1);
-        /* incr pointer to get past the = */
-        setter++;
-        end_msg = strtok(setter,"\n");
-        has_value = TRUE;
-    }
-
-    /* look for the key in the map */
-    struct translate_msg searchKey;
-    strncpy(searchKey.key, message, sizeof(searchKey.key));
-    const struct rbtree_node *node = rbtree_lookup(&searchKey.node, map);
-    if (node == 0) {
+    /* look for the key in the map, then among the wildcard and pattern rules */
+    size_t captureStart = 0;
+    size_t captureLength = 0;
+    uint32_t rule = indexLookup(state, map, inMsg, keyLength);
+    if (rule == 0) {
+        rule = trieLookup(state, trie, inMsg, keyLength, &captureStart,
+            &captureLength);
+    }
+    if (rule == 0) {
+        rule = dfaLookup(dfa, inMsg, keyLength);
+    }
+    if (rule == 0) {
         /* not found; use the default */
-        if (strlen(defaultMsg) > 0) {
+        if (arenaLength(&state->strings, defaultMsg) > 0) {
             LogMsg(LOG_INFO, "[TIO] sending default message\n");
-            sprintf(outMsg, defaultMsg, tmp);
+            if (stats != 0) {
+                statsIncrement(&stats->counts[source].defaulted);
+            }
+            LogTrace(TIO_TRACE_DEFAULT, source, TIO_TRACE_NO_RULE, keyLength);
+            return renderTemplate(state, defaultOutput, inMsg, msgLength,
+                0, 0, outMsg, outMsgSize);
         } else {
             LogMsg(LOG_INFO, "[TIO] sending untranslated message\n");
-            safe_strncpy(outMsg, inMsg, outMsgSize);
+            if (stats != 0) {
+                statsIncrement(&stats->counts[source].untranslated);
+            }
+            LogTrace(TIO_TRACE_UNTRANSLATED, source, TIO_TRACE_NO_RULE,
+                keyLength);
+            return copyMessage(outMsg, outMsgSize, inMsg, inLength);
         }
     } else {
         /* translation found in map, format outMsg accordingly */
-        const struct translate_msg *translation =
-            rbtree_container_of(node, struct translate_msg, node);
-
-        LogMsg(LOG_INFO, "[TIO] found key => \"%s\"; returning => \"%s\"\n", translation->key,
+        const struct translate_msg *translation = getTranslation(state,
+            rule - 1);
+        const char *translationMsg = arenaString(&state->strings,
             translation->msg);
+        LogMsg(LOG_INFO, "[TIO] found key => \"%s\"; returning => \"%s\"\n",
+            arenaString(&state->strings, translation->key), translationMsg);
+        LogTrace(TIO_TRACE_FOUND_KEY, source, rule - 1, keyLength);
+        if (stats != 0) {
+            statsIncrement(&stats->counts[source].found);
+            statsIncrement(&stats->hits[rule - 1]);
+        }
 
-        if (has_value) {
-            switch (translation->fmt_spec) {
-            case SPEC_INTEGER:
-                value = atoi(end_msg);
-                snprintf(outMsg, outMsgSize, translation->msg, value);
-                break;
-
-            case SPEC_STRING:
-                snprintf(outMsg, outMsgSize, translation->msg, end_msg);
-                break;
-
-            case SPEC_NONE:
-            default:
-                /* TODO: can we even get here? */
-                safe_strncpy(outMsg, translation->msg, outMsgSize);
-                break;
-            }
+        const char *capture = inMsg + captureStart;
+        if ((setter != 0) && (translation->fmt_spec != SPEC_NONE)) {
+            return renderTemplate(state, translation->output,
+                inMsg + keyLength, msgLength - keyLength, capture,
+                captureLength, outMsg, outMsgSize);
+        } else if (translation->wildcard != 0) {
+            /* no value, but there may be a %* */
+            return renderTemplate(state, translation->output, "", 0, capture,
+                captureLength, outMsg, outMsgSize);
         } else {
-            safe_strncpy(outMsg, translation->msg, outMsgSize);
+            return copyMessage(outMsg, outMsgSize, translationMsg,
+                arenaLength(&state->strings, translation->msg));
         }
-        return;
     }
 }
 
@@ -398,14 +1024,18 @@ static void translate_msg(const char* inMsg, char* outMsg, size_t outMsgSize,
  * 
  * @param state the program's set of translations
  * @param inMsg the message from the GUI to be translated
+ * @param inLength the number of characters in inMsg
  * @param outMsg a buffer into which a translated message is to be written
  * @param outMsgSize the maximum length of the output message
+ *
+ * @return size_t the length of the translated message
  */
-void translate_gui_msg(const TranslatorState *state, const char* inMsg,
-    char* outMsg, size_t outMsgSize)
+size_t translate_gui_msg(const TranslatorState *state, const char* inMsg,
+    size_t inLength, char* outMsg, size_t outMsgSize)
 {
-    translate_msg(inMsg, outMsg, outMsgSize, &state->guiTranslationMap,
-        state->guiDefault);
+    return translate_msg(state, inMsg, inLength, outMsg, outMsgSize,
+        &state->guiTranslationMap, &state->guiTrie, &state->guiDfa,
+        state->guiDefault, state->guiDefaultOutput, TIO_TRACE_FROM_GUI);
 }
 
 /**
@@ -414,61 +1044,107 @@ void translate_gui_msg(const TranslatorState *state, const char* inMsg,
  * 
  * @param state the program's set of translations
  * @param inMsg the message from the microcontroller to be translated
+ * @param inLength the number of characters in inMsg
  * @param outMsg a buffer into which a translated message is to be written
  * @param outMsgSize the maximum length of the output message
+ *
+ * @return size_t the length of the translated message
  */
-void translate_micro_msg(const TranslatorState *state, const char* inMsg,
-    char* outMsg, size_t outMsgSize)
+size_t translate_micro_msg(const TranslatorState *state, const char* inMsg,
+    size_t inLength, char* outMsg, size_t outMsgSize)
 {
-    translate_msg(inMsg, outMsg, outMsgSize, &state->microTranslationMap,
-        state->microDefault);
+    return translate_msg(state, inMsg, inLength, outMsg, outMsgSize,
+        &state->microTranslationMap, &state->microTrie, &state->microDfa,
+        state->microDefault, state->microDefaultOutput, TIO_TRACE_FROM_MICRO);
 }
 
 /**
- * Removes all translations.
- * 
- * @param state the program's set of translations which is to be cleared to 
- *              contain none
+ * Writes the usage counters of a set of translations as "name value" lines,
+ * followed by a "rule <index> <line> <hits> <key>" line for every rule used
+ * at least once.  The counters start from zero each time the translations are
+ * loaded.
+ *
+ * @param state the program's set of translations
+ * @param out where to write
  */
-void translate_reset_mapping(TranslatorState *state)
+void writeTranslationStats(const TranslatorState *state, FILE *out)
 {
-    state->translationCount = 0;
-    state->guiDefault[0] = '\0';
-    state->microDefault[0] = '\0';
-    rbtree_init(&state->guiTranslationMap, compareTranslations, 0);
-    rbtree_init(&state->microTranslationMap, compareTranslations, 0);
+    fprintf(out, "translations %u\n", state->translationCount);
+    const struct TranslationStats *stats = state->stats;
+    if (stats == 0) {
+        return;
+    }
+
+    static const char *const names[] = { "gui", "micro" };
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        const struct TranslationCounts *counts = &stats->counts[i];
+        fprintf(out, "%s.found %llu\n%s.default %llu\n%s.untranslated %llu\n",
+            names[i], (unsigned long long)statsRead(&counts->found),
+            names[i], (unsigned long long)statsRead(&counts->defaulted),
+            names[i], (unsigned long long)statsRead(&counts->untranslated));
+    }
+
+    for (i = 0; i < state->translationCount; i++) {
+        const uint64_t hits = statsRead(&stats->hits[i]);
+        if (hits > 0) {
+            const struct translate_msg *translation = getTranslation(state, i);
+            fprintf(out, "rule %u %u %llu %s\n", i, translation->lineNumber,
+                (unsigned long long)hits,
+                arenaString(&state->strings, translation->key));
+        }
+    }
 }
 
 /**
- * This function is called by the red/black tree library functions during node 
- * insertion and lookups. 
- * 
- * @param first one of the two nodes to be compared
- * @param second the other node to which the first is to be compared
+ * Removes all translations.
  * 
- * @return int <0 if first < second, >0 if first > second and 0 if first == 
- *         second
+ * @param state the program's set of translations which is to be cleared to 
+ *              contain none
  */
-int compareTranslations(const struct rbtree_node *first,
-    const struct rbtree_node *second)
+void translate_reset_mapping(TranslatorState *state)
 {
-    const char *str1 = rbtree_container_of(first, struct translate_msg, node)->key;
-    const char *str2 = rbtree_container_of(second, struct translate_msg, node)->key;
-    return strcmp(str1, str2);
+    state->translationCount = 0;
+    state->guiDefault = ARENA_EMPTY;
+    state->microDefault = ARENA_EMPTY;
+    memset(&state->guiDefaultOutput, 0, sizeof(struct TemplateRef));
+    memset(&state->microDefaultOutput, 0, sizeof(struct TemplateRef));
+    state->segmentCount = 0;
+    free(state->stats);
+    state->stats = 0;
+    arenaReset(&state->strings);
+    indexClear(&state->guiTranslationMap);
+    indexClear(&state->microTranslationMap);
+    trieClear(&state->guiTrie);
+    trieClear(&state->microTrie);
+    dfaClear(&state->guiDfa);
+    dfaClear(&state->microDfa);
 }
 
 /**
- * This function allocates memory for a variable number of translations.
+ * This function preallocates memory for translations.  The pool and indexes
+ * grow as needed when a file has more translations than this.
  *
  * @param state the program's set of translations
- * @param mapSize number to set total mappings in the translate file
+ * @param mapSize the number of translations to make room for up front
  *
  */
-void initTranslations(TranslatorState *state, const unsigned short mapSize)
+static void initTranslations(TranslatorState *state,
+    const unsigned short mapSize)
 {
-    state->translations = malloc(mapSize * sizeof(struct translate_msg));
-    maxMappingSize = mapSize;
-    LogMsg(LOG_INFO, "[TIO] translations size set to %d\n", maxMappingSize);
+    if (reserveTranslations(state, mapSize) != 0) {
+        dieWithSystemMessage("malloc() of translations failed");
+    }
+
+    /* start with the empty string so the defaults have something to refer to */
+    arenaReset(&state->strings);
+
+    /* size the indexes so a full map never has to rehash */
+    if ((indexReserve(&state->guiTranslationMap, mapSize) != 0) ||
+        (indexReserve(&state->microTranslationMap, mapSize) != 0)) {
+        dieWithSystemMessage("malloc() of translation index failed");
+    }
+    LogMsg(LOG_INFO, "[TIO] translations preallocated for %d\n", mapSize);
 }
 
 /**
@@ -479,6 +1155,40 @@ void initTranslations(TranslatorState *state, const unsigned short mapSize)
  */
 void freeTranslations(TranslatorState *state)
 {
-    free(state->translations);
+    if (state->image != 0) {
+        /* everything but the chunk table lives in the image's block */
+        free(state->image);
+        state->image = 0;
+        state->imageSize = 0;
+    } else {
+        unsigned i;
+        for (i = 0; i < state->chunkCount; i++) {
+            free(state->translationChunks[i]);
+        }
+        free(state->strings.data);
+        free(state->guiTranslationMap.slots);
+        free(state->microTranslationMap.slots);
+        free(state->segments);
+        trieFree(&state->guiTrie);
+        trieFree(&state->microTrie);
+        dfaFree(&state->guiDfa);
+        dfaFree(&state->microDfa);
+    }
+    state->segments = 0;
+    state->segmentCount = 0;
+    state->segmentCapacity = 0;
+    free(state->stats);
+    state->stats = 0;
+    free(state->translationChunks);
+    state->translationChunks = 0;
+    state->chunkCount = 0;
+    state->translationCount = 0;
+    memset(&state->strings, 0, sizeof(struct StringArena));
+    memset(&state->guiTranslationMap, 0, sizeof(struct TranslationIndex));
+    memset(&state->microTranslationMap, 0, sizeof(struct TranslationIndex));
+    memset(&state->guiTrie, 0, sizeof(struct TranslationTrie));
+    memset(&state->microTrie, 0, sizeof(struct TranslationTrie));
+    memset(&state->guiDfa, 0, sizeof(struct TranslationDfa));
+    memset(&state->microDfa, 0, sizeof(struct TranslationDfa));
     LogMsg(LOG_INFO, "[TIO] translations free()\n");
 }
@@ -8,10 +8,8 @@
 #ifndef TRANSLATE_PARSER_H_
 #define TRANSLATE_PARSER_H_
 
-#include <time.h>
-
-/* definitions for open source lib_tree */
-#include "libtree.h"
+#include <stddef.h>
+#include <stdio.h>
 
 #define MAX_MSG_MAP_SIZE 400
 #define MAX_LINE_SIZE 2048
@@ -34,12 +32,14 @@ typedef enum { SPEC_NONE, SPEC_STRING, SPEC_INTEGER } format_spec;
 
 typedef struct TranslatorState TranslatorState;
 
-TranslatorState *GetTranslatorState();
-time_t loadTranslations(TranslatorState *state, const char* path,
-    time_t lastModTime);
-void translate_gui_msg(const TranslatorState *state, const char* inMsg,
-    char* outMsg, size_t outMsgSize);
-void translate_micro_msg(const TranslatorState *state, const char* inMsg,
-    char* outMsg, size_t outMsgSize);
+TranslatorState *newTranslatorState(const unsigned short mapSize);
+void deleteTranslatorState(TranslatorState *state);
+int loadTranslations(TranslatorState *state, const char* path);
+int saveTranslations(const TranslatorState *state, const char *path);
+size_t translate_gui_msg(const TranslatorState *state, const char* inMsg,
+    size_t inLength, char* outMsg, size_t outMsgSize);
+size_t translate_micro_msg(const TranslatorState *state, const char* inMsg,
+    size_t inLength, char* outMsg, size_t outMsgSize);
+void writeTranslationStats(const TranslatorState *state, FILE *out);
 
 #endif /* TRANSLATE_PARSER_H_ */
@@ -0,0 +1,362 @@
+/*
+ * translate_pipeline.c
+ *
+ * Worker threads translating messages for the event loop.  Each direction
+ * has a stage: a ring of lines for its worker, a ring of translations coming
+ * back and an eventfd the worker sleeps on.  Lines and translations travel
+ * as TioMsgBufs; a buffer belongs to whichever side last took it out of a
+ * ring, so the reference counts are never touched by two threads at once.
+ *
+ * The event loop wakes a worker once per pass for all the lines it pushed
+ * (tioPipelineKick()), and the workers wake the event loop through a shared
+ * eventfd once per batch they translate.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_parser.h"
+#include "translate_pipeline.h"
+#include "translate_reload.h"
+
+/**
+ * Single producer, single consumer ring of buffers.  The producer only
+ * writes tail and the consumer only head; they are kept on separate cache
+ * lines so the two threads don't contend for one.
+ */
+struct TioRing
+{
+    struct TioMsgBuf *slots[TIO_PIPELINE_RING_SIZE];
+    _Atomic size_t tail __attribute__((aligned(64)));
+    _Atomic size_t head __attribute__((aligned(64)));
+};
+
+/**
+ * One direction's worker and the rings connecting it to the event loop.
+ */
+struct TioPipelineStage
+{
+    unsigned source;
+    const char *terminator;
+    size_t (*translate)(const TranslatorState *state, const char *inMsg,
+        size_t inLength, char *outMsg, size_t outMsgSize);
+
+    struct TioRing lines;           /* from the event loop */
+    struct TioRing translations;    /* back to the event loop */
+
+    /* the worker sleeps on wakeFd while it has no lines */
+    int wakeFd;
+    int pushed;     /* lines pushed since the last kick, event loop only */
+
+    struct TioReloadReader reader;
+    pthread_t thread;
+    int running;
+
+    /* scratch space for one translated message */
+    char *outMsg;
+};
+
+static struct TioPipelineStage stages[2];
+static size_t outMsgSize;
+
+/* written by the workers when they have translations ready */
+static int doneFd = -1;
+static atomic_int stopping;
+
+static TioPipelineHandler handler;
+static void *handlerContext;
+
+static void tioRingInit(struct TioRing *ring)
+{
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->head, 0);
+}
+
+/**
+ * Adds a buffer at the tail of the ring.  Producer only.
+ *
+ * @return int 0 on success, -1 if the ring is full
+ */
+static int tioRingPush(struct TioRing *ring, struct TioMsgBuf *buf)
+{
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if ((tail - atomic_load_explicit(&ring->head, memory_order_acquire)) ==
+        TIO_PIPELINE_RING_SIZE) {
+        return -1;
+    }
+
+    ring->slots[tail & (TIO_PIPELINE_RING_SIZE - 1)] = buf;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Takes the buffer at the head of the ring.  Consumer only.
+ *
+ * @return struct TioMsgBuf* the buffer or 0 if the ring is empty
+ */
+static struct TioMsgBuf *tioRingPop(struct TioRing *ring)
+{
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+        return 0;
+    }
+
+    struct TioMsgBuf *buf = ring->slots[head & (TIO_PIPELINE_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return buf;
+}
+
+/**
+ * Drops whatever is left in a ring.  Only once neither side is running.
+ */
+static void tioRingClear(struct TioRing *ring)
+{
+    struct TioMsgBuf *buf;
+    while ((buf = tioRingPop(ring)) != 0) {
+        tioMsgBufUnref(buf);
+    }
+}
+
+/**
+ * Hands a translation back to the event loop, waiting for room if its ring
+ * is full.  The event loop is always draining it, unless shutting down.
+ *
+ * @return int 0 on success, -1 if the pipeline is stopping
+ */
+static int tioPipelineReturn(struct TioPipelineStage *stage,
+    struct TioMsgBuf *buf)
+{
+    while (tioRingPush(&stage->translations, buf) != 0) {
+        if (atomic_load(&stopping)) {
+            return -1;
+        }
+        eventfd_write(doneFd, 1);
+        sched_yield();
+    }
+    return 0;
+}
+
+static void *tioPipelineWorker(void *arg)
+{
+    struct TioPipelineStage *stage = arg;
+
+    while (!atomic_load(&stopping)) {
+        eventfd_t count;
+        if (eventfd_read(stage->wakeFd, &count) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LogMsg(LOG_ERR, "[TIO] translator eventfd_read() failed, "
+                "errno = %d\n", errno);
+            break;
+        }
+
+        int translated = 0;
+        struct TioMsgBuf *line;
+        while ((line = tioRingPop(&stage->lines)) != 0) {
+            const TranslatorState *state = tioReloadEnter(&stage->reader);
+            const size_t outLength = stage->translate(state, line->data,
+                line->length, stage->outMsg, outMsgSize);
+            tioReloadLeave(&stage->reader);
+
+            struct TioMsgBuf *buf = tioMsgBufCreate(stage->outMsg, outLength,
+                stage->terminator);
+            if (buf == 0) {
+                LogMsg(LOG_ERR, "[TIO] out of memory for translated message\n");
+            } else {
+                buf->received = line->received;
+                if (tioPipelineReturn(stage, buf) == 0) {
+                    translated = 1;
+                } else {
+                    tioMsgBufUnref(buf);
+                }
+            }
+            tioMsgBufUnref(line);
+        }
+
+        if (translated && (eventfd_write(doneFd, 1) != 0)) {
+            LogMsg(LOG_ERR, "[TIO] translator eventfd_write() failed, "
+                "errno = %d\n", errno);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Passes the translations the workers have finished to the handler.
+ */
+static void tioPipelineOnDone(int fd, unsigned events, void *context)
+{
+    eventfd_t count;
+    if (eventfd_read(fd, &count) != 0) {
+        return;
+    }
+
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        struct TioMsgBuf *buf;
+        while ((buf = tioRingPop(&stages[i].translations)) != 0) {
+            handler(stages[i].source, buf, handlerContext);
+            tioMsgBufUnref(buf);
+        }
+    }
+}
+
+static int tioPipelineStart(struct TioPipelineStage *stage, unsigned source,
+    const char *terminator, size_t (*translate)(const TranslatorState *,
+    const char *, size_t, char *, size_t))
+{
+    stage->source = source;
+    stage->terminator = terminator;
+    stage->translate = translate;
+    tioRingInit(&stage->lines);
+    tioRingInit(&stage->translations);
+
+    stage->outMsg = malloc(outMsgSize);
+    if (stage->outMsg == 0) {
+        return -1;
+    }
+    stage->wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (stage->wakeFd < 0) {
+        return -1;
+    }
+
+    tioReloadAddReader(&stage->reader);
+    const int rv = pthread_create(&stage->thread, 0, tioPipelineWorker, stage);
+    if (rv != 0) {
+        tioReloadRemoveReader(&stage->reader);
+        errno = rv;
+        return -1;
+    }
+    stage->running = 1;
+    return 0;
+}
+
+/**
+ * Starts a worker for each direction.  The event engine and the translations
+ * must already be initialized.
+ *
+ * @param size the number of characters a translated message may take
+ * @param onTranslated called with each translated message
+ * @param context passed to onTranslated
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioPipelineInit(size_t size, TioPipelineHandler onTranslated,
+    void *context)
+{
+    outMsgSize = size;
+    handler = onTranslated;
+    handlerContext = context;
+    atomic_init(&stopping, 0);
+
+    /* not yet started; tioPipelineClose() checks these */
+    stages[TIO_TRACE_FROM_GUI].wakeFd = -1;
+    stages[TIO_TRACE_FROM_MICRO].wakeFd = -1;
+
+    doneFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (doneFd < 0) {
+        return -1;
+    }
+    if (tioEventAdd(doneFd, TIO_EVENT_READ, tioPipelineOnDone, 0) != 0) {
+        return -1;
+    }
+
+    if ((tioPipelineStart(&stages[TIO_TRACE_FROM_GUI], TIO_TRACE_FROM_GUI,
+        "\r", translate_gui_msg) != 0) ||
+        (tioPipelineStart(&stages[TIO_TRACE_FROM_MICRO], TIO_TRACE_FROM_MICRO,
+        "\n", translate_micro_msg) != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stops the workers and drops any messages still in the pipeline.
+ */
+void tioPipelineClose(void)
+{
+    atomic_store(&stopping, 1);
+
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        struct TioPipelineStage *stage = &stages[i];
+        if (stage->running) {
+            eventfd_write(stage->wakeFd, 1);
+            pthread_join(stage->thread, 0);
+            stage->running = 0;
+            tioReloadRemoveReader(&stage->reader);
+        }
+        tioRingClear(&stage->lines);
+        tioRingClear(&stage->translations);
+        if (stage->wakeFd >= 0) {
+            close(stage->wakeFd);
+            stage->wakeFd = -1;
+        }
+        free(stage->outMsg);
+        stage->outMsg = 0;
+    }
+
+    if (doneFd >= 0) {
+        tioEventRemove(doneFd);
+        close(doneFd);
+        doneFd = -1;
+    }
+}
+
+/**
+ * Queues a line for its direction's worker.  The worker isn't woken until
+ * tioPipelineKick().
+ *
+ * @param source TIO_TRACE_FROM_GUI or TIO_TRACE_FROM_MICRO
+ * @param msg the line, need not be nul terminated
+ * @param length the number of characters in msg
+ * @param received when the line was read, see tioStatsNow()
+ *
+ * @return int 0 on success, -1 if the worker is too far behind or out of
+ *             memory
+ */
+int tioPipelinePush(unsigned source, const char *msg, size_t length,
+    uint64_t received)
+{
+    struct TioPipelineStage *stage = &stages[source];
+
+    struct TioMsgBuf *buf = tioMsgBufCreate(msg, length, 0);
+    if (buf == 0) {
+        return -1;
+    }
+    buf->received = received;
+    if (tioRingPush(&stage->lines, buf) != 0) {
+        tioMsgBufUnref(buf);
+        return -1;
+    }
+    stage->pushed = 1;
+    return 0;
+}
+
+/**
+ * Wakes the workers that have had lines pushed since the last call.
+ */
+void tioPipelineKick(void)
+{
+    unsigned i;
+    for (i = 0; i < 2; i++) {
+        struct TioPipelineStage *stage = &stages[i];
+        if (stage->running && stage->pushed) {
+            stage->pushed = 0;
+            if (eventfd_write(stage->wakeFd, 1) != 0) {
+                LogMsg(LOG_ERR, "[TIO] waking translator failed, errno = %d\n",
+                    errno);
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * translate_pipeline.h
+ *
+ * Optional translation off the event loop thread, one worker thread per
+ * direction.  The event loop hands each worker the lines it reads through a
+ * lock-free single producer, single consumer ring and gets the translated
+ * messages back through another, so a burst of traffic in one direction
+ * doesn't hold up the other.  The sockets and output queues stay with the
+ * event loop thread.
+ */
+
+#ifndef TRANSLATE_PIPELINE_H_
+#define TRANSLATE_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "translate_output.h"
+
+/* lines waiting in each ring, a power of two */
+#define TIO_PIPELINE_RING_SIZE 1024
+
+/**
+ * Called on the event loop thread with each translated message, in the order
+ * the lines were pushed.
+ *
+ * @param source TIO_TRACE_FROM_GUI or TIO_TRACE_FROM_MICRO
+ * @param buf the message and its terminator, with received set from the
+ *            line; referenced only for the duration of the call
+ * @param context as passed to tioPipelineInit()
+ */
+typedef void (*TioPipelineHandler)(unsigned source, struct TioMsgBuf *buf,
+    void *context);
+
+int tioPipelineInit(size_t outMsgSize, TioPipelineHandler handler,
+    void *context);
+void tioPipelineClose(void);
+int tioPipelinePush(unsigned source, const char *msg, size_t length,
+    uint64_t received);
+void tioPipelineKick(void);
+
+#endif /* TRANSLATE_PIPELINE_H_ */
@@ -0,0 +1,479 @@
+/*
+ * translate_reload.c
+ *
+ * Double buffered loading of the translation file.  A reload runs on a
+ * helper thread which builds a complete new set and swaps it in atomically;
+ * the set it replaced is handed back to the event loop thread through an
+ * eventfd and freed there.  The event loop only holds on to a set while a
+ * handler runs, so by the time it handles the eventfd it doesn't refer to
+ * the old set any more.
+ *
+ * Other threads translating messages register as readers.  Each swap starts
+ * a new epoch, and a reader records the epoch whenever it fetches the set and
+ * clears it when done with it.  The replaced set is freed once no reader is
+ * still inside an earlier epoch; until then further reloads wait.
+ *
+ * Reloads are triggered by inotify(7).  Both the file and its directory are
+ * watched: the file for in-place writes and the directory for editors that
+ * write a new file and rename it over the old one.  If inotify isn't
+ * available the file's modification time is polled with a timerfd instead.
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_reload.h"
+
+static const char *path;
+static unsigned short mapSize;
+
+/* watching for changes: inotify descriptor and watches, or a polling timer */
+static int inotifyFd = -1;
+static int fileWatch = -1;
+static int dirWatch = -1;
+static char fileName[NAME_MAX + 1];
+static int pollTimerFd = -1;
+
+/* the published set of translations */
+static TranslatorState *_Atomic currentState;
+
+/* advanced by each swap of currentState */
+static _Atomic uint64_t reloadEpoch = 1;
+
+/* registered readers, only changed while none of them are running */
+static struct TioReloadReader *readers;
+
+/* signalled by the loader thread when it has finished */
+static int reloadFd = -1;
+
+/* only touched by the event loop thread */
+static pthread_t loaderThread;
+static int loaderRunning;
+static int reloadPending;
+static int reloadForced;
+
+/* written by the loader thread before it signals reloadFd */
+static time_t lastModTime;
+static TranslatorState *retiredState;
+static uint64_t retiredEpoch;
+
+/* read by the loader thread, set before it starts */
+static int loadForced;
+
+/**
+ * Reads the translation file into a new set of translations and publishes it
+ * if the file changed since the last successful load.  A forced load skips
+ * the modification time check, which only has one second resolution.
+ *
+ * @param arg unused
+ *
+ * @return void* always 0
+ */
+static void *tioReloadThread(void *arg)
+{
+    struct stat filestat;
+    if (stat(path, &filestat) != 0) {
+        LogMsg(LOG_ERR, "[TIO] stat() of %s failed, errno = %d\n", path,
+            errno);
+    } else if (loadForced || (filestat.st_mtime > lastModTime)) {
+        TranslatorState *state = newTranslatorState(mapSize);
+        if (loadTranslations(state, path) == 0) {
+            retiredState = atomic_exchange(&currentState, state);
+            retiredEpoch = atomic_fetch_add(&reloadEpoch, 1) + 1;
+            lastModTime = filestat.st_mtime;
+        } else {
+            LogMsg(LOG_ERR, "[TIO] reload of %s failed, keeping current "
+                "translations\n", path);
+            deleteTranslatorState(state);
+        }
+    }
+
+    if (eventfd_write(reloadFd, 1) != 0) {
+        dieWithSystemMessage("eventfd_write() failed");
+    }
+    return 0;
+}
+
+static void tioReloadStart(void)
+{
+    loadForced = reloadForced;
+    reloadPending = 0;
+    reloadForced = 0;
+    if (pthread_create(&loaderThread, 0, tioReloadThread, 0) != 0) {
+        LogMsg(LOG_ERR, "[TIO] could not start translation loader\n");
+        return;
+    }
+    loaderRunning = 1;
+}
+
+/**
+ * Collects a finished loader thread and frees the set of translations it
+ * replaced, if the readers are done with it.
+ */
+static void tioReloadOnDone(int fd, unsigned events, void *context)
+{
+    eventfd_t count;
+    if ((eventfd_read(fd, &count) != 0) || !loaderRunning) {
+        return;
+    }
+
+    pthread_join(loaderThread, 0);
+    loaderRunning = 0;
+    tioReloadCollect();
+}
+
+static void tioReloadRequestForced(void)
+{
+    reloadForced = 1;
+    tioReloadRequest();
+}
+
+/**
+ * (Re)starts watching the file itself.  Needed after the file is replaced
+ * since the old watch follows the old inode.
+ */
+static void tioReloadWatchFile(void)
+{
+    if (fileWatch >= 0) {
+        inotify_rm_watch(inotifyFd, fileWatch);
+    }
+    fileWatch = inotify_add_watch(inotifyFd, path,
+        IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF);
+}
+
+/**
+ * Handles inotify events for the translation file and its directory.
+ */
+static void tioReloadOnNotify(int fd, unsigned events, void *context)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    int replaced = 0;
+
+    for (;;) {
+        const ssize_t len = read(fd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+
+        const char *p = buf;
+        while (p < (buf + len)) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->wd == fileWatch) {
+                if (ev->mask & IN_CLOSE_WRITE) {
+                    changed = 1;
+                }
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    /* old inode is gone, a replacement shows up in the dir */
+                    fileWatch = -1;
+                }
+            } else if ((ev->wd == dirWatch) && (ev->len > 0) &&
+                (strcmp(ev->name, fileName) == 0)) {
+                if (ev->mask & IN_MOVED_TO) {
+                    replaced = 1;
+                } else if (ev->mask & IN_CLOSE_WRITE) {
+                    /* written through a different link to the same name */
+                    changed = 1;
+                    if (fileWatch < 0) {
+                        replaced = 1;
+                    }
+                }
+            }
+        }
+    }
+
+    if (replaced) {
+        tioReloadWatchFile();
+    }
+    if (changed || replaced) {
+        tioReloadRequestForced();
+    }
+}
+
+/**
+ * Polls the file's modification time when inotify isn't available.
+ */
+static void tioReloadOnTimer(int fd, unsigned events, void *context)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) > 0) {
+        tioReloadRequest();
+    }
+}
+
+/**
+ * Sets up inotify watches on the file and its directory.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+static int tioReloadWatch(void)
+{
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        return -1;
+    }
+
+    /* dirname() and basename() may modify their argument */
+    char dirPath[PATH_MAX];
+    char namePath[PATH_MAX];
+    strncpy(dirPath, path, sizeof(dirPath) - 1);
+    dirPath[sizeof(dirPath) - 1] = '\0';
+    strcpy(namePath, dirPath);
+    strncpy(fileName, basename(namePath), sizeof(fileName) - 1);
+
+    dirWatch = inotify_add_watch(inotifyFd, dirname(dirPath),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+    if (dirWatch < 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+        return -1;
+    }
+    tioReloadWatchFile();
+
+    if (tioEventAdd(inotifyFd, TIO_EVENT_READ | TIO_EVENT_EDGE,
+        tioReloadOnNotify, 0) != 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Sets up a timer to poll the file's modification time.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+static int tioReloadPoll(unsigned refreshDelay)
+{
+    pollTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pollTimerFd < 0) {
+        return -1;
+    }
+
+    struct itimerspec interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.it_value.tv_sec = refreshDelay;
+    interval.it_interval.tv_sec = refreshDelay;
+    if ((timerfd_settime(pollTimerFd, 0, &interval, 0) != 0) ||
+        (tioEventAdd(pollTimerFd, TIO_EVENT_READ, tioReloadOnTimer, 0) != 0)) {
+        close(pollTimerFd);
+        pollTimerFd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Loads the translation file for the first time and gets ready to reload it.
+ * The initial load is done synchronously so translations are in place before
+ * any traffic is handled.  The event engine must already be initialized.
+ *
+ * @param translatePath the translation file
+ * @param size the number of translations to preallocate in each set
+ * @param refreshDelay 0 to never reload, otherwise reload when the file
+ *                     changes; if inotify can't be used the file is checked
+ *                     every refreshDelay seconds
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioReloadInit(const char *translatePath, const unsigned short size,
+    unsigned refreshDelay)
+{
+    path = translatePath;
+    mapSize = size;
+
+    reloadFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (reloadFd < 0) {
+        return -1;
+    }
+    if (tioEventAdd(reloadFd, TIO_EVENT_READ, tioReloadOnDone, 0) != 0) {
+        return -1;
+    }
+
+    struct stat filestat;
+    memset(&filestat, 0, sizeof(filestat));
+    if (stat(path, &filestat) != 0) {
+        perror("stat() failed");
+    }
+
+    /* an unreadable file leaves an empty set; a later reload can fix that */
+    TranslatorState *state = newTranslatorState(mapSize);
+    if (loadTranslations(state, path) == 0) {
+        lastModTime = filestat.st_mtime;
+    }
+    atomic_store(&currentState, state);
+
+    if (refreshDelay > 0) {
+        if (tioReloadWatch() == 0) {
+            LogMsg(LOG_INFO, "[TIO] watching %s for changes\n", path);
+        } else {
+            LogMsg(LOG_ERR, "[TIO] inotify failed, errno = %d; checking %s "
+                "every %d seconds\n", errno, path, refreshDelay);
+            if (tioReloadPoll(refreshDelay) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Waits for any reload in progress and frees all translations.
+ */
+void tioReloadClose(void)
+{
+    if (loaderRunning) {
+        pthread_join(loaderThread, 0);
+        loaderRunning = 0;
+    }
+    if (retiredState != 0) {
+        deleteTranslatorState(retiredState);
+        retiredState = 0;
+    }
+
+    TranslatorState *state = atomic_exchange(&currentState, 0);
+    if (state != 0) {
+        deleteTranslatorState(state);
+    }
+
+    if (reloadFd >= 0) {
+        tioEventRemove(reloadFd);
+        close(reloadFd);
+        reloadFd = -1;
+    }
+    if (inotifyFd >= 0) {
+        tioEventRemove(inotifyFd);
+        close(inotifyFd);
+        inotifyFd = -1;
+        fileWatch = -1;
+        dirWatch = -1;
+    }
+    if (pollTimerFd >= 0) {
+        tioEventRemove(pollTimerFd);
+        close(pollTimerFd);
+        pollTimerFd = -1;
+    }
+}
+
+/**
+ * Reloads the translation file in the background if it has been modified.
+ * Returns immediately; the new translations are used as soon as they are
+ * completely loaded.
+ */
+void tioReloadRequest(void)
+{
+    if (loaderRunning || (retiredState != 0)) {
+        /* check again once the current load is done and collected */
+        reloadPending = 1;
+    } else {
+        tioReloadStart();
+    }
+}
+
+/**
+ * Returns the set of translations to use.  The result must not be kept past
+ * the event handler that fetched it.
+ *
+ * @return const TranslatorState* the current translations
+ */
+const TranslatorState *tioTranslatorState(void)
+{
+    return atomic_load_explicit(&currentState, memory_order_acquire);
+}
+
+/**
+ * Frees the set of translations replaced by the last reload once no reader
+ * can still be using it, then starts any reload that was waiting for that.
+ * Called by the event loop thread; cheap when there is nothing to do.
+ */
+void tioReloadCollect(void)
+{
+    if (loaderRunning || (retiredState == 0)) {
+        return;
+    }
+
+    const struct TioReloadReader *reader;
+    for (reader = readers; reader != 0; reader = reader->next) {
+        const uint64_t epoch = atomic_load(&reader->epoch);
+        if ((epoch != 0) && (epoch < retiredEpoch)) {
+            /* still translating with the old set; try again later */
+            return;
+        }
+    }
+
+    deleteTranslatorState(retiredState);
+    retiredState = 0;
+
+    /* the file may have changed again while it was being read */
+    if (reloadPending) {
+        tioReloadStart();
+    }
+}
+
+/**
+ * Registers a thread that will use the translations.  Must be called before
+ * the thread starts.
+ */
+void tioReloadAddReader(struct TioReloadReader *reader)
+{
+    atomic_init(&reader->epoch, 0);
+    reader->next = readers;
+    readers = reader;
+}
+
+/**
+ * Unregisters a reader.  Must be called after its thread has finished.
+ */
+void tioReloadRemoveReader(struct TioReloadReader *reader)
+{
+    struct TioReloadReader **p;
+    for (p = &readers; *p != 0; p = &(*p)->next) {
+        if (*p == reader) {
+            *p = reader->next;
+            break;
+        }
+    }
+}
+
+/**
+ * Returns the set of translations for a reader to use until it calls
+ * tioReloadLeave().
+ *
+ * @param reader the calling thread's registration
+ *
+ * @return const TranslatorState* the current translations
+ */
+const TranslatorState *tioReloadEnter(struct TioReloadReader *reader)
+{
+    /*
+     * Both sequentially consistent, so once tioReloadCollect() has seen this
+     * epoch the set fetched here can't be one retired before it.
+     */
+    atomic_store(&reader->epoch, atomic_load(&reloadEpoch));
+    return atomic_load(&currentState);
+}
+
+/**
+ * Ends a reader's use of the set returned by tioReloadEnter().
+ */
+void tioReloadLeave(struct TioReloadReader *reader)
+{
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
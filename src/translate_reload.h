@@ -0,0 +1,40 @@
+/*
+ * translate_reload.h
+ *
+ * Owns the set of translations in use and replaces it when the translation
+ * file changes.  A reload is parsed into a new TranslatorState on a helper
+ * thread and published with one atomic pointer swap, so the event loop never
+ * waits for it and never sees a partially loaded set.
+ */
+
+#ifndef TRANSLATE_RELOAD_H_
+#define TRANSLATE_RELOAD_H_
+
+#include <stdint.h>
+
+#include "translate_parser.h"
+
+/**
+ * A thread other than the event loop thread that uses the translations.  A
+ * replaced set is only freed once every reader has been seen not using it.
+ */
+struct TioReloadReader
+{
+    /* the reload epoch when it last fetched a set, 0 while not using one */
+    _Atomic uint64_t epoch;
+    struct TioReloadReader *next;
+};
+
+int tioReloadInit(const char *translatePath, const unsigned short mapSize,
+    unsigned refreshDelay);
+void tioReloadClose(void);
+void tioReloadRequest(void);
+void tioReloadCollect(void);
+const TranslatorState *tioTranslatorState(void);
+
+void tioReloadAddReader(struct TioReloadReader *reader);
+void tioReloadRemoveReader(struct TioReloadReader *reader);
+const TranslatorState *tioReloadEnter(struct TioReloadReader *reader);
+void tioReloadLeave(struct TioReloadReader *reader);
+
+#endif /* TRANSLATE_RELOAD_H_ */
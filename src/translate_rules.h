@@ -0,0 +1,316 @@
+/*
+ * translate_rules.h
+ *
+ * Layout of a set of translations.  This is private to the translation
+ * engine (translate_parser.c and translate_image.c); the rest of the agent
+ * only sees the opaque TranslatorState.
+ */
+
+#ifndef TRANSLATE_RULES_H_
+#define TRANSLATE_RULES_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "translate_parser.h"
+
+/* translations are allocated in chunks of this many records */
+#define TRANSLATION_CHUNK_SHIFT 8
+#define TRANSLATION_CHUNK_SIZE (1u << TRANSLATION_CHUNK_SHIFT)
+
+/* the kinds of pieces an output template is compiled into */
+typedef enum { SEGMENT_LITERAL, SEGMENT_INTEGER, SEGMENT_STRING,
+    SEGMENT_CAPTURE } segment_type;
+
+/**
+ * One piece of a compiled output template: either literal text, which is
+ * copied as is, or a place where the value from the input message goes.
+ */
+struct TemplateSegment {
+    /* literal text: position of the first character in the string arena */
+    uint32_t offset;
+    uint16_t length;
+    uint8_t type;
+    uint8_t reserved;
+};
+
+/**
+ * A compiled output template, a run of consecutive segments in the state's
+ * segment array.
+ */
+struct TemplateRef {
+    uint32_t first;
+    uint32_t count;
+};
+
+/**
+ * This structure is a single record of information which is placed into a
+ * translation index.  The key and message text live in the state's string
+ * arena; the record only holds their offsets.  The message is also compiled
+ * into an output template when the translation is added.
+ *
+ * A key with a * in it is a wildcard rule, which goes into a prefix trie
+ * instead of the hash index: the text before the * is the prefix, the text
+ * after it must end the key, and whatever is in between is captured for %*.
+ * A key starting with ~ is a pattern rule, matched by a direction's DFA.
+ */
+struct translate_msg {
+    uint32_t key;
+    uint32_t msg;
+    struct TemplateRef output;
+    uint32_t lineNumber;
+    uint8_t fmt_spec;
+    uint8_t reserved;
+
+    /* position of the * in the key plus one, 0 for an exact key */
+    uint16_t wildcard;
+};
+
+/**
+ * Contiguous storage for the text of all translations.  Each entry is a
+ * 16 bit length followed by the characters and a nul, padded so the next
+ * entry's length is aligned.  Entries are referred to by their offset, which
+ * stays valid when the arena is reallocated to grow.  Offset 0 is always the
+ * empty string.
+ */
+struct StringArena {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+#define ARENA_EMPTY 0
+
+/**
+ * One slot of a translation index.  The key's hash is kept in the slot so a
+ * probe only looks at a translation's key when the hashes already match.
+ */
+struct TranslationSlot {
+    uint32_t hash;
+
+    /* position of the translation in the pool plus one, 0 for empty */
+    uint32_t rule;
+};
+
+/**
+ * An open addressing (linear probing) hash table mapping keys to
+ * translations.  The capacity is always a power of two and at least twice
+ * the count so probe sequences stay short.
+ */
+struct TranslationIndex {
+    struct TranslationSlot *slots;
+    unsigned capacity;
+    unsigned count;
+};
+
+/**
+ * A node of a prefix trie.  The edge leading to it is labelled with text
+ * from the string arena; a node's children are consecutive in the node array
+ * and sorted by the first character of their labels.  The wildcard rules
+ * whose prefix ends at the node are consecutive in the trie's rule array,
+ * sorted by their suffixes read backwards.
+ */
+struct TrieNode {
+    /* position of the label's first character in the string arena */
+    uint32_t label;
+    uint16_t labelLength;
+    uint16_t childCount;
+    uint32_t firstChild;
+    uint32_t firstRule;
+    uint32_t ruleCount;
+};
+
+/**
+ * A compressed radix trie of the prefixes of one direction's wildcard rules,
+ * node 0 being the root.  Rules are collected in pending while a file is
+ * parsed and the trie is built from them once it has been read, so nodeCount
+ * is 0 until then or if there are no wildcard rules.
+ */
+struct TranslationTrie {
+    struct TrieNode *nodes;
+    unsigned nodeCount;
+
+    /* positions of the wildcard rules in the pool */
+    uint32_t *rules;
+    unsigned ruleCount;
+
+    uint32_t *pending;
+    unsigned pendingCount;
+    unsigned pendingCapacity;
+};
+
+/**
+ * A DFA matching the keys of one direction's pattern rules.  State 0 is the
+ * dead state and matching starts in state 1; the state after a byte is
+ * transitions[state * classCount + classes[byte]].  Rules are collected in
+ * pending while a file is parsed and compiled once it has been read, so
+ * stateCount is 0 until then or if there are no pattern rules.
+ */
+struct TranslationDfa {
+    /* the class of each of the 256 byte values */
+    uint8_t *classes;
+    unsigned classCount;
+    unsigned stateCount;
+    uint32_t *transitions;
+
+    /* per state, one more than the rule it accepts, or 0 */
+    uint32_t *accept;
+
+    uint32_t *pending;
+    unsigned pendingCount;
+    unsigned pendingCapacity;
+};
+
+/**
+ * How often messages from one direction were translated each way.
+ */
+struct TranslationCounts {
+    _Atomic uint64_t found;
+    _Atomic uint64_t defaulted;
+    _Atomic uint64_t untranslated;
+};
+
+/**
+ * Usage counters for a set of translations, indexed by TIO_TRACE_FROM_GUI or
+ * TIO_TRACE_FROM_MICRO and by rule.  They are kept apart from the
+ * translations, which may be in a read-only image.  Each counter is only
+ * updated by the thread translating its direction, with -w a translator
+ * thread, but read by the event loop for the stats socket, so they are
+ * atomic: a reader never sees half of a 64 bit update on a 32 bit target.
+ */
+struct TranslationStats {
+    struct TranslationCounts counts[2];
+    _Atomic uint64_t hits[];
+};
+
+/**
+ * Adds one to a usage counter.  There is only one writer, so a relaxed load
+ * and store do without the cost of a locked add.
+ */
+static inline void statsIncrement(_Atomic uint64_t *counter)
+{
+    atomic_store_explicit(counter,
+        atomic_load_explicit(counter, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+/**
+ * Reads a usage counter, possibly while its thread is updating it.
+ */
+static inline uint64_t statsRead(const _Atomic uint64_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * This structure represents the state of the translation maps used by the 
+ * agent.  It contains the free store of translations, maps for both directions 
+ * of message traversal and default messages for each. 
+ */
+struct TranslatorState
+{
+    /* the number of translations allocated from the pool */
+    unsigned translationCount;
+
+    /* the default message to use for messages from the GUI (arena offset) */
+    uint32_t guiDefault;
+
+    /* the default message to use for messages from the micro (arena offset) */
+    uint32_t microDefault;
+
+    /* the default messages compiled into output templates */
+    struct TemplateRef guiDefaultOutput;
+    struct TemplateRef microDefaultOutput;
+
+    /* the segments of all compiled output templates */
+    struct TemplateSegment *segments;
+    unsigned segmentCount;
+    unsigned segmentCapacity;
+
+    /* the text of all keys and messages */
+    struct StringArena strings;
+
+    /* the pool of translation structures that will be put into the maps */
+    struct translate_msg **translationChunks;
+
+    /* the number of chunks allocated for the pool */
+    unsigned chunkCount;
+
+    /* the map of translation messages for messages received from the GUI */
+    struct TranslationIndex guiTranslationMap;
+
+    /* the map of translation messages for messages received from the micro */
+    struct TranslationIndex microTranslationMap;
+
+    /* the wildcard rules for each direction, tried when the maps don't match */
+    struct TranslationTrie guiTrie;
+    struct TranslationTrie microTrie;
+
+    /* the pattern rules for each direction, tried after the tries */
+    struct TranslationDfa guiDfa;
+    struct TranslationDfa microDfa;
+
+    /* usage counters, allocated once loading is done; may be 0 */
+    struct TranslationStats *stats;
+
+    /*
+     * the block holding a compiled translation image, which the arena, pool
+     * chunks, index slots, segments, tries and DFAs point into, 0 if they
+     * were allocated while parsing a text file
+     */
+    void *image;
+    size_t imageSize;
+};
+
+/**
+ * Returns a translation from the pool by its position.  Translations never
+ * move once allocated since the pool grows by adding chunks.
+ */
+static inline struct translate_msg *getTranslation(
+    const TranslatorState *state, unsigned rule)
+{
+    return &state->translationChunks[rule >> TRANSLATION_CHUNK_SHIFT]
+        [rule & (TRANSLATION_CHUNK_SIZE - 1)];
+}
+
+/**
+ * Returns the characters of an arena entry.
+ */
+static inline const char *arenaString(const struct StringArena *arena,
+    uint32_t offset)
+{
+    return arena->data + offset + sizeof(uint16_t);
+}
+
+/**
+ * Returns the number of characters in an arena entry, not counting the nul.
+ */
+static inline size_t arenaLength(const struct StringArena *arena,
+    uint32_t offset)
+{
+    return *(const uint16_t *)(arena->data + offset);
+}
+
+
+/* functions shared within the translation engine */
+void freeTranslations(TranslatorState *state);
+int loadTranslationImage(TranslatorState *state, int fd, const char *filePath);
+int isTranslationImage(int fd);
+void trieAddRule(struct TranslationTrie *trie, uint32_t rule);
+void trieBuild(const TranslatorState *state, struct TranslationTrie *trie,
+    const char *mapName);
+uint32_t trieLookup(const TranslatorState *state,
+    const struct TranslationTrie *trie, const char *key, size_t length,
+    size_t *captureStart, size_t *captureLength);
+void trieClear(struct TranslationTrie *trie);
+void trieFree(struct TranslationTrie *trie);
+void dfaAddRule(struct TranslationDfa *dfa, uint32_t rule);
+void dfaBuild(const TranslatorState *state, struct TranslationDfa *dfa,
+    const char *mapName);
+uint32_t dfaLookup(const struct TranslationDfa *dfa, const char *key,
+    size_t length);
+void dfaClear(struct TranslationDfa *dfa);
+void dfaFree(struct TranslationDfa *dfa);
+
+#endif /* TRANSLATE_RULES_H_ */
@@ -17,6 +17,7 @@
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 #include "translate_agent.h"
 
@@ -69,6 +70,17 @@ int tioQvSocketAccept(int serverFd, int addressFamily)
     return clientFd;
 }
 
+/*
+ * Turn off Nagle's algorithm on a TCP connection so a write goes out
+ * immediately.  The agent gathers its own output, so there is nothing for
+ * Nagle to coalesce.
+ */
+int tioSocketSetNoDelay(int fd)
+{
+    const int enable = 1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+}
+
 static int createTCPServerSocket(unsigned short port)
 {
     struct sockaddr_in addr;
@@ -131,13 +143,3 @@ static int createUnixSocket(const char* path)
 
     return sfd;
 }
-
-void tioQvSocketWrite(int socketFd, const char* buf)
-{
-	LogMsg(LOG_INFO, "[TIO] sending => \"%s\"\n", buf);
-	
-    const size_t cnt = strlen(buf);
-    if ((cnt > 0) && send(socketFd, buf, cnt, 0) != cnt) {
-        perror("send to qml-viewer socket failed");
-    }
-}
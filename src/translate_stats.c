@@ -0,0 +1,260 @@
+/*
+ * translate_stats.c
+ *
+ * Serves snapshots of the agent's counters on a Unix socket, e.g.
+ * socat - UNIX-CONNECT:/tmp/tioStats.  A snapshot is formatted in full when a
+ * client connects and then written by the event loop like any other output,
+ * so a client which doesn't read never holds up the agent.
+ */
+
+#define _GNU_SOURCE  /* for open_memstream() */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "translate_agent.h"
+#include "translate_event.h"
+#include "translate_output.h"
+#include "translate_parser.h"
+#include "translate_reload.h"
+#include "translate_stats.h"
+
+struct TioStats tioStats;
+
+/**
+ * A client being sent a snapshot.
+ */
+struct TioStatsClient
+{
+    int fd;
+    struct TioOutQueue out;
+    struct TioStatsClient *next;
+};
+
+static const char *path;
+static int listenFd = -1;
+static struct TioStatsClient *clients;
+static struct timespec startTime;
+
+static void tioStatsWriteHistogram(FILE *out, const char *name,
+    const char *stage, const struct TioHistogram *histogram)
+{
+    fprintf(out, "%s.%s.count %llu\n%s.%s.p50 %llu\n%s.%s.p99 %llu\n"
+        "%s.%s.p999 %llu\n%s.%s.max %llu\n",
+        name, stage, (unsigned long long)histogram->count,
+        name, stage,
+        (unsigned long long)tioHistogramPercentile(histogram, 500000),
+        name, stage,
+        (unsigned long long)tioHistogramPercentile(histogram, 990000),
+        name, stage,
+        (unsigned long long)tioHistogramPercentile(histogram, 999000),
+        name, stage, (unsigned long long)histogram->max);
+}
+
+static void tioStatsWriteDirection(FILE *out, const char *name,
+    const struct TioDirectionStats *stats)
+{
+    fprintf(out, "%s.messages %llu\n%s.bytes %llu\n%s.discarded %llu\n"
+        "%s.sent %llu\n%s.sent_bytes %llu\n%s.dropped %llu\n",
+        name, (unsigned long long)stats->messages,
+        name, (unsigned long long)stats->bytes,
+        name, (unsigned long long)stats->discarded,
+        name, (unsigned long long)stats->sent,
+        name, (unsigned long long)stats->sentBytes,
+        name, (unsigned long long)stats->dropped);
+    tioStatsWriteHistogram(out, name, "translate_ns", &stats->translateLatency);
+    tioStatsWriteHistogram(out, name, "send_ns", &stats->sendLatency);
+}
+
+static void tioStatsLogHistogram(const char *name,
+    const struct TioHistogram *histogram)
+{
+    LogMsg(LOG_NOTICE, "[TIO] %s: %llu messages, p50 %llu p99 %llu "
+        "p999 %llu max %llu ns\n", name,
+        (unsigned long long)histogram->count,
+        (unsigned long long)tioHistogramPercentile(histogram, 500000),
+        (unsigned long long)tioHistogramPercentile(histogram, 990000),
+        (unsigned long long)tioHistogramPercentile(histogram, 999000),
+        (unsigned long long)histogram->max);
+}
+
+/**
+ * Logs the latency percentiles, e.g. on SIGUSR1.
+ */
+void tioStatsLog(void)
+{
+    tioStatsLogHistogram("gui translate", &tioStats.fromGui.translateLatency);
+    tioStatsLogHistogram("gui to sio-agent", &tioStats.fromGui.sendLatency);
+    tioStatsLogHistogram("micro translate",
+        &tioStats.fromMicro.translateLatency);
+    tioStatsLogHistogram("micro to qml-viewer",
+        &tioStats.fromMicro.sendLatency);
+}
+
+/**
+ * Formats the current counters.
+ *
+ * @param length receives the length of the snapshot
+ *
+ * @return char* the snapshot, to be freed by the caller, or 0 if out of memory
+ */
+static char *tioStatsSnapshot(size_t *length)
+{
+    char *text = 0;
+    FILE *out = open_memstream(&text, length);
+    if (out == 0) {
+        return 0;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(out, "uptime %ld\n", (long)(now.tv_sec - startTime.tv_sec));
+    tioStatsWriteDirection(out, "gui", &tioStats.fromGui);
+    tioStatsWriteDirection(out, "micro", &tioStats.fromMicro);
+    fprintf(out, "sio.connects %llu\nsio.disconnects %llu\n"
+        "viewer.connects %llu\nviewer.disconnects %llu\n"
+        "overflow.disconnects %llu\n",
+        (unsigned long long)tioStats.sioConnects,
+        (unsigned long long)tioStats.sioDisconnects,
+        (unsigned long long)tioStats.viewerConnects,
+        (unsigned long long)tioStats.viewerDisconnects,
+        (unsigned long long)tioStats.overflowDisconnects);
+
+    const TranslatorState *state = tioTranslatorState();
+    if (state != 0) {
+        writeTranslationStats(state, out);
+    }
+
+    if (fclose(out) != 0) {
+        free(text);
+        return 0;
+    }
+    return text;
+}
+
+static void tioStatsCloseClient(struct TioStatsClient *client)
+{
+    struct TioStatsClient **link = &clients;
+    while (*link != client) {
+        link = &(*link)->next;
+    }
+    *link = client->next;
+
+    tioEventRemove(client->fd);
+    close(client->fd);
+    tioOutQueueClear(&client->out);
+    free(client);
+}
+
+static void tioStatsOnClient(int fd, unsigned events, void *context)
+{
+    struct TioStatsClient *client = context;
+
+    /* done once the snapshot is written or the client has gone */
+    if ((events & TIO_EVENT_ERROR) ||
+        (tioOutQueueFlush(&client->out, fd) <= 0)) {
+        tioStatsCloseClient(client);
+    }
+}
+
+/**
+ * Sends a snapshot to a new client.
+ */
+static void tioStatsAccept(int fd)
+{
+    size_t length;
+    char *text = tioStatsSnapshot(&length);
+    struct TioMsgBuf *buf = (text == 0) ? 0 :
+        tioMsgBufCreate(text, length, 0);
+    free(text);
+
+    struct TioStatsClient *client = (buf == 0) ? 0 :
+        calloc(1, sizeof(struct TioStatsClient));
+    if (client == 0) {
+        LogMsg(LOG_ERR, "[TIO] out of memory for stats snapshot\n");
+        if (buf != 0) {
+            tioMsgBufUnref(buf);
+        }
+        close(fd);
+        return;
+    }
+    client->fd = fd;
+    tioOutQueueInit(&client->out);
+    client->next = clients;
+    clients = client;
+
+    const int rv = tioOutQueuePush(&client->out, buf);
+    tioMsgBufUnref(buf);
+    if ((rv != 0) || (tioSetNonBlocking(fd) != 0) ||
+        (tioEventAdd(fd, TIO_EVENT_WRITE, tioStatsOnClient, client) != 0)) {
+        LogMsg(LOG_ERR, "[TIO] could not send stats snapshot, errno = %d\n",
+            errno);
+        tioStatsCloseClient(client);
+    }
+}
+
+static void tioStatsOnListen(int fd, unsigned events, void *context)
+{
+    /* edge triggered, so accept everything that is queued */
+    for (;;) {
+        const int clientFd = tioQvSocketAccept(fd, AF_UNIX);
+        if (clientFd < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                LogMsg(LOG_ERR, "[TIO] accept() on stats socket failed, "
+                    "errno = %d\n", errno);
+            }
+            return;
+        }
+        tioStatsAccept(clientFd);
+    }
+}
+
+/**
+ * Opens the stats socket.  The event engine must already be initialized.
+ *
+ * @param socketPath the Unix socket to listen on, replaced if it exists
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioStatsInit(const char *socketPath)
+{
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+
+    int addressFamily;
+    listenFd = tioQvSocketInit(0, &addressFamily, socketPath);
+    if (listenFd < 0) {
+        return -1;
+    }
+    path = socketPath;
+
+    if ((tioSetNonBlocking(listenFd) != 0) ||
+        (tioEventAdd(listenFd, TIO_EVENT_READ | TIO_EVENT_EDGE,
+            tioStatsOnListen, 0) != 0)) {
+        tioStatsClose();
+        return -1;
+    }
+    LogMsg(LOG_INFO, "[TIO] stats available on %s\n", socketPath);
+    return 0;
+}
+
+/**
+ * Closes the stats socket and any clients still being sent a snapshot.
+ */
+void tioStatsClose(void)
+{
+    while (clients != 0) {
+        tioStatsCloseClient(clients);
+    }
+
+    if (listenFd >= 0) {
+        tioEventRemove(listenFd);
+        close(listenFd);
+        listenFd = -1;
+        unlink(path);
+    }
+}
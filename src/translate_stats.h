@@ -0,0 +1,66 @@
+/*
+ * translate_stats.h
+ *
+ * Counters describing the agent's traffic, and a local socket which hands
+ * out a snapshot of them.  Every connection to the socket receives the
+ * current values as "name value" lines, followed by the usage counters of
+ * the translations in use, and is then closed.
+ */
+
+#ifndef TRANSLATE_STATS_H_
+#define TRANSLATE_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "translate_histogram.h"
+
+/**
+ * Returns the CLOCK_MONOTONIC time in nanoseconds, for latencies.
+ */
+static inline uint64_t tioStatsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+/**
+ * Traffic in one direction: messages received for translation and the
+ * translated messages sent on.
+ */
+struct TioDirectionStats
+{
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t discarded;     /* received with nobody to send them to */
+    uint64_t sent;
+    uint64_t sentBytes;
+    uint64_t dropped;       /* discarded from a full output queue */
+
+    /* nanoseconds from being read to translated, and to written out */
+    struct TioHistogram translateLatency;
+    struct TioHistogram sendLatency;
+};
+
+/**
+ * All of the agent's counters.  Only the event loop thread updates them.
+ */
+struct TioStats
+{
+    struct TioDirectionStats fromGui;
+    struct TioDirectionStats fromMicro;
+    uint64_t sioConnects;
+    uint64_t sioDisconnects;
+    uint64_t viewerConnects;
+    uint64_t viewerDisconnects;
+    uint64_t overflowDisconnects;
+};
+
+extern struct TioStats tioStats;
+
+int tioStatsInit(const char *socketPath);
+void tioStatsClose(void);
+void tioStatsLog(void);
+
+#endif /* TRANSLATE_STATS_H_ */
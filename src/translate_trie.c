@@ -0,0 +1,448 @@
+/*
+ * translate_trie.c
+ *
+ * Prefix tries of wildcard rules.  A rule such as G:meter*.value=%d is
+ * indexed by its prefix "meter" in a compressed radix trie, so finding the
+ * rules whose prefix starts a key takes one walk down the trie, as long as
+ * the key and independent of the number of rules.  The longest prefix wins;
+ * among the rules sharing a prefix the first in the file whose suffix (here
+ * ".value=") ends the key is used.
+ *
+ * The trie is built in one go once a translation file has been read, from
+ * the rules sorted by prefix, into arrays that can be saved in an image and
+ * used from a loaded image as they are.  The rules of a node are sorted by
+ * their suffixes read backwards, so the ones ending a key are found by
+ * binary search however many rules share the prefix, and a rule repeating
+ * another's prefix and suffix sorts next to it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "translate_parser.h"
+#include "translate_rules.h"
+#include "read_line.h"
+
+/**
+ * A wildcard rule's prefix and suffix, while building.
+ */
+struct TrieEntry {
+    const char *prefix;
+    size_t length;
+    const char *suffix;
+    size_t suffixLength;
+    uint32_t rule;
+};
+
+/**
+ * Compares two texts read backwards, from their last characters.
+ */
+static int compareReversed(const char *a, size_t aLength, const char *b,
+    size_t bLength)
+{
+    size_t i;
+    for (i = 0; (i < aLength) && (i < bLength); i++) {
+        const unsigned char x = a[aLength - 1 - i];
+        const unsigned char y = b[bLength - 1 - i];
+        if (x != y) {
+            return (x < y) ? -1 : 1;
+        }
+    }
+    return (aLength < bLength) ? -1 : (aLength > bLength);
+}
+
+/**
+ * Returns the number of characters at the ends of two texts that match.
+ */
+static size_t commonEnding(const char *a, size_t aLength, const char *b,
+    size_t bLength)
+{
+    size_t i = 0;
+    while ((i < aLength) && (i < bLength) &&
+        (a[aLength - 1 - i] == b[bLength - 1 - i])) {
+        i++;
+    }
+    return i;
+}
+
+/* by prefix, then by suffix read backwards, then in file order */
+static int compareEntries(const void *a, const void *b)
+{
+    const struct TrieEntry *x = a;
+    const struct TrieEntry *y = b;
+    const size_t common = (x->length < y->length) ? x->length : y->length;
+    int rv = memcmp(x->prefix, y->prefix, common);
+    if (rv != 0) {
+        return rv;
+    }
+    if (x->length != y->length) {
+        return (x->length < y->length) ? -1 : 1;
+    }
+    rv = compareReversed(x->suffix, x->suffixLength, y->suffix,
+        y->suffixLength);
+    if (rv != 0) {
+        return rv;
+    }
+    return (x->rule < y->rule) ? -1 : (x->rule > y->rule);
+}
+
+/**
+ * Returns the text after the * of a wildcard rule's key.
+ */
+static const char *ruleSuffix(const TranslatorState *state,
+    const struct translate_msg *translation, size_t *length)
+{
+    *length = arenaLength(&state->strings, translation->key) -
+        translation->wildcard;
+    return arenaString(&state->strings, translation->key) +
+        translation->wildcard;
+}
+
+/**
+ * Fills in a node and, recursively, everything below it.
+ *
+ * @param state the translations the rules belong to
+ * @param trie the trie being built, with room for every node
+ * @param nodeIndex the node to fill in, its label already set
+ * @param entries the sorted prefixes which go through the node
+ * @param count the number of entries
+ * @param depth the number of characters of the prefixes the node stands for
+ * @param mapName the name of the direction, for messages
+ */
+static void trieBuildNode(const TranslatorState *state,
+    struct TranslationTrie *trie, uint32_t nodeIndex,
+    const struct TrieEntry *entries, unsigned count, size_t depth,
+    const char *mapName)
+{
+    /*
+     * sorting puts the prefixes which end here first, and a duplicate right
+     * after the first rule with its suffix
+     */
+    const uint32_t firstRule = trie->ruleCount;
+    unsigned i;
+    for (i = 0; (i < count) && (entries[i].length == depth); i++) {
+        const struct TrieEntry *entry = &entries[i];
+        if ((trie->ruleCount > firstRule) &&
+            (compareReversed(entry->suffix, entry->suffixLength,
+                entries[i - 1].suffix, entries[i - 1].suffixLength) == 0)) {
+            const struct translate_msg *translation = getTranslation(state,
+                entry->rule);
+            const struct translate_msg *other = getTranslation(state,
+                trie->rules[trie->ruleCount - 1]);
+            LogMsg(LOG_ERR, "[TIO] translation for key \"%s\" on line %d in %s map "
+                "already defined on line %d.\n",
+                arenaString(&state->strings, translation->key),
+                translation->lineNumber, mapName, other->lineNumber);
+            continue;
+        }
+        trie->rules[trie->ruleCount++] = entry->rule;
+    }
+
+    /* the rest are grouped by their next character, one child per group */
+    unsigned childCount = 0;
+    unsigned j;
+    for (j = i; j < count; j++) {
+        if ((j == i) || (entries[j].prefix[depth] !=
+            entries[j - 1].prefix[depth])) {
+            childCount++;
+        }
+    }
+
+    struct TrieNode *node = &trie->nodes[nodeIndex];
+    node->firstRule = firstRule;
+    node->ruleCount = trie->ruleCount - firstRule;
+    node->firstChild = trie->nodeCount;
+    node->childCount = childCount;
+    uint32_t child = trie->nodeCount;
+    trie->nodeCount += childCount;
+
+    unsigned start = i;
+    while (start < count) {
+        const char next = entries[start].prefix[depth];
+        unsigned end = start + 1;
+        while ((end < count) && (entries[end].prefix[depth] == next)) {
+            end++;
+        }
+
+        /* sorted, so what the first and last share the whole group shares */
+        const struct TrieEntry *first = &entries[start];
+        const struct TrieEntry *last = &entries[end - 1];
+        size_t shared = depth + 1;
+        while ((shared < first->length) && (shared < last->length) &&
+            (first->prefix[shared] == last->prefix[shared])) {
+            shared++;
+        }
+
+        struct TrieNode *childNode = &trie->nodes[child];
+        childNode->label = first->prefix + depth - state->strings.data;
+        childNode->labelLength = shared - depth;
+        trieBuildNode(state, trie, child, first, end - start, shared,
+            mapName);
+
+        child++;
+        start = end;
+    }
+}
+
+/**
+ * Adds a wildcard rule to the rules a trie will be built from.
+ *
+ * @param trie the direction's trie
+ * @param rule the position of the translation in the pool
+ */
+void trieAddRule(struct TranslationTrie *trie, uint32_t rule)
+{
+    if (trie->pendingCount == trie->pendingCapacity) {
+        const unsigned capacity = (trie->pendingCapacity == 0) ? 64 :
+            trie->pendingCapacity * 2;
+        uint32_t *pending = realloc(trie->pending,
+            capacity * sizeof(uint32_t));
+        if (pending == 0) {
+            dieWithSystemMessage("realloc() of wildcard rules failed");
+        }
+        trie->pending = pending;
+        trie->pendingCapacity = capacity;
+    }
+    trie->pending[trie->pendingCount++] = rule;
+}
+
+/**
+ * Builds a trie from the wildcard rules added to it, reporting any rule with
+ * the same prefix and suffix as an earlier one, which is left out.  Sorting
+ * the rules makes this O(r log r) in the number of rules.
+ *
+ * @param state the translations the rules belong to, all loaded
+ * @param trie the direction's trie
+ * @param mapName the name of the direction, for messages
+ */
+void trieBuild(const TranslatorState *state, struct TranslationTrie *trie,
+    const char *mapName)
+{
+    const unsigned count = trie->pendingCount;
+    if (count == 0) {
+        return;
+    }
+
+    /* every node but the root has rules or at least two children */
+    struct TrieEntry *entries = malloc(count * sizeof(struct TrieEntry));
+    struct TrieNode *nodes = realloc(trie->nodes,
+        (2 * count + 1) * sizeof(struct TrieNode));
+    if (nodes != 0) {
+        trie->nodes = nodes;
+    }
+    uint32_t *rules = realloc(trie->rules, count * sizeof(uint32_t));
+    if (rules != 0) {
+        trie->rules = rules;
+    }
+    if ((entries == 0) || (nodes == 0) || (rules == 0)) {
+        dieWithSystemMessage("malloc() of wildcard trie failed");
+    }
+
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        const struct translate_msg *translation = getTranslation(state,
+            trie->pending[i]);
+        entries[i].prefix = arenaString(&state->strings, translation->key);
+        entries[i].length = translation->wildcard - 1;
+        entries[i].suffix = ruleSuffix(state, translation,
+            &entries[i].suffixLength);
+        entries[i].rule = trie->pending[i];
+    }
+    qsort(entries, count, sizeof(struct TrieEntry), compareEntries);
+
+    memset(&trie->nodes[0], 0, sizeof(struct TrieNode));
+    trie->nodeCount = 1;
+    trie->ruleCount = 0;
+    trieBuildNode(state, trie, 0, entries, count, 0, mapName);
+
+    free(entries);
+    trie->pendingCount = 0;
+}
+
+/**
+ * Finds the first rule in the file, among a node's rules, whose suffix ends
+ * the key.  The rules are sorted by suffix read backwards, so a suffix ending
+ * the key sorts at or before the key's tail read backwards.  A binary search
+ * finds the last suffix there; either it ends the key, or it shares some
+ * characters with the key's ending and no longer suffix can.  Each search is
+ * narrowed to a shorter ending than the last, so there are at most as many
+ * searches as characters in the tail.
+ *
+ * @param state the translations the trie refers to
+ * @param trie the direction's trie
+ * @param node the node whose rules to search
+ * @param tail the part of the key after the node's prefix
+ * @param tailLength the number of characters in the tail
+ *
+ * @return uint32_t one more than the index of the translation in the pool, or
+ *         0 if no suffix ends the key
+ */
+static uint32_t trieMatchSuffix(const TranslatorState *state,
+    const struct TranslationTrie *trie, const struct TrieNode *node,
+    const char *tail, size_t tailLength)
+{
+    const uint32_t *const rules = trie->rules + node->firstRule;
+    uint32_t best = 0;
+    uint32_t hi = node->ruleCount;
+    size_t limit = tailLength;
+    while (hi > 0) {
+        /* the last of rules[0, hi) whose suffix sorts at or before the end */
+        const char *ending = tail + tailLength - limit;
+        uint32_t lo = 0;
+        while (lo < hi) {
+            const uint32_t mid = (lo + hi) / 2;
+            size_t suffixLength;
+            const char *suffix = ruleSuffix(state,
+                getTranslation(state, rules[mid]), &suffixLength);
+            if (compareReversed(suffix, suffixLength, ending, limit) <= 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (hi == 0) {
+            break;
+        }
+
+        /* whatever happens it sorts after the next, shorter, ending */
+        hi--;
+        size_t suffixLength;
+        const char *suffix = ruleSuffix(state, getTranslation(state, rules[hi]),
+            &suffixLength);
+        const size_t common = commonEnding(suffix, suffixLength, ending,
+            limit);
+        if (common == suffixLength) {
+            if ((best == 0) || (rules[hi] < (best - 1))) {
+                best = rules[hi] + 1;
+            }
+            if (suffixLength == 0) {
+                break;
+            }
+            limit = suffixLength - 1;
+        } else {
+            limit = common;
+        }
+    }
+    return best;
+}
+
+/**
+ * A node with rules found along a key, and the number of characters of the
+ * key it stands for.
+ */
+struct TrieCandidate {
+    uint32_t node;
+    uint32_t depth;
+};
+
+/**
+ * Finds the wildcard rule for a key: the longest prefix of the key with a
+ * rule whose suffix ends the key.  One walk down the trie collects the nodes
+ * with rules along the key, which are then tried deepest first.
+ *
+ * @param state the translations the trie refers to
+ * @param trie the direction's trie
+ * @param key the key to look for, not necessarily nul terminated
+ * @param length the number of characters in the key
+ * @param captureStart receives the position in key of the text matching the
+ *                     *, if found
+ * @param captureLength receives the length of that text
+ *
+ * @return uint32_t one more than the index of the translation in the pool, or
+ *         0 if not found
+ */
+uint32_t trieLookup(const TranslatorState *state,
+    const struct TranslationTrie *trie, const char *key, size_t length,
+    size_t *captureStart, size_t *captureLength)
+{
+    if (trie->nodeCount == 0) {
+        return 0;
+    }
+
+    /*
+     * every node but the root is at least one character deeper than its
+     * parent, and no prefix is as long as a line
+     */
+    const size_t capacity = ((length < MAX_LINE_SIZE) ? length :
+        MAX_LINE_SIZE) + 1;
+    struct TrieCandidate candidates[capacity];
+    size_t found = 0;
+
+    const char *const text = state->strings.data;
+    const struct TrieNode *node = trie->nodes;
+    size_t depth = 0;
+    for (;;) {
+        if ((node->ruleCount > 0) && (found < capacity)) {
+            candidates[found].node = node - trie->nodes;
+            candidates[found].depth = depth;
+            found++;
+        }
+        if ((depth == length) || (node->childCount == 0)) {
+            break;
+        }
+
+        /* binary search of the children for the next character */
+        const unsigned char next = key[depth];
+        const struct TrieNode *children = &trie->nodes[node->firstChild];
+        unsigned lo = 0;
+        unsigned hi = node->childCount;
+        while (lo < hi) {
+            const unsigned mid = (lo + hi) / 2;
+            if ((unsigned char)text[children[mid].label] < next) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if ((lo == node->childCount) ||
+            ((unsigned char)text[children[lo].label] != next)) {
+            break;
+        }
+
+        const struct TrieNode *child = &children[lo];
+        if ((child->labelLength > (length - depth)) ||
+            (memcmp(text + child->label, key + depth,
+                child->labelLength) != 0)) {
+            break;
+        }
+        depth += child->labelLength;
+        node = child;
+    }
+
+    while (found > 0) {
+        const struct TrieCandidate *candidate = &candidates[--found];
+        const size_t prefixLength = candidate->depth;
+        const uint32_t rule = trieMatchSuffix(state, trie,
+            &trie->nodes[candidate->node], key + prefixLength,
+            length - prefixLength);
+        if (rule != 0) {
+            size_t suffixLength;
+            ruleSuffix(state, getTranslation(state, rule - 1), &suffixLength);
+            *captureStart = prefixLength;
+            *captureLength = length - prefixLength - suffixLength;
+            return rule;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Removes every rule from a trie, keeping its arrays for reuse.
+ */
+void trieClear(struct TranslationTrie *trie)
+{
+    trie->nodeCount = 0;
+    trie->ruleCount = 0;
+    trie->pendingCount = 0;
+}
+
+/**
+ * Releases a trie's arrays.  Not for a trie in a loaded image.
+ */
+void trieFree(struct TranslationTrie *trie)
+{
+    free(trie->nodes);
+    free(trie->rules);
+    free(trie->pending);
+    memset(trie, 0, sizeof(struct TranslationTrie));
+}
@@ -0,0 +1,860 @@
+/*
+ * translate_uring.c
+ *
+ * io_uring(7) based event engine, driven with the raw system calls since
+ * liburing isn't available on the target.  Descriptors registered with
+ * tioEventAdd() are watched with one-shot polls, armed again after each
+ * event.  Stream sockets registered with tioEventAddRecv() have a multishot
+ * recv which takes buffers from a ring of provided buffers until it is
+ * cancelled, so receiving costs no system calls of its own.  A send copies
+ * its data into a buffer that lives until the send completes, which the
+ * kernel waits for by itself if the socket is full.
+ *
+ * New requests are only queued; the system call that waits for events
+ * submits all of them, so a loop iteration's sends and re-armed polls go to
+ * the kernel together.  Only removing a descriptor submits straight away,
+ * since the kernel holds on to it until its requests are cancelled.
+ *
+ * As in translate_event.c each slot has a generation, which is part of every
+ * request's user data so completions for a descriptor that was removed are
+ * dropped.
+ */
+
+#define _GNU_SOURCE  /* for POLLRDHUP */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "translate_uring.h"
+
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(IORING_RECV_MULTISHOT) && !defined(TIO_NO_URING)
+
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SQ_ENTRIES 256
+
+/* buffers provided for receiving; BUFFER_COUNT must be a power of two */
+#define BUFFER_COUNT 64
+#define BUFFER_SIZE 4096
+#define BUFFER_GROUP 0
+
+/* most bytes taken by one send, the rest waits for the next */
+#define MAX_SEND_SIZE 65536
+
+/* the kind of request, in the top byte of its user data */
+#define KIND_SEND   0   /* the user data is the struct TioUringSend */
+#define KIND_POLL   1
+#define KIND_RECV   2
+#define KIND_IGNORE 3   /* cancellations, whose results don't matter */
+
+/* requests a slot has with the kernel */
+#define ARMED_POLL 0x01
+#define ARMED_RECV 0x02
+
+#define GENERATION_MASK 0xffffffu
+
+struct TioUringSend
+{
+    int fd;
+    uint32_t generation;
+    TioSendHandler onSent;
+    void *context;
+    char data[];
+};
+
+struct TioUringSlot
+{
+    TioEventHandler handler;
+    TioRecvHandler onData;      /* 0 for a descriptor that is polled */
+    void *context;
+    unsigned events;
+    uint32_t generation;
+
+    unsigned armed;             /* ARMED_* requests with the kernel */
+    unsigned cancelling;        /* ARMED_* requests being cancelled */
+    uint32_t pollMask;          /* what the armed poll waits for */
+    struct TioUringSend *send;  /* in progress, 0 if none */
+    int dirty;                  /* requests to be brought up to date */
+};
+
+static int ringFd = -1;
+
+/* submission queue, shared with the kernel */
+static void *sqRing;
+static size_t sqRingSize;
+static unsigned *sqHead;
+static unsigned *sqTail;
+static unsigned *sqMask;
+static unsigned *sqArray;
+static unsigned sqEntries;
+static unsigned sqLocalTail;
+static struct io_uring_sqe *sqes;
+static size_t sqesSize;
+
+/* completion queue, in the same mapping as the submission queue */
+static unsigned *cqHead;
+static unsigned *cqTail;
+static unsigned *cqMask;
+static struct io_uring_cqe *cqes;
+
+/* provided buffers */
+static struct io_uring_buf_ring *bufRing;
+static char *buffers;
+static unsigned short bufTail;
+
+static struct TioUringSlot *slots;
+static int slotCount;
+
+/* descriptors whose requests need updating before the next wait */
+static int *dirtyFds;
+static int dirtyCount;
+
+static int ioUringEnter(unsigned toSubmit, unsigned minComplete,
+    unsigned flags, void *arg, size_t argSize)
+{
+    return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags,
+        arg, argSize);
+}
+
+static uint64_t userData(unsigned kind, int fd, uint32_t generation)
+{
+    return ((uint64_t)kind << 56) |
+        ((uint64_t)(generation & GENERATION_MASK) << 32) | (uint32_t)fd;
+}
+
+static struct TioUringSlot *getSlot(int fd)
+{
+    if (fd >= slotCount) {
+        int newCount = (slotCount == 0) ? 64 : slotCount;
+        while (newCount <= fd) {
+            newCount *= 2;
+        }
+        struct TioUringSlot *newSlots = realloc(slots,
+            newCount * sizeof(struct TioUringSlot));
+        if (newSlots == 0) {
+            return 0;
+        }
+        memset(newSlots + slotCount, 0,
+            (newCount - slotCount) * sizeof(struct TioUringSlot));
+        slots = newSlots;
+
+        int *newDirty = realloc(dirtyFds, newCount * sizeof(int));
+        if (newDirty == 0) {
+            return 0;
+        }
+        dirtyFds = newDirty;
+        slotCount = newCount;
+    }
+    return &slots[fd];
+}
+
+static struct TioUringSlot *findSlot(int fd)
+{
+    if ((fd < 0) || (fd >= slotCount) || (slots[fd].handler == 0)) {
+        return 0;
+    }
+    return &slots[fd];
+}
+
+static void markDirty(int fd, struct TioUringSlot *slot)
+{
+    if (!slot->dirty) {
+        slot->dirty = 1;
+        dirtyFds[dirtyCount++] = fd;
+    }
+}
+
+/**
+ * Hands every queued request to the kernel without waiting for any.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+static int tioUringSubmit(void)
+{
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    const unsigned pending = sqLocalTail -
+        __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    while (pending > 0) {
+        if (ioUringEnter(pending, 0, 0, 0, 0) >= 0) {
+            break;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns a cleared submission queue entry to fill in, submitting what is
+ * queued if the queue is full.
+ *
+ * @return struct io_uring_sqe* the entry or 0 if the queue stays full
+ */
+static struct io_uring_sqe *tioUringGetSqe(void)
+{
+    if ((sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) ==
+        sqEntries) {
+        if ((tioUringSubmit() != 0) ||
+            ((sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) ==
+            sqEntries)) {
+            errno = EBUSY;
+            return 0;
+        }
+    }
+
+    const unsigned index = sqLocalTail & *sqMask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    sqLocalTail++;
+    return sqe;
+}
+
+/**
+ * Queues the cancellation of a request.
+ *
+ * @param opcode IORING_OP_POLL_REMOVE for polls, IORING_OP_ASYNC_CANCEL for
+ *               anything else
+ * @param target the user data of the request
+ */
+static void tioUringCancel(uint8_t opcode, uint64_t target)
+{
+    struct io_uring_sqe *sqe = tioUringGetSqe();
+    if (sqe != 0) {
+        sqe->opcode = opcode;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = userData(KIND_IGNORE, 0, 0);
+    }
+}
+
+/**
+ * Gives a provided buffer back to the kernel.
+ */
+static void tioUringRecycle(unsigned short bid)
+{
+    struct io_uring_buf *buf = &bufRing->bufs[bufTail & (BUFFER_COUNT - 1)];
+    buf->addr = (uintptr_t)(buffers + (size_t)bid * BUFFER_SIZE);
+    buf->len = BUFFER_SIZE;
+    buf->bid = bid;
+    bufTail++;
+    __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+static uint32_t toPollMask(unsigned events)
+{
+    uint32_t mask = 0;
+    if (events & TIO_EVENT_READ) {
+        mask |= POLLIN | POLLRDHUP;
+    }
+    if (events & TIO_EVENT_WRITE) {
+        mask |= POLLOUT;
+    }
+    return mask;
+}
+
+static unsigned fromPollMask(uint32_t mask)
+{
+    unsigned events = 0;
+    if (mask & (POLLIN | POLLRDHUP)) {
+        events |= TIO_EVENT_READ;
+    }
+    if (mask & POLLOUT) {
+        events |= TIO_EVENT_WRITE;
+    }
+    if (mask & (POLLERR | POLLHUP)) {
+        /* let the handler see the error through its next read */
+        events |= TIO_EVENT_ERROR | TIO_EVENT_READ;
+    }
+    return events;
+}
+
+/**
+ * Queues whatever requests a slot needs for the events it wants: a poll
+ * matching them, or for a stream socket a multishot recv while it wants to
+ * read.  A poll for the wrong events is cancelled first; the next update
+ * after its completion arms the right one.
+ */
+static void tioUringUpdate(int fd, struct TioUringSlot *slot)
+{
+    struct io_uring_sqe *sqe;
+
+    if (slot->onData != 0) {
+        const int reading = (slot->events & TIO_EVENT_READ) != 0;
+        if (reading && !(slot->armed & ARMED_RECV)) {
+            sqe = tioUringGetSqe();
+            if (sqe != 0) {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = BUFFER_GROUP;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->user_data = userData(KIND_RECV, fd, slot->generation);
+                slot->armed |= ARMED_RECV;
+            }
+        } else if (!reading && (slot->armed & ARMED_RECV) &&
+            !(slot->cancelling & ARMED_RECV)) {
+            tioUringCancel(IORING_OP_ASYNC_CANCEL,
+                userData(KIND_RECV, fd, slot->generation));
+            slot->cancelling |= ARMED_RECV;
+        }
+        return;
+    }
+
+    const uint32_t mask = toPollMask(slot->events);
+    if (slot->armed & ARMED_POLL) {
+        if ((mask != slot->pollMask) && !(slot->cancelling & ARMED_POLL)) {
+            tioUringCancel(IORING_OP_POLL_REMOVE,
+                userData(KIND_POLL, fd, slot->generation));
+            slot->cancelling |= ARMED_POLL;
+        }
+    } else if (mask != 0) {
+        sqe = tioUringGetSqe();
+        if (sqe != 0) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = mask;
+            sqe->user_data = userData(KIND_POLL, fd, slot->generation);
+            slot->armed |= ARMED_POLL;
+            slot->pollMask = mask;
+        }
+    }
+}
+
+static int tioUringOnPoll(int fd, struct TioUringSlot *slot,
+    const struct io_uring_cqe *cqe)
+{
+    slot->armed &= ~ARMED_POLL;
+    slot->cancelling &= ~ARMED_POLL;
+    markDirty(fd, slot);
+    if (cqe->res <= 0) {
+        /* cancelled */
+        return 0;
+    }
+
+    const unsigned events = fromPollMask(cqe->res) &
+        (slot->events | TIO_EVENT_ERROR | TIO_EVENT_READ);
+    if ((events & ~TIO_EVENT_ERROR) == 0) {
+        return 0;
+    }
+    slot->handler(fd, events, slot->context);
+    return 1;
+}
+
+static int tioUringOnRecv(int fd, struct TioUringSlot *slot,
+    const struct io_uring_cqe *cqe)
+{
+    const int hasBuffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+    const unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    char *data = hasBuffer ? (buffers + (size_t)bid * BUFFER_SIZE) : 0;
+    int dispatched = 0;
+
+    if (slot != 0) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            /* finished: cancelled, out of buffers, end of file or error */
+            slot->armed &= ~ARMED_RECV;
+            slot->cancelling &= ~ARMED_RECV;
+            markDirty(fd, slot);
+        }
+        if ((cqe->res != -ENOBUFS) && (cqe->res != -ECANCELED)) {
+            slot->onData(fd, data, cqe->res, slot->context);
+            dispatched = 1;
+        }
+    }
+
+    if (hasBuffer) {
+        tioUringRecycle(bid);
+    }
+    return dispatched;
+}
+
+static int tioUringOnSent(const struct io_uring_cqe *cqe)
+{
+    struct TioUringSend *send = (struct TioUringSend *)(uintptr_t)
+        cqe->user_data;
+    const int fd = send->fd;
+    struct TioUringSlot *slot = findSlot(fd);
+    int dispatched = 0;
+
+    if ((slot != 0) && (slot->generation == send->generation)) {
+        slot->send = 0;
+        send->onSent(fd, cqe->res, send->context);
+        dispatched = 1;
+
+        /* tell it it can write more, unless onSent removed it */
+        if ((slot->handler != 0) && (slot->generation == send->generation) &&
+            (slot->events & TIO_EVENT_WRITE)) {
+            slot->handler(fd, TIO_EVENT_WRITE, slot->context);
+        }
+    }
+    free(send);
+    return dispatched;
+}
+
+static int tioUringComplete(const struct io_uring_cqe *cqe)
+{
+    const unsigned kind = cqe->user_data >> 56;
+    if (kind == KIND_SEND) {
+        return tioUringOnSent(cqe);
+    }
+    if (kind == KIND_IGNORE) {
+        return 0;
+    }
+
+    const int fd = (int)(uint32_t)cqe->user_data;
+    const uint32_t generation = (cqe->user_data >> 32) & GENERATION_MASK;
+    struct TioUringSlot *slot = findSlot(fd);
+    if ((slot != 0) && ((slot->generation & GENERATION_MASK) != generation)) {
+        /* removed, and the descriptor possibly reused */
+        slot = 0;
+    }
+
+    if (kind == KIND_RECV) {
+        /* stale or not, a buffer it took has to go back */
+        return tioUringOnRecv(fd, slot, cqe);
+    }
+    return (slot == 0) ? 0 : tioUringOnPoll(fd, slot, cqe);
+}
+
+/**
+ * Makes sure multishot recv is supported by receiving a byte with it.
+ *
+ * @return int 0 if it is, -1 if not with errno set
+ */
+static int tioUringProbe(void)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return -1;
+    }
+
+    int rv = -1;
+    struct io_uring_sqe *sqe = tioUringGetSqe();
+    if ((sqe != 0) && (write(pair[1], "", 1) == 1)) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = pair[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = userData(KIND_IGNORE, 0, 0);
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+        if (ioUringEnter(1, 1, IORING_ENTER_GETEVENTS, 0, 0) >= 0) {
+            const unsigned head = *cqHead;
+            const struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+            if ((cqe->res == 1) && (cqe->flags & IORING_CQE_F_MORE)) {
+                rv = 0;
+            } else {
+                errno = (cqe->res < 0) ? -cqe->res : EINVAL;
+            }
+            if (cqe->flags & IORING_CQE_F_BUFFER) {
+                tioUringRecycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        }
+
+        /* its last completion is ignored whenever it turns up */
+        tioUringCancel(IORING_OP_ASYNC_CANCEL, userData(KIND_IGNORE, 0, 0));
+        tioUringSubmit();
+    }
+
+    close(pair[0]);
+    close(pair[1]);
+    return rv;
+}
+
+/**
+ * Sets up the rings and the provided buffers.
+ *
+ * @return int 0 on success, -1 on failure with errno set
+ */
+int tioUringInit(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, SQ_ENTRIES, &params);
+    if (ringFd < 0) {
+        return -1;
+    }
+
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+        IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        tioUringClose();
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* one mapping holds both rings */
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    const size_t cqRingSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cqRingSize > sqRingSize) {
+        sqRingSize = cqRingSize;
+    }
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = 0;
+        tioUringClose();
+        return -1;
+    }
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = mmap(0, sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        sqes = 0;
+        tioUringClose();
+        return -1;
+    }
+
+    char *const base = sqRing;
+    sqHead = (unsigned *)(base + params.sq_off.head);
+    sqTail = (unsigned *)(base + params.sq_off.tail);
+    sqMask = (unsigned *)(base + params.sq_off.ring_mask);
+    sqArray = (unsigned *)(base + params.sq_off.array);
+    sqEntries = params.sq_entries;
+    sqLocalTail = *sqTail;
+    cqHead = (unsigned *)(base + params.cq_off.head);
+    cqTail = (unsigned *)(base + params.cq_off.tail);
+    cqMask = (unsigned *)(base + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(base + params.cq_off.cqes);
+
+    void *ring;
+    if (posix_memalign(&ring, sysconf(_SC_PAGESIZE),
+        BUFFER_COUNT * sizeof(struct io_uring_buf)) != 0) {
+        tioUringClose();
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(ring, 0, BUFFER_COUNT * sizeof(struct io_uring_buf));
+    bufRing = ring;
+    buffers = malloc((size_t)BUFFER_COUNT * BUFFER_SIZE);
+    if (buffers == 0) {
+        tioUringClose();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)bufRing;
+    reg.ring_entries = BUFFER_COUNT;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING,
+        &reg, 1) != 0) {
+        tioUringClose();
+        return -1;
+    }
+    unsigned short i;
+    for (i = 0; i < BUFFER_COUNT; i++) {
+        tioUringRecycle(i);
+    }
+
+    if (tioUringProbe() != 0) {
+        const int probeErrno = errno;
+        tioUringClose();
+        errno = probeErrno;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Releases the rings.  Sends still in progress are abandoned.
+ */
+void tioUringClose(void)
+{
+    if (ringFd >= 0) {
+        if (bufRing != 0) {
+            struct io_uring_buf_reg reg;
+            memset(&reg, 0, sizeof(reg));
+            reg.bgid = BUFFER_GROUP;
+            syscall(__NR_io_uring_register, ringFd,
+                IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        }
+        close(ringFd);
+        ringFd = -1;
+    }
+    if (sqes != 0) {
+        munmap(sqes, sqesSize);
+        sqes = 0;
+    }
+    if (sqRing != 0) {
+        munmap(sqRing, sqRingSize);
+        sqRing = 0;
+    }
+    free(bufRing);
+    bufRing = 0;
+    free(buffers);
+    buffers = 0;
+    bufTail = 0;
+    free(slots);
+    slots = 0;
+    slotCount = 0;
+    free(dirtyFds);
+    dirtyFds = 0;
+    dirtyCount = 0;
+}
+
+int tioUringAdd(int fd, unsigned events, TioEventHandler handler,
+    TioRecvHandler onData, void *context)
+{
+    if (fcntl(fd, F_GETFD) < 0) {
+        return -1;
+    }
+    struct TioUringSlot *slot = getSlot(fd);
+    if (slot == 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (slot->handler != 0) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    slot->generation++;
+    slot->handler = handler;
+    slot->onData = onData;
+    slot->context = context;
+    slot->events = events;
+    slot->armed = 0;
+    slot->cancelling = 0;
+    slot->send = 0;
+    markDirty(fd, slot);
+    return 0;
+}
+
+int tioUringModify(int fd, unsigned events)
+{
+    struct TioUringSlot *slot = findSlot(fd);
+    if (slot == 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (slot->events != events) {
+        slot->events = events;
+        markDirty(fd, slot);
+    }
+    return 0;
+}
+
+void tioUringRemove(int fd)
+{
+    struct TioUringSlot *slot = findSlot(fd);
+    if (slot == 0) {
+        return;
+    }
+
+    if (slot->armed & ARMED_RECV) {
+        tioUringCancel(IORING_OP_ASYNC_CANCEL,
+            userData(KIND_RECV, fd, slot->generation));
+    }
+    if (slot->armed & ARMED_POLL) {
+        tioUringCancel(IORING_OP_POLL_REMOVE,
+            userData(KIND_POLL, fd, slot->generation));
+    }
+    if (slot->send != 0) {
+        tioUringCancel(IORING_OP_ASYNC_CANCEL, (uintptr_t)slot->send);
+    }
+
+    slot->handler = 0;
+    slot->onData = 0;
+    slot->context = 0;
+    slot->events = 0;
+    slot->armed = 0;
+    slot->cancelling = 0;
+    slot->send = 0;
+    slot->generation++;
+
+    /* let go of the descriptor before the caller closes it */
+    tioUringSubmit();
+}
+
+/**
+ * Submits the queued requests, waits for completions and calls their
+ * handlers.
+ *
+ * @param timeoutMs maximum time to wait in milliseconds, -1 waits forever
+ *
+ * @return int the number of handlers called, 0 on timeout or -1 on failure
+ *         with errno set (EINTR when interrupted by a signal)
+ */
+int tioUringWait(int timeoutMs)
+{
+    int i;
+    for (i = 0; i < dirtyCount; i++) {
+        struct TioUringSlot *slot = &slots[dirtyFds[i]];
+        slot->dirty = 0;
+        if (slot->handler != 0) {
+            tioUringUpdate(dirtyFds[i], slot);
+        }
+    }
+    dirtyCount = 0;
+
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    const unsigned pending = sqLocalTail -
+        __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    int interrupted = 0;
+
+    if ((timeoutMs != 0) &&
+        (*cqHead == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))) {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (timeoutMs > 0) {
+            ts.tv_sec = timeoutMs / 1000;
+            ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+            arg.ts = (uintptr_t)&ts;
+        }
+        if (ioUringEnter(pending, 1,
+            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+            sizeof(arg)) < 0) {
+            if (errno == EINTR) {
+                interrupted = 1;
+            } else if (errno != ETIME) {
+                return -1;
+            }
+        }
+    } else if ((pending > 0) && (tioUringSubmit() != 0)) {
+        return -1;
+    }
+
+    int dispatched = 0;
+    unsigned head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe cqe = cqes[head & *cqMask];
+        head++;
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        dispatched += tioUringComplete(&cqe);
+    }
+
+    if ((dispatched == 0) && interrupted) {
+        errno = EINTR;
+        return -1;
+    }
+    return dispatched;
+}
+
+int tioUringCanSend(int fd)
+{
+    const struct TioUringSlot *slot = findSlot(fd);
+    return (slot != 0) && (slot->onData != 0);
+}
+
+int tioUringSend(int fd, const struct iovec *iov, unsigned iovCount,
+    TioSendHandler onSent, void *context)
+{
+    struct TioUringSlot *slot = findSlot(fd);
+    if ((slot == 0) || (slot->onData == 0)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    size_t length = 0;
+    unsigned i;
+    for (i = 0; i < iovCount; i++) {
+        length += iov[i].iov_len;
+    }
+    if (length > MAX_SEND_SIZE) {
+        length = MAX_SEND_SIZE;
+    }
+
+    struct TioUringSend *send = malloc(sizeof(struct TioUringSend) + length);
+    if (send == 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t copied = 0;
+    for (i = 0; (i < iovCount) && (copied < length); i++) {
+        size_t part = iov[i].iov_len;
+        if (part > (length - copied)) {
+            part = length - copied;
+        }
+        memcpy(send->data + copied, iov[i].iov_base, part);
+        copied += part;
+    }
+
+    struct io_uring_sqe *sqe = tioUringGetSqe();
+    if (sqe == 0) {
+        free(send);
+        return -1;
+    }
+    send->fd = fd;
+    send->generation = slot->generation;
+    send->onSent = onSent;
+    send->context = context;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)send->data;
+    sqe->len = length;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)send;
+    slot->send = send;
+    return 0;
+}
+
+#else /* no io_uring with multishot recv in the kernel headers */
+
+int tioUringInit(void)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void tioUringClose(void)
+{
+}
+
+int tioUringAdd(int fd, unsigned events, TioEventHandler handler,
+    TioRecvHandler onData, void *context)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int tioUringModify(int fd, unsigned events)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+void tioUringRemove(int fd)
+{
+}
+
+int tioUringWait(int timeoutMs)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int tioUringCanSend(int fd)
+{
+    return 0;
+}
+
+int tioUringSend(int fd, const struct iovec *iov, unsigned iovCount,
+    TioSendHandler onSent, void *context)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
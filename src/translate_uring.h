@@ -0,0 +1,24 @@
+/*
+ * translate_uring.h
+ *
+ * io_uring(7) backend of the event engine.  Only translate_event.c calls
+ * these; everyone else goes through the tioEvent functions.
+ */
+
+#ifndef TRANSLATE_URING_H_
+#define TRANSLATE_URING_H_
+
+#include "translate_event.h"
+
+int tioUringInit(void);
+void tioUringClose(void);
+int tioUringAdd(int fd, unsigned events, TioEventHandler handler,
+    TioRecvHandler onData, void *context);
+int tioUringModify(int fd, unsigned events);
+void tioUringRemove(int fd);
+int tioUringWait(int timeoutMs);
+int tioUringCanSend(int fd);
+int tioUringSend(int fd, const struct iovec *iov, unsigned iovCount,
+    TioSendHandler onSent, void *context);
+
+#endif /* TRANSLATE_URING_H_ */